@@ -12,17 +12,42 @@
 #ifndef EGGS_SQLITE_HPP
 #define EGGS_SQLITE_HPP
 
+#include <eggs/sqlite/aggregate.hpp>
+#include <eggs/sqlite/allocator.hpp>
+#include <eggs/sqlite/approximate.hpp>
+#include <eggs/sqlite/backup.hpp>
 #include <eggs/sqlite/blob.hpp>
+#include <eggs/sqlite/carray.hpp>
+#include <eggs/sqlite/checkpoint_scheduler.hpp>
+#include <eggs/sqlite/collation.hpp>
 #include <eggs/sqlite/conversion_traits.hpp>
 #include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/durability.hpp>
 #include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/file_control.hpp>
+#include <eggs/sqlite/function.hpp>
+#include <eggs/sqlite/instrumented_vfs.hpp>
+#include <eggs/sqlite/knn_table.hpp>
+#include <eggs/sqlite/memory_vfs.hpp>
+#include <eggs/sqlite/mmap_vfs.hpp>
 #include <eggs/sqlite/mutex.hpp>
+#include <eggs/sqlite/page_cache.hpp>
 #include <eggs/sqlite/pragma.hpp>
 #include <eggs/sqlite/raw_traits.hpp>
+#include <eggs/sqlite/readahead_vfs.hpp>
 #include <eggs/sqlite/row.hpp>
 #include <eggs/sqlite/sequence.hpp>
+#include <eggs/sqlite/sequence_table.hpp>
+#include <eggs/sqlite/similarity.hpp>
 #include <eggs/sqlite/statement.hpp>
+#include <eggs/sqlite/statement_cache.hpp>
 #include <eggs/sqlite/statement_iterator.hpp>
+#include <eggs/sqlite/statement_registry.hpp>
+#include <eggs/sqlite/status.hpp>
 #include <eggs/sqlite/transaction.hpp>
+#include <eggs/sqlite/vacuum_scheduler.hpp>
+#include <eggs/sqlite/vfs.hpp>
+#include <eggs/sqlite/virtual_table.hpp>
+#include <eggs/sqlite/warm_up.hpp>
 
 #endif /*EGGS_SQLITE_HPP*/
@@ -0,0 +1,310 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/aggregate.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_AGGREGATE_HPP
+#define EGGS_SQLITE_AGGREGATE_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/function.hpp>
+#include <eggs/sqlite/raw_traits.hpp>
+
+#include <boost/function_types/parameter_types.hpp>
+#include <boost/function_types/result_type.hpp>
+
+#include <boost/fusion/include/as_vector.hpp>
+#include <boost/fusion/include/fold.hpp>
+#include <boost/fusion/include/invoke.hpp>
+#include <boost/fusion/include/mpl.hpp>
+#include <boost/fusion/include/push_front.hpp>
+
+#include <boost/mpl/placeholders.hpp>
+#include <boost/mpl/pop_front.hpp>
+#include <boost/mpl/size.hpp>
+#include <boost/mpl/transform.hpp>
+
+#include <boost/static_assert.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+#include <new>
+#include <string>
+
+namespace eggs { namespace sqlite {
+
+    namespace detail {
+
+        // the state of a group lives in memory owned by SQLite, which comes
+        // zeroed and is released by SQLite once the group is done with; that
+        // memory is only aligned to 8 bytes
+        template< typename State >
+        struct aggregate_storage
+        {
+            BOOST_STATIC_ASSERT(( boost::alignment_of< State >::value <= 8 ));
+
+            State& state()
+            {
+                return *static_cast< State* >( static_cast< void* >( &storage ) );
+            }
+
+            bool constructed;
+            typename boost::aligned_storage<
+                sizeof( State ), boost::alignment_of< State >::value
+            >::type storage;
+        };
+
+        template< typename State >
+        inline aggregate_storage< State >* aggregate_context( sqlite3_context* context, bool create )
+        {
+            aggregate_storage< State >* storage =
+                static_cast< aggregate_storage< State >* >(
+                    sqlite3_aggregate_context( context, create ? sizeof( aggregate_storage< State > ) : 0 ) );
+            if( storage == 0 && create )
+            {
+                throw std::bad_alloc();
+            }
+
+            if( storage != 0 && create && !storage->constructed )
+            {
+                new ( &storage->storage ) State();
+                storage->constructed = true;
+            }
+            return storage;
+        }
+
+        template< typename State >
+        class aggregate_destroy
+        {
+        public:
+            explicit aggregate_destroy( aggregate_storage< State >& storage )
+              : _storage( storage )
+            {}
+
+            ~aggregate_destroy()
+            {
+                _storage.state().~State();
+                _storage.constructed = false;
+            }
+
+        private:
+            aggregate_storage< State >& _storage;
+        };
+
+        // the arguments taken by a member function, held by value
+        template< typename Member >
+        struct member_arguments
+          : boost::fusion::result_of::as_vector<
+                typename boost::mpl::transform<
+                    typename boost::mpl::pop_front<
+                        typename boost::function_types::parameter_types< Member >::type
+                    >::type
+                  , function_argument< boost::mpl::_1 >
+                >::type
+            >
+        {};
+
+        template< typename Member >
+        struct member_arity
+          : boost::mpl::size< typename member_arguments< Member >::type >
+        {};
+
+        template< typename Member >
+        struct member_result
+          : function_argument<
+                typename boost::function_types::result_type< Member >::type
+            >
+        {};
+
+        template< typename State, typename Member >
+        inline void call_member( State& state, Member member, sqlite3_value** values )
+        {
+            typename member_arguments< Member >::type arguments;
+            boost::fusion::fold( arguments, 0, function_argument_fold( values ) );
+
+            boost::fusion::invoke( member, boost::fusion::push_front( arguments, &state ) );
+        }
+
+        template< typename State, typename Step >
+        void aggregate_step( sqlite3_context* context, int /*count*/, sqlite3_value** values )
+        {
+            try
+            {
+                aggregate_storage< State >* storage = aggregate_context< State >( context, true );
+                call_member( storage->state(), static_cast< Step >( &State::step ), values );
+            } catch( ... ) {
+                function_error( context );
+            }
+        }
+
+        // groups with no rows never had their state constructed
+        template< typename State, typename Final >
+        void aggregate_final( sqlite3_context* context )
+        {
+            typedef typename member_result< Final >::type result_type;
+
+            try
+            {
+                aggregate_storage< State >* storage = aggregate_context< State >( context, false );
+                if( storage != 0 && storage->constructed )
+                {
+                    aggregate_destroy< State > destroy( *storage );
+                    raw_traits< result_type >::result( context, storage->state().final() );
+                } else {
+                    State state;
+                    raw_traits< result_type >::result( context, state.final() );
+                }
+            } catch( ... ) {
+                function_error( context );
+            }
+        }
+
+        template< typename State, typename Step, typename Final >
+        inline int create_aggregate( sqlite3* db, char const* name, int flags, Step, Final )
+        {
+            return
+                sqlite3_create_function_v2(
+                    db, name
+                  , member_arity< Step >::value
+                  , SQLITE_UTF8 | flags
+                  , 0
+                  , 0, &aggregate_step< State, Step >, &aggregate_final< State, Final >
+                  , 0
+                );
+        }
+
+#   if SQLITE_VERSION_NUMBER >= 3025000
+        template< typename State, typename Inverse >
+        void aggregate_inverse( sqlite3_context* context, int /*count*/, sqlite3_value** values )
+        {
+            try
+            {
+                aggregate_storage< State >* storage = aggregate_context< State >( context, true );
+                call_member( storage->state(), static_cast< Inverse >( &State::inverse ), values );
+            } catch( ... ) {
+                function_error( context );
+            }
+        }
+
+        template< typename State, typename Value >
+        void aggregate_value( sqlite3_context* context )
+        {
+            typedef typename member_result< Value >::type result_type;
+
+            try
+            {
+                aggregate_storage< State >* storage = aggregate_context< State >( context, true );
+                raw_traits< result_type >::result( context, storage->state().value() );
+            } catch( ... ) {
+                function_error( context );
+            }
+        }
+
+        template< typename State, typename Step, typename Final, typename Inverse, typename Value >
+        inline int create_window_function( sqlite3* db, char const* name, int flags, Step, Final, Inverse, Value )
+        {
+            return
+                sqlite3_create_window_function(
+                    db, name
+                  , member_arity< Step >::value
+                  , SQLITE_UTF8 | flags
+                  , 0
+                  , &aggregate_step< State, Step >, &aggregate_final< State, Final >
+                  , &aggregate_value< State, Value >, &aggregate_inverse< State, Inverse >
+                  , 0
+                );
+        }
+#   endif
+
+    } // namespace detail
+
+    // makes an aggregate function callable from sql; a State is default
+    // constructed for every group, in memory provided by SQLite, and has
+    //
+    //   void step( Args... ); // called for every row in the group
+    //   Result final();       // called once, the state is destroyed after
+    //
+    // arguments and result are converted as for create_function
+    template< typename State >
+    inline void create_aggregate(
+        database& db, std::string const& name
+      , int flags, boost::system::error_code& error_code
+    )
+    {
+        int const result =
+            detail::create_aggregate< State >(
+                db.native_handle(), name.c_str(), flags
+              , &State::step, &State::final
+            );
+        error_code.assign( result, sqlite_category() );
+    }
+    template< typename State >
+    inline void create_aggregate(
+        database& db, std::string const& name
+      , int flags = function_flags::none
+    )
+    {
+        int const result =
+            detail::create_aggregate< State >(
+                db.native_handle(), name.c_str(), flags
+              , &State::step, &State::final
+            );
+        if( result != SQLITE_OK )
+        {
+            BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+        }
+    }
+
+#if SQLITE_VERSION_NUMBER >= 3025000
+    // makes an aggregate function that can also be used over a window frame,
+    // the State additionally has
+    //
+    //   void inverse( Args... ); // called for every row leaving the frame
+    //   Result value();          // the result for the current frame
+    template< typename State >
+    inline void create_window_function(
+        database& db, std::string const& name
+      , int flags, boost::system::error_code& error_code
+    )
+    {
+        int const result =
+            detail::create_window_function< State >(
+                db.native_handle(), name.c_str(), flags
+              , &State::step, &State::final, &State::inverse, &State::value
+            );
+        error_code.assign( result, sqlite_category() );
+    }
+    template< typename State >
+    inline void create_window_function(
+        database& db, std::string const& name
+      , int flags = function_flags::none
+    )
+    {
+        int const result =
+            detail::create_window_function< State >(
+                db.native_handle(), name.c_str(), flags
+              , &State::step, &State::final, &State::inverse, &State::value
+            );
+        if( result != SQLITE_OK )
+        {
+            BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+        }
+    }
+#endif
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_AGGREGATE_HPP*/
@@ -0,0 +1,926 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/allocator.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_ALLOCATOR_HPP
+#define EGGS_SQLITE_ALLOCATOR_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/error.hpp>
+
+#include <boost/assert.hpp>
+
+#include <boost/atomic.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <vector>
+
+#if defined( _WIN32 )
+#   include <windows.h>
+#elif defined( __unix__ ) || defined( __APPLE__ )
+#   include <sys/mman.h>
+#endif
+
+#if defined( _MSC_VER )
+#   define EGGS_SQLITE_THREAD_LOCAL __declspec( thread )
+#else
+#   define EGGS_SQLITE_THREAD_LOCAL __thread
+#endif
+
+namespace eggs { namespace sqlite {
+
+    struct allocator
+    {
+        enum enum_type
+        {
+            system
+          , pool
+          , arena
+        };
+    };
+
+    struct size_class_statistics
+    {
+        std::size_t size;
+        boost::uint64_t allocations;
+        boost::uint64_t deallocations;
+        boost::uint64_t cache_hits;
+    };
+
+    struct allocator_statistics
+    {
+        std::vector< size_class_statistics > size_classes;
+        size_class_statistics large;
+    };
+
+    struct static_memory
+    {
+        static_memory()
+          : page_slot_size( 0 )
+          , page_slot_count( 0 )
+          , scratch_slot_size( 0 )
+          , scratch_slot_count( 0 )
+          , huge_pages( false )
+        {}
+
+        // page slots must fit a database page plus the per-page header of the
+        // page cache; a count of zero leaves that pool to the heap
+        int page_slot_size;
+        int page_slot_count;
+        int scratch_slot_size;
+        int scratch_slot_count;
+        bool huge_pages;
+    };
+
+    namespace detail {
+
+        // every block is preceded by a header holding its usable size, which
+        // keeps the user pointer 8-byte aligned as SQLite requires
+        std::size_t const allocator_header_size = 8;
+
+        // 16-byte steps up to 128 bytes, then 4 steps per power of two
+        std::size_t const pool_size_class_count = 40;
+        std::size_t const pool_max_block_size = 32768;
+
+        inline std::size_t pool_size_class( std::size_t size )
+        {
+            BOOST_ASSERT(( size > 0 && size <= pool_max_block_size ));
+
+            if( size <= 128 )
+                return ( size - 1 ) >> 4;
+
+            std::size_t shift = 7;
+            while( ( ( size - 1 ) >> ( shift + 1 ) ) != 0 )
+                ++shift;
+
+            return 8 + ( shift - 7 ) * 4 + ( ( ( size - 1 ) >> ( shift - 2 ) ) & 3 );
+        }
+
+        inline std::size_t pool_block_size( std::size_t size_class )
+        {
+            BOOST_ASSERT(( size_class < pool_size_class_count ));
+
+            if( size_class < 8 )
+                return ( size_class + 1 ) << 4;
+
+            std::size_t const shift = 7 + ( size_class - 8 ) / 4;
+            return ( std::size_t( 1 ) << shift ) + ( ( size_class - 8 ) % 4 + 1 ) * ( std::size_t( 1 ) << ( shift - 2 ) );
+        }
+
+        inline std::size_t pool_batch_size( std::size_t size_class )
+        {
+            return std::min< std::size_t >( 64, std::max< std::size_t >( 2, 32768 / pool_block_size( size_class ) ) );
+        }
+
+        inline void* allocator_block( void* header, std::size_t size )
+        {
+            *static_cast< boost::uint64_t* >( header ) = size;
+
+            return static_cast< unsigned char* >( header ) + allocator_header_size;
+        }
+        inline void* allocator_header( void* block )
+        {
+            return static_cast< unsigned char* >( block ) - allocator_header_size;
+        }
+        inline std::size_t allocator_size( void* block )
+        {
+            return static_cast< std::size_t >( *static_cast< boost::uint64_t* >( allocator_header( block ) ) );
+        }
+
+        // counters are only ever written by their owning thread, so relaxed
+        // loads and stores suffice and no cache line is shared between writers
+        struct allocator_counters
+        {
+            allocator_counters()
+            {
+                allocations.store( 0, boost::memory_order_relaxed );
+                deallocations.store( 0, boost::memory_order_relaxed );
+                cache_hits.store( 0, boost::memory_order_relaxed );
+            }
+
+            static void increment( boost::atomic< boost::uint64_t >& counter )
+            {
+                counter.store( counter.load( boost::memory_order_relaxed ) + 1, boost::memory_order_relaxed );
+            }
+
+            void accumulate( size_class_statistics& statistics ) const
+            {
+                statistics.allocations += allocations.load( boost::memory_order_relaxed );
+                statistics.deallocations += deallocations.load( boost::memory_order_relaxed );
+                statistics.cache_hits += cache_hits.load( boost::memory_order_relaxed );
+            }
+
+            boost::atomic< boost::uint64_t > allocations;
+            boost::atomic< boost::uint64_t > deallocations;
+            boost::atomic< boost::uint64_t > cache_hits;
+        };
+
+        struct pool_free_node
+        {
+            pool_free_node* next;
+        };
+
+        struct pool_thread_cache
+        {
+            pool_thread_cache()
+              : generation( 0 )
+              , previous( 0 )
+              , next( 0 )
+            {
+                std::fill( free_list, free_list + pool_size_class_count, static_cast< pool_free_node* >( 0 ) );
+                std::fill( free_count, free_count + pool_size_class_count, 0 );
+            }
+
+            unsigned generation;
+            pool_free_node* free_list[ pool_size_class_count ];
+            std::size_t free_count[ pool_size_class_count ];
+            allocator_counters counters[ pool_size_class_count ];
+            allocator_counters large;
+
+            pool_thread_cache* previous;
+            pool_thread_cache* next;
+        };
+
+        inline pool_thread_cache*& pool_local_cache()
+        {
+            static EGGS_SQLITE_THREAD_LOCAL pool_thread_cache* cache = 0;
+
+            return cache;
+        }
+
+        class pool_allocator
+        {
+        public:
+            static pool_allocator& instance()
+            {
+                static pool_allocator instance;
+
+                return instance;
+            }
+
+            void* allocate( std::size_t size )
+            {
+                std::size_t const block_size = size + allocator_header_size;
+                pool_thread_cache& cache = local_cache();
+
+                if( block_size > pool_max_block_size )
+                {
+                    void* header = std::malloc( block_size );
+                    if( header == 0 )
+                        return 0;
+
+                    allocator_counters::increment( cache.large.allocations );
+                    return allocator_block( header, size );
+                }
+
+                std::size_t const size_class = pool_size_class( block_size );
+                if( cache.free_list[ size_class ] != 0 )
+                {
+                    allocator_counters::increment( cache.counters[ size_class ].cache_hits );
+                } else if( !refill( cache, size_class ) ) {
+                    return 0;
+                }
+
+                pool_free_node* node = cache.free_list[ size_class ];
+                cache.free_list[ size_class ] = node->next;
+                --cache.free_count[ size_class ];
+
+                allocator_counters::increment( cache.counters[ size_class ].allocations );
+                return allocator_block( node, pool_block_size( size_class ) - allocator_header_size );
+            }
+
+            void deallocate( void* block )
+            {
+                std::size_t const block_size = allocator_size( block ) + allocator_header_size;
+                pool_thread_cache& cache = local_cache();
+
+                if( block_size > pool_max_block_size )
+                {
+                    allocator_counters::increment( cache.large.deallocations );
+                    std::free( allocator_header( block ) );
+                    return;
+                }
+
+                std::size_t const size_class = pool_size_class( block_size );
+                pool_free_node* node = static_cast< pool_free_node* >( allocator_header( block ) );
+                node->next = cache.free_list[ size_class ];
+                cache.free_list[ size_class ] = node;
+                ++cache.free_count[ size_class ];
+
+                allocator_counters::increment( cache.counters[ size_class ].deallocations );
+                if( cache.free_count[ size_class ] > 2 * pool_batch_size( size_class ) )
+                {
+                    release( cache, size_class, pool_batch_size( size_class ) );
+                }
+            }
+
+            void shutdown()
+            {
+                for( std::size_t i = 0; i < pool_size_class_count; ++i )
+                {
+                    boost::mutex::scoped_lock lock( _central[ i ].mutex );
+                    _central[ i ].head = 0;
+                    _central[ i ].count = 0;
+                }
+
+                boost::mutex::scoped_lock lock( _slab_mutex );
+                for( std::size_t i = 0; i < _slabs.size(); ++i )
+                {
+                    std::free( _slabs[ i ] );
+                }
+                _slabs.clear();
+
+                // thread caches hold blocks from the slabs just released, they
+                // drop their contents the next time their thread allocates
+                ++_generation;
+            }
+
+            void statistics( allocator_statistics& result )
+            {
+                boost::mutex::scoped_lock lock( _registry_mutex );
+
+                for( std::size_t i = 0; i < pool_size_class_count; ++i )
+                {
+                    _retired[ i ].accumulate( result.size_classes[ i ] );
+                }
+                _retired_large.accumulate( result.large );
+
+                for( pool_thread_cache* cache = _caches; cache != 0; cache = cache->next )
+                {
+                    for( std::size_t i = 0; i < pool_size_class_count; ++i )
+                    {
+                        cache->counters[ i ].accumulate( result.size_classes[ i ] );
+                    }
+                    cache->large.accumulate( result.large );
+                }
+            }
+
+        private:
+            pool_allocator()
+              : _caches( 0 )
+              , _generation( 0 )
+              , _local( &pool_allocator::retire )
+            {}
+
+            pool_thread_cache& local_cache()
+            {
+                pool_thread_cache* cache = pool_local_cache();
+                if( cache == 0 )
+                {
+                    cache = new pool_thread_cache;
+                    cache->generation = _generation.load( boost::memory_order_relaxed );
+                    {
+                        boost::mutex::scoped_lock lock( _registry_mutex );
+                        cache->next = _caches;
+                        if( _caches != 0 )
+                            _caches->previous = cache;
+                        _caches = cache;
+                    }
+
+                    _local.reset( cache );
+                    pool_local_cache() = cache;
+                } else if( cache->generation != _generation.load( boost::memory_order_relaxed ) ) {
+                    std::fill( cache->free_list, cache->free_list + pool_size_class_count, static_cast< pool_free_node* >( 0 ) );
+                    std::fill( cache->free_count, cache->free_count + pool_size_class_count, 0 );
+                    cache->generation = _generation.load( boost::memory_order_relaxed );
+                }
+                return *cache;
+            }
+
+            bool refill( pool_thread_cache& cache, std::size_t size_class )
+            {
+                std::size_t const batch = pool_batch_size( size_class );
+                {
+                    central_list& central = _central[ size_class ];
+                    boost::mutex::scoped_lock lock( central.mutex );
+                    for( std::size_t i = 0; i < batch && central.head != 0; ++i )
+                    {
+                        pool_free_node* node = central.head;
+                        central.head = node->next;
+                        --central.count;
+
+                        node->next = cache.free_list[ size_class ];
+                        cache.free_list[ size_class ] = node;
+                        ++cache.free_count[ size_class ];
+                    }
+                }
+                if( cache.free_list[ size_class ] != 0 )
+                    return true;
+
+                std::size_t const block_size = pool_block_size( size_class );
+                std::size_t const block_count = std::max< std::size_t >( 8, 65536 / block_size );
+                unsigned char* slab = static_cast< unsigned char* >( std::malloc( block_size * block_count ) );
+                if( slab == 0 )
+                    return false;
+                {
+                    boost::mutex::scoped_lock lock( _slab_mutex );
+                    _slabs.push_back( slab );
+                }
+
+                for( std::size_t i = 0; i < block_count; ++i )
+                {
+                    pool_free_node* node = reinterpret_cast< pool_free_node* >( slab + i * block_size );
+                    node->next = cache.free_list[ size_class ];
+                    cache.free_list[ size_class ] = node;
+                    ++cache.free_count[ size_class ];
+                }
+                if( cache.free_count[ size_class ] > 2 * batch )
+                {
+                    release( cache, size_class, cache.free_count[ size_class ] - batch );
+                }
+                return true;
+            }
+
+            void release( pool_thread_cache& cache, std::size_t size_class, std::size_t count )
+            {
+                pool_free_node* head = cache.free_list[ size_class ];
+                pool_free_node* tail = head;
+                for( std::size_t i = 1; i < count; ++i )
+                {
+                    tail = tail->next;
+                }
+                cache.free_list[ size_class ] = tail->next;
+                cache.free_count[ size_class ] -= count;
+
+                central_list& central = _central[ size_class ];
+                boost::mutex::scoped_lock lock( central.mutex );
+                tail->next = central.head;
+                central.head = head;
+                central.count += count;
+            }
+
+            static void retire( pool_thread_cache* cache )
+            {
+                pool_allocator& self = instance();
+                if( cache->generation == self._generation.load( boost::memory_order_relaxed ) )
+                {
+                    for( std::size_t i = 0; i < pool_size_class_count; ++i )
+                    {
+                        if( cache->free_count[ i ] != 0 )
+                            self.release( *cache, i, cache->free_count[ i ] );
+                    }
+                }
+
+                {
+                    boost::mutex::scoped_lock lock( self._registry_mutex );
+                    for( std::size_t i = 0; i < pool_size_class_count; ++i )
+                    {
+                        fold( self._retired[ i ], cache->counters[ i ] );
+                    }
+                    fold( self._retired_large, cache->large );
+
+                    if( cache->previous != 0 )
+                        cache->previous->next = cache->next;
+                    else
+                        self._caches = cache->next;
+                    if( cache->next != 0 )
+                        cache->next->previous = cache->previous;
+                }
+
+                pool_local_cache() = 0;
+                delete cache;
+            }
+
+            static void fold( allocator_counters& target, allocator_counters const& source )
+            {
+                target.allocations.fetch_add( source.allocations.load( boost::memory_order_relaxed ), boost::memory_order_relaxed );
+                target.deallocations.fetch_add( source.deallocations.load( boost::memory_order_relaxed ), boost::memory_order_relaxed );
+                target.cache_hits.fetch_add( source.cache_hits.load( boost::memory_order_relaxed ), boost::memory_order_relaxed );
+            }
+
+        private:
+            struct central_list
+            {
+                central_list()
+                  : head( 0 )
+                  , count( 0 )
+                {}
+
+                boost::mutex mutex;
+                pool_free_node* head;
+                std::size_t count;
+            };
+
+            central_list _central[ pool_size_class_count ];
+
+            boost::mutex _slab_mutex;
+            std::vector< void* > _slabs;
+
+            boost::mutex _registry_mutex;
+            pool_thread_cache* _caches;
+            allocator_counters _retired[ pool_size_class_count ];
+            allocator_counters _retired_large;
+
+            boost::atomic< unsigned > _generation;
+            boost::thread_specific_ptr< pool_thread_cache > _local;
+        };
+
+        std::size_t const arena_chunk_size = 1 << 20;
+
+        // a bump allocator for short-lived batch processes; memory is never
+        // reused and is only given back when SQLite shuts down
+        class arena_allocator
+        {
+        public:
+            static arena_allocator& instance()
+            {
+                static arena_allocator instance;
+
+                return instance;
+            }
+
+            void* allocate( std::size_t size )
+            {
+                std::size_t const block_size = ( size + allocator_header_size + 7 ) & ~std::size_t( 7 );
+
+                boost::mutex::scoped_lock lock( _mutex );
+                if( block_size > static_cast< std::size_t >( _end - _cursor ) )
+                {
+                    std::size_t const new_chunk_size = std::max< std::size_t >( arena_chunk_size, block_size );
+                    unsigned char* chunk = static_cast< unsigned char* >( std::malloc( new_chunk_size ) );
+                    if( chunk == 0 )
+                        return 0;
+
+                    _chunks.push_back( chunk );
+                    _cursor = chunk;
+                    _end = chunk + new_chunk_size;
+                }
+
+                _last = _cursor;
+                _cursor += block_size;
+
+                count( block_size ).allocations += 1;
+                return allocator_block( _last, block_size - allocator_header_size );
+            }
+
+            void deallocate( void* block )
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+                count( allocator_size( block ) + allocator_header_size ).deallocations += 1;
+            }
+
+            void* reallocate( void* block, std::size_t size )
+            {
+                std::size_t const block_size = ( size + allocator_header_size + 7 ) & ~std::size_t( 7 );
+                {
+                    boost::mutex::scoped_lock lock( _mutex );
+                    if( allocator_header( block ) == _last
+                     && block_size <= static_cast< std::size_t >( _end - _last ) )
+                    {
+                        _cursor = _last + block_size;
+                        allocator_block( _last, block_size - allocator_header_size );
+
+                        return block;
+                    }
+                }
+
+                void* result = allocate( size );
+                if( result != 0 )
+                {
+                    std::memcpy( result, block, std::min( size, allocator_size( block ) ) );
+                    deallocate( block );
+                }
+                return result;
+            }
+
+            void shutdown()
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+                for( std::size_t i = 0; i < _chunks.size(); ++i )
+                {
+                    std::free( _chunks[ i ] );
+                }
+                _chunks.clear();
+                _cursor = _end = _last = 0;
+            }
+
+            void statistics( allocator_statistics& result )
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+                for( std::size_t i = 0; i < pool_size_class_count; ++i )
+                {
+                    result.size_classes[ i ].allocations += _counters[ i ].allocations;
+                    result.size_classes[ i ].deallocations += _counters[ i ].deallocations;
+                    result.size_classes[ i ].cache_hits += _counters[ i ].cache_hits;
+                }
+                result.large.allocations += _large.allocations;
+                result.large.deallocations += _large.deallocations;
+                result.large.cache_hits += _large.cache_hits;
+            }
+
+        private:
+            arena_allocator()
+              : _cursor( 0 )
+              , _end( 0 )
+              , _last( 0 )
+            {
+                std::memset( _counters, 0, sizeof( _counters ) );
+                std::memset( &_large, 0, sizeof( _large ) );
+            }
+
+            size_class_statistics& count( std::size_t block_size )
+            {
+                return
+                    block_size <= pool_max_block_size
+                  ? _counters[ pool_size_class( block_size ) ]
+                  : _large;
+            }
+
+        private:
+            boost::mutex _mutex;
+            std::vector< unsigned char* > _chunks;
+            unsigned char* _cursor;
+            unsigned char* _end;
+            unsigned char* _last;
+
+            size_class_statistics _counters[ pool_size_class_count ];
+            size_class_statistics _large;
+        };
+
+        template< typename Allocator >
+        struct allocator_methods
+        {
+            static void* malloc( int size )
+            {
+                return Allocator::instance().allocate( size );
+            }
+
+            static void free( void* block )
+            {
+                Allocator::instance().deallocate( block );
+            }
+
+            static void* realloc( void* block, int size )
+            {
+                if( static_cast< std::size_t >( size ) <= allocator_size( block ) )
+                    return block;
+
+                void* result = Allocator::instance().allocate( size );
+                if( result != 0 )
+                {
+                    std::memcpy( result, block, allocator_size( block ) );
+                    Allocator::instance().deallocate( block );
+                }
+                return result;
+            }
+
+            static int size( void* block )
+            {
+                return static_cast< int >( allocator_size( block ) );
+            }
+
+            static int roundup( int size )
+            {
+                std::size_t const block_size = size + allocator_header_size;
+
+                return static_cast< int >(
+                    block_size <= pool_max_block_size
+                  ? pool_block_size( pool_size_class( block_size ) ) - allocator_header_size
+                  : ( static_cast< std::size_t >( size ) + 7 ) & ~std::size_t( 7 )
+                );
+            }
+
+            static int init( void* )
+            {
+                return SQLITE_OK;
+            }
+
+            static void shutdown( void* )
+            {
+                Allocator::instance().shutdown();
+            }
+
+            static sqlite3_mem_methods* get()
+            {
+                static sqlite3_mem_methods methods =
+                {
+                    &malloc, &free, &realloc, &size, &roundup
+                  , &init, &shutdown, 0
+                };
+
+                return &methods;
+            }
+        };
+
+        template<>
+        inline void* allocator_methods< arena_allocator >::realloc( void* block, int size )
+        {
+            return arena_allocator::instance().reallocate( block, size );
+        }
+
+        class memory_region
+        {
+        public:
+            memory_region()
+              : _address( 0 )
+              , _size( 0 )
+            {}
+
+            ~memory_region()
+            {
+                release();
+            }
+
+            bool allocate( std::size_t size, bool huge_pages )
+            {
+                BOOST_ASSERT(( _address == 0 ));
+
+#           if defined( _WIN32 )
+                if( huge_pages && GetLargePageMinimum() != 0 )
+                {
+                    std::size_t const large_size = ( size + GetLargePageMinimum() - 1 ) & ~( GetLargePageMinimum() - 1 );
+                    _address = VirtualAlloc( 0, large_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE );
+                }
+                if( _address == 0 )
+                {
+                    _address = VirtualAlloc( 0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+                }
+#           elif defined( __unix__ ) || defined( __APPLE__ )
+                void* address = MAP_FAILED;
+#               if defined( MAP_HUGETLB )
+                if( huge_pages )
+                {
+                    std::size_t const huge_size = ( size + ( 1 << 21 ) - 1 ) & ~std::size_t( ( 1 << 21 ) - 1 );
+                    address = mmap( 0, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+                    if( address != MAP_FAILED )
+                        size = huge_size;
+                }
+#               endif
+                if( address == MAP_FAILED )
+                {
+                    address = mmap( 0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+#               if defined( MADV_HUGEPAGE )
+                    if( huge_pages && address != MAP_FAILED )
+                        madvise( address, size, MADV_HUGEPAGE );
+#               endif
+                }
+                _address = address != MAP_FAILED ? address : 0;
+#           else
+                _address = std::malloc( size );
+#           endif
+                _size = size;
+
+                return _address != 0;
+            }
+
+            void release()
+            {
+                if( _address == 0 )
+                    return;
+
+#           if defined( _WIN32 )
+                VirtualFree( _address, 0, MEM_RELEASE );
+#           elif defined( __unix__ ) || defined( __APPLE__ )
+                munmap( _address, _size );
+#           else
+                std::free( _address );
+#           endif
+                _address = 0;
+                _size = 0;
+            }
+
+            void swap( memory_region& right )
+            {
+                std::swap( _address, right._address );
+                std::swap( _size, right._size );
+            }
+
+            unsigned char* address() const
+            {
+                return static_cast< unsigned char* >( _address );
+            }
+
+        private:
+            memory_region( memory_region const& );
+            memory_region& operator =( memory_region const& );
+
+        private:
+            void* _address;
+            std::size_t _size;
+        };
+
+        inline void configure_static_memory(
+            static_memory const& memory
+          , boost::system::error_code* error_code = 0
+        )
+        {
+            // regions are kept for the life of the process once SQLite took
+            // them, as it may still reference them after being reconfigured
+            static std::vector< memory_region* > installed_regions;
+
+            std::size_t const scratch_slot_size = ( static_cast< std::size_t >( memory.scratch_slot_size ) + 7 ) & ~std::size_t( 7 );
+            std::size_t const scratch_size = scratch_slot_size * memory.scratch_slot_count;
+            std::size_t const page_size = static_cast< std::size_t >( memory.page_slot_size ) * memory.page_slot_count;
+
+            int result = result_code::ok;
+
+            memory_region region;
+            if( scratch_size + page_size != 0 && !region.allocate( scratch_size + page_size, memory.huge_pages ) )
+            {
+                result = result_code::no_mem;
+            }
+
+            bool installed = false;
+            if( result == result_code::ok && memory.scratch_slot_count != 0 )
+            {
+                result =
+                    sqlite3_config(
+                        SQLITE_CONFIG_SCRATCH
+                      , region.address()
+                      , static_cast< int >( scratch_slot_size ), memory.scratch_slot_count
+                    );
+                installed = result == result_code::ok;
+            }
+            if( result == result_code::ok && memory.page_slot_count != 0 )
+            {
+                result =
+                    sqlite3_config(
+                        SQLITE_CONFIG_PAGECACHE
+                      , region.address() + scratch_size
+                      , memory.page_slot_size, memory.page_slot_count
+                    );
+                installed = installed || result == result_code::ok;
+            }
+
+            if( installed )
+            {
+                installed_regions.push_back( new memory_region() );
+                installed_regions.back()->swap( region );
+            }
+
+            if( error_code != 0 )
+            {
+                error_code->assign( result, sqlite_category() );
+            } else if( result != result_code::ok ) {
+                BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+            }
+        }
+
+        inline allocator::enum_type& current_allocator()
+        {
+            static allocator::enum_type current = allocator::system;
+
+            return current;
+        }
+
+        inline void configure_allocator(
+            allocator::enum_type kind
+          , boost::system::error_code* error_code = 0
+        )
+        {
+            static sqlite3_mem_methods system_methods;
+            static bool system_methods_saved = false;
+
+            int result = result_code::ok;
+            if( !system_methods_saved )
+            {
+                result = sqlite3_config( SQLITE_CONFIG_GETMALLOC, &system_methods );
+                system_methods_saved = ( result == result_code::ok );
+            }
+
+            if( result == result_code::ok )
+            {
+                switch( kind )
+                {
+                case allocator::system:
+                    result = sqlite3_config( SQLITE_CONFIG_MALLOC, &system_methods );
+                    break;
+                case allocator::pool:
+                    pool_allocator::instance();
+                    result = sqlite3_config( SQLITE_CONFIG_MALLOC, allocator_methods< pool_allocator >::get() );
+                    break;
+                case allocator::arena:
+                    arena_allocator::instance();
+                    result = sqlite3_config( SQLITE_CONFIG_MALLOC, allocator_methods< arena_allocator >::get() );
+                    break;
+                default:
+                    BOOST_ASSERT(( false ));
+                    result = result_code::misuse;
+                    break;
+                }
+            }
+
+            if( result == result_code::ok )
+                current_allocator() = kind;
+
+            if( error_code != 0 )
+            {
+                error_code->assign( result, sqlite_category() );
+            } else if( result != result_code::ok ) {
+                BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+            }
+        }
+
+    } // namespace detail
+
+    // must be called before the first database is opened, or after
+    // sqlite3_shutdown, otherwise SQLite reports misuse
+    inline void configure_allocator( allocator::enum_type kind, boost::system::error_code& error_code )
+    {
+        detail::configure_allocator( kind, &error_code );
+    }
+    inline void configure_allocator( allocator::enum_type kind )
+    {
+        detail::configure_allocator( kind );
+    }
+
+    // backs the page cache and scratch pools with a single region allocated
+    // up front, so that steady-state queries perform no heap allocations;
+    // like configure_allocator it must precede the first database opened
+    inline void configure_static_memory( static_memory const& memory, boost::system::error_code& error_code )
+    {
+        detail::configure_static_memory( memory, &error_code );
+    }
+    inline void configure_static_memory( static_memory const& memory )
+    {
+        detail::configure_static_memory( memory );
+    }
+
+    inline allocator_statistics get_allocator_statistics()
+    {
+        allocator_statistics result;
+
+        size_class_statistics empty = {};
+        result.size_classes.assign( detail::pool_size_class_count, empty );
+        for( std::size_t i = 0; i < detail::pool_size_class_count; ++i )
+        {
+            result.size_classes[ i ].size = detail::pool_block_size( i ) - detail::allocator_header_size;
+        }
+        result.large = empty;
+
+        switch( detail::current_allocator() )
+        {
+        case allocator::pool:
+            detail::pool_allocator::instance().statistics( result );
+            break;
+        case allocator::arena:
+            detail::arena_allocator::instance().statistics( result );
+            break;
+        default:
+            break;
+        }
+
+        return result;
+    }
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_ALLOCATOR_HPP*/
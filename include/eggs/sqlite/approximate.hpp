@@ -0,0 +1,518 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/approximate.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_APPROXIMATE_HPP
+#define EGGS_SQLITE_APPROXIMATE_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/aggregate.hpp>
+#include <eggs/sqlite/blob.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/function.hpp>
+#include <eggs/sqlite/raw_traits.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <boost/optional.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace eggs { namespace sqlite {
+
+    namespace detail {
+
+        // the finalizer of MurmurHash3
+        inline boost::uint64_t mix_hash( boost::uint64_t value )
+        {
+            value ^= value >> 33;
+            value *= 0xff51afd7ed558ccdULL;
+            value ^= value >> 33;
+            value *= 0xc4ceb9fe1a85ec53ULL;
+            value ^= value >> 33;
+            return value;
+        }
+
+        inline boost::uint64_t hash_bytes( void const* bytes, std::size_t size, boost::uint64_t seed )
+        {
+            unsigned char const* input = static_cast< unsigned char const* >( bytes );
+            boost::uint64_t hash = seed ^ ( size * 0x9e3779b97f4a7c15ULL );
+            for( ; size >= 8; input += 8, size -= 8 )
+            {
+                boost::uint64_t word;
+                std::memcpy( &word, input, 8 );
+                hash = ( hash ^ mix_hash( word ) ) * 0x9e3779b97f4a7c15ULL;
+            }
+            boost::uint64_t tail = 0;
+            if( size != 0 )
+                std::memcpy( &tail, input, size );
+            return mix_hash( hash ^ tail );
+        }
+
+        // values that compare equal in sql hash the same, so 1 and 1.0 do
+        inline boost::uint64_t hash_value( sqlite3_value* value )
+        {
+            switch( sqlite3_value_type( value ) )
+            {
+            case SQLITE_INTEGER:
+                return mix_hash( static_cast< boost::uint64_t >( sqlite3_value_int64( value ) ) );
+            case SQLITE_FLOAT:
+                {
+                    double const real = sqlite3_value_double( value );
+                    if( real >= -9.2e18 && real <= 9.2e18 && real == std::floor( real ) )
+                        return mix_hash( static_cast< boost::uint64_t >( static_cast< boost::int64_t >( real ) ) );
+                    return hash_bytes( &real, sizeof( real ), 1 );
+                }
+            case SQLITE_TEXT:
+                return hash_bytes( sqlite3_value_text( value ), sqlite3_value_bytes( value ), 2 );
+            default:
+                return hash_bytes( sqlite3_value_blob( value ), sqlite3_value_bytes( value ), 3 );
+            }
+        }
+
+        inline void check_state( bool valid )
+        {
+            if( !valid )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( result_code::mismatch ) );
+            }
+        }
+
+    } // namespace detail
+
+    // estimates the number of distinct values added, within about 1.04 over
+    // the square root of 2^precision, using 2^precision bytes
+    class hyperloglog
+    {
+    public:
+        explicit hyperloglog( int precision = 14 )
+          : _precision( precision )
+          , _registers( std::size_t( 1 ) << precision, 0 )
+        {}
+
+        void add( boost::uint64_t hash )
+        {
+            std::size_t const index = static_cast< std::size_t >( hash >> ( 64 - _precision ) );
+            boost::uint64_t const rest = hash << _precision;
+
+            // the position of the first set bit among the rest
+            unsigned char rank = 1;
+            for( boost::uint64_t bit = boost::uint64_t( 1 ) << 63; rank <= 64 - _precision && ( rest & bit ) == 0; bit >>= 1 )
+                ++rank;
+
+            _registers[ index ] = (std::max)( _registers[ index ], rank );
+        }
+
+        void merge( hyperloglog const& other )
+        {
+            detail::check_state( other._precision == _precision );
+
+            for( std::size_t i = 0; i < _registers.size(); ++i )
+                _registers[ i ] = (std::max)( _registers[ i ], other._registers[ i ] );
+        }
+
+        boost::int64_t estimate() const
+        {
+            double const m = double( _registers.size() );
+
+            double sum = 0;
+            std::size_t zeros = 0;
+            for( std::size_t i = 0; i < _registers.size(); ++i )
+            {
+                sum += std::ldexp( 1.0, -_registers[ i ] );
+                if( _registers[ i ] == 0 )
+                    ++zeros;
+            }
+
+            double estimate = 0.7213 / ( 1 + 1.079 / m ) * m * m / sum;
+
+            // small cardinalities are better served by linear counting
+            if( estimate <= 2.5 * m && zeros != 0 )
+                estimate = m * std::log( m / double( zeros ) );
+            return static_cast< boost::int64_t >( estimate + 0.5 );
+        }
+
+        // a version byte, the precision, and the registers
+        blob serialize() const
+        {
+            std::vector< unsigned char > bytes;
+            bytes.reserve( _registers.size() + 2 );
+            bytes.push_back( 1 );
+            bytes.push_back( static_cast< unsigned char >( _precision ) );
+            bytes.insert( bytes.end(), _registers.begin(), _registers.end() );
+            return blob( bytes.begin(), bytes.end() );
+        }
+
+        static hyperloglog deserialize( void const* bytes, std::size_t size )
+        {
+            unsigned char const* input = static_cast< unsigned char const* >( bytes );
+            detail::check_state( size >= 2 && input[ 0 ] == 1 && input[ 1 ] >= 4 && input[ 1 ] <= 18 );
+
+            hyperloglog result( input[ 1 ] );
+            detail::check_state( size == result._registers.size() + 2 );
+            std::copy( input + 2, input + size, result._registers.begin() );
+            return result;
+        }
+
+    private:
+        int _precision;
+        std::vector< unsigned char > _registers;
+    };
+
+    // estimates quantiles of the values added with a merging t-digest, most
+    // accurate towards the tails, keeping about compression centroids
+    class tdigest
+    {
+    public:
+        explicit tdigest( double compression = 100 )
+          : _compression( compression )
+          , _count( 0 )
+          , _min( std::numeric_limits< double >::infinity() )
+          , _max( -std::numeric_limits< double >::infinity() )
+        {}
+
+        void add( double value, double weight = 1 )
+        {
+            if( value != value )
+                return;
+
+            _buffer.push_back( centroid( value, weight ) );
+            _count += weight;
+            _min = (std::min)( _min, value );
+            _max = (std::max)( _max, value );
+            if( _buffer.size() >= buffer_size() )
+                compress();
+        }
+
+        void merge( tdigest const& other )
+        {
+            for( std::size_t i = 0; i < other._centroids.size(); ++i )
+                add( other._centroids[ i ].mean, other._centroids[ i ].weight );
+            for( std::size_t i = 0; i < other._buffer.size(); ++i )
+                add( other._buffer[ i ].mean, other._buffer[ i ].weight );
+            _min = (std::min)( _min, other._min );
+            _max = (std::max)( _max, other._max );
+        }
+
+        double count() const
+        {
+            return _count;
+        }
+
+        // the value below which the given fraction of values fall, null if
+        // nothing was added
+        boost::optional< double > quantile( double fraction )
+        {
+            compress();
+            if( _centroids.empty() )
+                return boost::none;
+
+            fraction = (std::min)( (std::max)( fraction, 0.0 ), 1.0 );
+            if( _centroids.size() == 1 )
+                return _centroids[ 0 ].mean;
+
+            // values are interpolated between the centers of the centroids,
+            // and towards the extremes at either end
+            double const index = fraction * _count;
+            double center = _centroids[ 0 ].weight / 2;
+            if( index < center )
+                return _min + ( _centroids[ 0 ].mean - _min ) * ( index / center );
+
+            for( std::size_t i = 0; i + 1 < _centroids.size(); ++i )
+            {
+                double const next = center + ( _centroids[ i ].weight + _centroids[ i + 1 ].weight ) / 2;
+                if( index < next )
+                {
+                    return _centroids[ i ].mean
+                      + ( _centroids[ i + 1 ].mean - _centroids[ i ].mean ) * ( ( index - center ) / ( next - center ) );
+                }
+                center = next;
+            }
+
+            double const last = _count - center;
+            return last > 0
+              ? _centroids.back().mean + ( _max - _centroids.back().mean ) * (std::min)( ( index - center ) / last, 1.0 )
+              : _max;
+        }
+
+        // a version byte, compression, count, min and max, and the centroids
+        // as pairs of mean and weight; doubles in native byte order
+        blob serialize()
+        {
+            compress();
+
+            std::vector< double > values;
+            values.reserve( 4 + 2 * _centroids.size() );
+            values.push_back( _compression );
+            values.push_back( _count );
+            values.push_back( _min );
+            values.push_back( _max );
+            for( std::size_t i = 0; i < _centroids.size(); ++i )
+            {
+                values.push_back( _centroids[ i ].mean );
+                values.push_back( _centroids[ i ].weight );
+            }
+
+            std::vector< unsigned char > bytes( 1 + values.size() * sizeof( double ) );
+            bytes[ 0 ] = 1;
+            std::memcpy( &bytes[ 1 ], &values[ 0 ], values.size() * sizeof( double ) );
+            return blob( bytes.begin(), bytes.end() );
+        }
+
+        static tdigest deserialize( void const* bytes, std::size_t size )
+        {
+            unsigned char const* input = static_cast< unsigned char const* >( bytes );
+            detail::check_state( size >= 1 + 4 * sizeof( double ) && input[ 0 ] == 1 && ( size - 1 ) % ( 2 * sizeof( double ) ) == 0 );
+
+            std::vector< double > values( ( size - 1 ) / sizeof( double ) );
+            std::memcpy( &values[ 0 ], input + 1, values.size() * sizeof( double ) );
+
+            // the compression sizes the buffers, a corrupt one could ask for
+            // none or for far too much memory; comparisons reject nan too
+            detail::check_state( values[ 0 ] >= 1 && values[ 0 ] <= max_compression() );
+
+            tdigest result( values[ 0 ] );
+            result._count = values[ 1 ];
+            result._min = values[ 2 ];
+            result._max = values[ 3 ];
+            for( std::size_t i = 4; i < values.size(); i += 2 )
+                result._centroids.push_back( centroid( values[ i ], values[ i + 1 ] ) );
+            return result;
+        }
+
+    private:
+        struct centroid
+        {
+            centroid( double mean, double weight )
+              : mean( mean )
+              , weight( weight )
+            {}
+
+            bool operator <( centroid const& right ) const
+            {
+                return mean < right.mean;
+            }
+
+            double mean;
+            double weight;
+        };
+
+        static double max_compression()
+        {
+            return 1e5;
+        }
+
+        std::size_t buffer_size() const
+        {
+            return static_cast< std::size_t >( _compression ) * 5 + 16;
+        }
+
+        // the k1 scale function, which keeps centroids small at the tails
+        double scale( double fraction ) const
+        {
+            return _compression / ( 2 * 3.14159265358979323846 ) * std::asin( 2 * fraction - 1 );
+        }
+        double inverse_scale( double k ) const
+        {
+            return ( std::sin( k * ( 2 * 3.14159265358979323846 ) / _compression ) + 1 ) / 2;
+        }
+
+        void compress()
+        {
+            if( _buffer.empty() )
+                return;
+
+            _buffer.insert( _buffer.end(), _centroids.begin(), _centroids.end() );
+            std::sort( _buffer.begin(), _buffer.end() );
+            _centroids.clear();
+
+            double total = 0;
+            for( std::size_t i = 0; i < _buffer.size(); ++i )
+                total += _buffer[ i ].weight;
+
+            double so_far = 0;
+            double limit = inverse_scale( scale( 0 ) + 1 ) * total;
+            centroid current = _buffer[ 0 ];
+            for( std::size_t i = 1; i < _buffer.size(); ++i )
+            {
+                if( so_far + current.weight + _buffer[ i ].weight <= limit )
+                {
+                    current.weight += _buffer[ i ].weight;
+                    current.mean += ( _buffer[ i ].mean - current.mean ) * _buffer[ i ].weight / current.weight;
+                } else {
+                    so_far += current.weight;
+                    _centroids.push_back( current );
+                    limit = inverse_scale( scale( so_far / total ) + 1 ) * total;
+                    current = _buffer[ i ];
+                }
+            }
+            _centroids.push_back( current );
+            _buffer.clear();
+        }
+
+    private:
+        double _compression;
+        double _count;
+        double _min;
+        double _max;
+        std::vector< centroid > _centroids;
+        std::vector< centroid > _buffer;
+    };
+
+    namespace detail {
+
+        struct count_distinct_aggregate
+        {
+            void step( sqlite3_value* value )
+            {
+                if( sqlite3_value_type( value ) != SQLITE_NULL )
+                    sketch.add( hash_value( value ) );
+            }
+
+            boost::int64_t final()
+            {
+                return sketch.estimate();
+            }
+
+            hyperloglog sketch;
+        };
+
+        struct count_distinct_state_aggregate
+          : count_distinct_aggregate
+        {
+            blob final()
+            {
+                return sketch.serialize();
+            }
+        };
+
+        struct count_distinct_merge_aggregate
+        {
+            void step( sqlite3_value* state )
+            {
+                if( sqlite3_value_type( state ) == SQLITE_NULL )
+                    return;
+
+                void const* bytes = sqlite3_value_blob( state );
+                if( !sketch )
+                    sketch = hyperloglog::deserialize( bytes, sqlite3_value_bytes( state ) );
+                else
+                    sketch->merge( hyperloglog::deserialize( bytes, sqlite3_value_bytes( state ) ) );
+            }
+
+            blob final()
+            {
+                return sketch ? sketch->serialize() : hyperloglog().serialize();
+            }
+
+            boost::optional< hyperloglog > sketch;
+        };
+
+        inline boost::int64_t count_distinct_estimate( sqlite3_value* state )
+        {
+            return hyperloglog::deserialize( sqlite3_value_blob( state ), sqlite3_value_bytes( state ) ).estimate();
+        }
+
+        struct quantile_aggregate
+        {
+            quantile_aggregate()
+              : fraction( 0.5 )
+            {}
+
+            void step( sqlite3_value* value, double fraction )
+            {
+                this->fraction = fraction;
+                if( sqlite3_value_type( value ) != SQLITE_NULL )
+                    sketch.add( sqlite3_value_double( value ) );
+            }
+
+            boost::optional< double > final()
+            {
+                return sketch.quantile( fraction );
+            }
+
+            tdigest sketch;
+            double fraction;
+        };
+
+        struct quantile_state_aggregate
+        {
+            void step( sqlite3_value* value )
+            {
+                if( sqlite3_value_type( value ) != SQLITE_NULL )
+                    sketch.add( sqlite3_value_double( value ) );
+            }
+
+            blob final()
+            {
+                return sketch.serialize();
+            }
+
+            tdigest sketch;
+        };
+
+        struct quantile_merge_aggregate
+        {
+            void step( sqlite3_value* state )
+            {
+                if( sqlite3_value_type( state ) != SQLITE_NULL )
+                    sketch.merge( tdigest::deserialize( sqlite3_value_blob( state ), sqlite3_value_bytes( state ) ) );
+            }
+
+            blob final()
+            {
+                return sketch.serialize();
+            }
+
+            tdigest sketch;
+        };
+
+        inline boost::optional< double > quantile_estimate( sqlite3_value* state, double fraction )
+        {
+            return tdigest::deserialize( sqlite3_value_blob( state ), sqlite3_value_bytes( state ) ).quantile( fraction );
+        }
+
+    } // namespace detail
+
+    // makes approximate aggregates callable from sql:
+    //
+    //   approx_count_distinct( x ), approx_quantile( x, fraction )
+    //
+    // along with ones working on partial states, kept as blobs, so that
+    // partial aggregates can be stored and rolled up later:
+    //
+    //   approx_count_distinct_state( x ), approx_quantile_state( x )
+    //   approx_count_distinct_merge( state ), approx_quantile_merge( state )
+    //   approx_count_distinct_estimate( state ), approx_quantile_estimate( state, fraction )
+    inline void create_approximate_aggregates( database& db )
+    {
+        create_aggregate< detail::count_distinct_aggregate >( db, "approx_count_distinct", function_flags::deterministic );
+        create_aggregate< detail::count_distinct_state_aggregate >( db, "approx_count_distinct_state", function_flags::deterministic );
+        create_aggregate< detail::count_distinct_merge_aggregate >( db, "approx_count_distinct_merge", function_flags::deterministic );
+        create_function( db, "approx_count_distinct_estimate", &detail::count_distinct_estimate, function_flags::deterministic );
+
+        create_aggregate< detail::quantile_aggregate >( db, "approx_quantile", function_flags::deterministic );
+        create_aggregate< detail::quantile_state_aggregate >( db, "approx_quantile_state", function_flags::deterministic );
+        create_aggregate< detail::quantile_merge_aggregate >( db, "approx_quantile_merge", function_flags::deterministic );
+        create_function( db, "approx_quantile_estimate", &detail::quantile_estimate, function_flags::deterministic );
+    }
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_APPROXIMATE_HPP*/
@@ -0,0 +1,259 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/backup.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_BACKUP_HPP
+#define EGGS_SQLITE_BACKUP_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/pragma.hpp>
+
+#include <boost/chrono/duration.hpp>
+#include <boost/chrono/system_clocks.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <boost/thread/thread.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <cstddef>
+
+#include <sstream>
+#include <string>
+
+namespace eggs { namespace sqlite {
+
+    struct backup_options
+    {
+        backup_options()
+          : pages_per_step( 64 )
+          , pause( 0 )
+          , busy_pause( 10 )
+          , bytes_per_second( 0 )
+          , max_restarts( 8 )
+        {}
+
+        // how many pages to copy while holding the source lock
+        int pages_per_step;
+
+        // how long to let the source be between steps
+        boost::chrono::milliseconds pause;
+
+        // how long to wait for a source that is locked by a writer
+        boost::chrono::milliseconds busy_pause;
+
+        // pause longer when needed to stay under this rate, zero for no limit
+        boost::uint64_t bytes_per_second;
+
+        // a source written to by other connections makes the backup start
+        // over; after this many restarts the rest is copied in a single step
+        int max_restarts;
+    };
+
+    struct backup_progress
+    {
+        int remaining;
+        int page_count;
+        int restarts;
+    };
+
+    namespace detail {
+
+        struct ignore_backup_progress
+        {
+            void operator ()( backup_progress const& ) const {}
+        };
+
+        inline int backup_page_size( database& db, std::string const& name )
+        {
+            std::ostringstream query;
+            query << "PRAGMA \"";
+            for( std::size_t i = 0; i < name.size(); ++i )
+            {
+                if( name[ i ] == '"' )
+                    query << '"';
+                query << name[ i ];
+            }
+            query << "\".page_size;";
+
+            int page_size = 0;
+            invoke_pragma( db, query.str(), page_size );
+            return page_size;
+        }
+
+    } // namespace detail
+
+    // copies a live database page by page; the source connection may keep
+    // serving other threads meanwhile, SQLite serializes access to it, but
+    // the destination must not be used until the backup is done
+    class backup
+    {
+    public:
+        backup(
+            database& destination, database& source
+          , std::string const& destination_name = "main"
+          , std::string const& source_name = "main"
+        )
+          : _handle(
+                sqlite3_backup_init(
+                    destination.native_handle(), destination_name.c_str()
+                  , source.native_handle(), source_name.c_str()
+                )
+            )
+          , _page_size( 0 )
+          , _copied( 0 )
+          , _restarts( 0 )
+          , _done( false )
+          , _busy( false )
+        {
+            if( _handle == 0 )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( sqlite3_errcode( destination.native_handle() ) ) );
+            }
+
+            try
+            {
+                _page_size = detail::backup_page_size( source, source_name );
+            } catch( ... ) {
+                sqlite3_backup_finish( _handle );
+                throw;
+            }
+        }
+
+        ~backup()
+        {
+            sqlite3_backup_finish( _handle );
+        }
+
+        // copies up to the given number of pages, or all of them if negative;
+        // returns true once the backup is complete, and false when there is
+        // more to copy or the source was busy
+        bool step( int pages, boost::system::error_code& error_code )
+        {
+            int const result = sqlite3_backup_step( _handle, pages );
+            if( result == SQLITE_DONE || result == SQLITE_BUSY || result == SQLITE_LOCKED )
+            {
+                error_code.assign( result_code::ok, sqlite_category() );
+            } else {
+                error_code.assign( result, sqlite_category() );
+            }
+            return update( result, pages );
+        }
+        bool step( int pages = -1 )
+        {
+            int const result = sqlite3_backup_step( _handle, pages );
+            if( result != SQLITE_OK && result != SQLITE_DONE && result != SQLITE_BUSY && result != SQLITE_LOCKED )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+            }
+            return update( result, pages );
+        }
+
+        // steps through the whole backup at the pace given by the options,
+        // calling progress with a backup_progress after every step
+        template< typename Progress >
+        void run( backup_options const& options, Progress progress )
+        {
+            boost::chrono::steady_clock::time_point const start = boost::chrono::steady_clock::now();
+            boost::uint64_t copied = 0;
+            while( !_done )
+            {
+                int const before = _copied;
+                int const restarts = _restarts;
+                int const pages = _restarts < options.max_restarts ? options.pages_per_step : -1;
+                step( pages );
+
+                copied += _restarts != restarts ? _copied : _copied - before;
+
+                backup_progress const current = { remaining(), page_count(), _restarts };
+                progress( current );
+                if( _done )
+                    break;
+
+                boost::chrono::steady_clock::duration wait = _busy ? options.busy_pause : options.pause;
+                if( options.bytes_per_second != 0 )
+                {
+                    // when the copy should be at this point to keep the rate
+                    boost::chrono::steady_clock::time_point const due =
+                        start + boost::chrono::microseconds( copied * _page_size * 1000000 / options.bytes_per_second );
+                    boost::chrono::steady_clock::time_point const now = boost::chrono::steady_clock::now();
+                    if( due - now > wait )
+                        wait = due - now;
+                }
+                if( wait.count() > 0 )
+                    boost::this_thread::sleep_for( wait );
+            }
+        }
+        void run( backup_options const& options = backup_options() )
+        {
+            run( options, detail::ignore_backup_progress() );
+        }
+
+        bool done() const
+        {
+            return _done;
+        }
+
+        // pages left to copy and pages in the source as of the last step
+        int remaining() const
+        {
+            return sqlite3_backup_remaining( _handle );
+        }
+        int page_count() const
+        {
+            return sqlite3_backup_pagecount( _handle );
+        }
+
+        // how many times the backup had to start over so far
+        int restarts() const
+        {
+            return _restarts;
+        }
+
+    private:
+        backup( backup const& );
+        backup& operator =( backup const& );
+
+        // SQLite starts over when someone else writes to the source, which
+        // shows as fewer pages copied than the step asked for
+        bool update( int result, int pages )
+        {
+            int const page_count = sqlite3_backup_pagecount( _handle );
+            int const copied = page_count - sqlite3_backup_remaining( _handle );
+
+            bool const busy = result == SQLITE_BUSY || result == SQLITE_LOCKED;
+            int const expected = result != SQLITE_OK && result != SQLITE_DONE ? _copied
+              : pages < 0 || page_count - _copied < pages ? page_count : _copied + pages;
+            if( copied < expected )
+                ++_restarts;
+
+            _copied = copied;
+            _done = result == SQLITE_DONE;
+            _busy = busy;
+            return _done;
+        }
+
+    private:
+        sqlite3_backup* _handle;
+        int _page_size;
+        int _copied; // pages copied as of the last step
+        int _restarts;
+        bool _done;
+        bool _busy;
+    };
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_BACKUP_HPP*/
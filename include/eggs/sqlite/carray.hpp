@@ -0,0 +1,405 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/carray.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_CARRAY_HPP
+#define EGGS_SQLITE_CARRAY_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/raw_traits.hpp>
+#include <eggs/sqlite/virtual_table.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+#include <string>
+#include <vector>
+
+// pointers are passed through bindings since SQLite 3.20; before that the
+// integer path, as carray did up to 3.19, lets any sql text that reaches
+// carray read arbitrary memory, so it has to be asked for explicitly by
+// defining EGGS_SQLITE_CARRAY_INTEGER_POINTERS
+#if SQLITE_VERSION_NUMBER >= 3020000 || defined( EGGS_SQLITE_CARRAY_INTEGER_POINTERS )
+
+#if SQLITE_VERSION_NUMBER < 3020000
+#   if defined( _MSC_VER )
+#       pragma message( "warning: carray binds pointers as integers, any sql that reaches it can read arbitrary memory" )
+#   else
+#       warning "carray binds pointers as integers, any sql that reaches it can read arbitrary memory"
+#   endif
+#endif
+
+namespace eggs { namespace sqlite {
+
+    namespace detail {
+
+        struct carray_kind
+        {
+            enum enum_type
+            {
+                none = 0
+              , int64
+              , real
+              , text
+            };
+        };
+
+        template< typename Type >
+        struct carray_element;
+
+        template<>
+        struct carray_element< boost::int64_t >
+        {
+            static carray_kind::enum_type const kind = carray_kind::int64;
+            static char const* type_name()
+            {
+                return "eggs::sqlite::carray<int64>";
+            }
+            static char const* tag()
+            {
+                return "int64";
+            }
+        };
+        template<>
+        struct carray_element< double >
+        {
+            static carray_kind::enum_type const kind = carray_kind::real;
+            static char const* type_name()
+            {
+                return "eggs::sqlite::carray<double>";
+            }
+            static char const* tag()
+            {
+                return "double";
+            }
+        };
+        template<>
+        struct carray_element< std::string >
+        {
+            static carray_kind::enum_type const kind = carray_kind::text;
+            static char const* type_name()
+            {
+                return "eggs::sqlite::carray<text>";
+            }
+            static char const* tag()
+            {
+                return "text";
+            }
+        };
+
+        // a container bound by pointer, it is not copied and has to outlive
+        // the binding
+#if SQLITE_VERSION_NUMBER >= 3020000
+        // pointers are passed through bindings since SQLite 3.20, any other
+        // sql value reads as a null pointer
+        template< typename Type >
+        struct carray_traits
+        {
+            typedef std::vector< Type > const* value_type;
+
+            static value_type get( sqlite3_stmt* statement_handle, std::size_t index )
+            {
+                return get( sqlite3_column_value( statement_handle, index ) );
+            }
+            static void bind( sqlite3_stmt* statement_handle, std::size_t index, value_type value )
+            {
+                sqlite3_bind_pointer(
+                    statement_handle, index
+                  , const_cast< std::vector< Type >* >( value ), carray_element< Type >::type_name(), 0
+                );
+            }
+
+            static value_type get( sqlite3_value* value_handle )
+            {
+                return static_cast< value_type >(
+                    sqlite3_value_pointer( value_handle, carray_element< Type >::type_name() ) );
+            }
+            static void result( sqlite3_context* context, value_type value )
+            {
+                sqlite3_result_pointer(
+                    context
+                  , const_cast< std::vector< Type >* >( value ), carray_element< Type >::type_name(), 0
+                );
+            }
+        };
+#else
+        // before SQLite 3.20 the address travels as an integer, and the type
+        // tag given to carray says what it points to; any integer reads as a
+        // pointer, which is why this path is opt-in, any other sql value as a
+        // null one
+        template< typename Type >
+        struct carray_traits
+        {
+            typedef std::vector< Type > const* value_type;
+
+            static value_type get( sqlite3_stmt* statement_handle, std::size_t index )
+            {
+                return get( sqlite3_column_value( statement_handle, index ) );
+            }
+            static void bind( sqlite3_stmt* statement_handle, std::size_t index, value_type value )
+            {
+                sqlite3_bind_int64(
+                    statement_handle, index
+                  , static_cast< sqlite3_int64 >( reinterpret_cast< std::size_t >( value ) )
+                );
+            }
+
+            static value_type get( sqlite3_value* value_handle )
+            {
+                if( sqlite3_value_type( value_handle ) != SQLITE_INTEGER )
+                    return 0;
+
+                return reinterpret_cast< value_type >(
+                    static_cast< std::size_t >( sqlite3_value_int64( value_handle ) ) );
+            }
+            static void result( sqlite3_context* context, value_type value )
+            {
+                sqlite3_result_int64(
+                    context
+                  , static_cast< sqlite3_int64 >( reinterpret_cast< std::size_t >( value ) )
+                );
+            }
+        };
+#endif
+
+    } // namespace detail
+
+    template<>
+    struct raw_traits< std::vector< boost::int64_t > const* >
+      : detail::carray_traits< boost::int64_t >
+    {};
+
+    template<>
+    struct raw_traits< std::vector< double > const* >
+      : detail::carray_traits< double >
+    {};
+
+    template<>
+    struct raw_traits< std::vector< std::string > const* >
+      : detail::carray_traits< std::string >
+    {};
+
+    namespace detail {
+
+        struct carray_cursor
+          : virtual_table_cursor
+        {
+            carray_cursor()
+              : kind( carray_kind::none )
+              , elements( 0 )
+              , position( 0 )
+              , size( 0 )
+            {}
+
+            template< typename Type >
+            std::vector< Type > const& values() const
+            {
+                return *static_cast< std::vector< Type > const* >( elements );
+            }
+
+            carray_kind::enum_type kind;
+            void const* elements;
+            std::size_t position;
+            std::size_t size;
+        };
+
+        // binds the container if the type tag, when given, names its elements
+        template< typename Type >
+        inline bool carray_bind( carray_cursor& cursor, sqlite3_value* value, char const* tag )
+        {
+            if( tag != 0 && std::strcmp( tag, carray_element< Type >::tag() ) != 0 )
+                return false;
+
+            std::vector< Type > const* elements = carray_traits< Type >::get( value );
+            if( elements == 0 )
+                return false;
+
+            cursor.kind = carray_element< Type >::kind;
+            cursor.elements = elements;
+            cursor.size = elements->size();
+            return true;
+        }
+
+    } // namespace detail
+
+    // a table-valued function over a container bound by pointer, declared
+    // as
+    //
+    //   CREATE TABLE carray( value, pointer HIDDEN, type HIDDEN )
+    //
+    // so that a whole container can be bound to a single parameter:
+    //
+    //   SELECT * FROM t WHERE id IN carray( :ids, 'int64' )
+    //
+    // with a std::vector< boost::int64_t >, std::vector< double >, or
+    // std::vector< std::string > bound through a pointer to it; elements
+    // are read in place, the rowid of each is its index
+    //
+    // the type is one of 'int64', 'double' or 'text'; it can be left out
+    // since SQLite 3.20, where the pointer carries its own type, but it is
+    // required before that, where the pointer is bound as a plain integer
+    // and a container without a type yields no rows; that path is only
+    // available with EGGS_SQLITE_CARRAY_INTEGER_POINTERS defined
+    class carray_module
+      : public basic_module< carray_module, virtual_table, detail::carray_cursor >
+    {
+        friend class basic_module< carray_module, virtual_table, detail::carray_cursor >;
+
+    public:
+        carray_module()
+          : basic_module< carray_module, virtual_table, detail::carray_cursor >( true )
+        {}
+
+    private:
+        int connect( sqlite3* /*db*/, table_type& /*table*/, int /*argc*/, char const* const* /*argv*/, std::string& schema )
+        {
+            schema = "CREATE TABLE x( value, pointer HIDDEN, type HIDDEN )";
+            return SQLITE_OK;
+        }
+
+        // idxNum is 1 with a container, 3 with a container and a type tag
+        int best_index( table_type& /*table*/, sqlite3_index_info* info )
+        {
+            int pointer = -1;
+            int type = -1;
+            for( int i = 0; i < info->nConstraint; ++i )
+            {
+                sqlite3_index_info::sqlite3_index_constraint const& constraint = info->aConstraint[ i ];
+                if( !constraint.usable || constraint.op != SQLITE_INDEX_CONSTRAINT_EQ )
+                    continue;
+
+                if( constraint.iColumn == 1 )
+                    pointer = i;
+                else if( constraint.iColumn == 2 )
+                    type = i;
+            }
+
+            if( pointer < 0 )
+            {
+                // without a container there are no rows
+                info->idxNum = 0;
+                info->estimatedCost = 1e99;
+                return SQLITE_OK;
+            }
+
+            info->idxNum = 1;
+            info->aConstraintUsage[ pointer ].argvIndex = 1;
+            info->aConstraintUsage[ pointer ].omit = 1;
+            if( type >= 0 )
+            {
+                info->idxNum = 3;
+                info->aConstraintUsage[ type ].argvIndex = 2;
+                info->aConstraintUsage[ type ].omit = 1;
+            }
+            info->estimatedCost = 1;
+#if SQLITE_VERSION_NUMBER >= 3008002
+            info->estimatedRows = 100;
+#endif
+            return SQLITE_OK;
+        }
+
+        int filter( cursor_type& cursor, int index, char const* /*index_string*/, int argc, sqlite3_value** argv )
+        {
+            cursor.kind = detail::carray_kind::none;
+            cursor.elements = 0;
+            cursor.position = 0;
+            cursor.size = 0;
+            if( ( index & 1 ) == 0 )
+                return SQLITE_OK;
+
+            char const* tag = 0;
+            if( ( index & 2 ) != 0 && argc > 1 )
+            {
+                tag = reinterpret_cast< char const* >( sqlite3_value_text( argv[ 1 ] ) );
+                if( tag == 0 )
+                    return SQLITE_OK;
+            }
+#if SQLITE_VERSION_NUMBER < 3020000
+            // a plain integer does not say what it points to
+            if( tag == 0 )
+                return SQLITE_OK;
+#endif
+
+            if( !detail::carray_bind< boost::int64_t >( cursor, argv[ 0 ], tag )
+             && !detail::carray_bind< double >( cursor, argv[ 0 ], tag ) )
+            {
+                detail::carray_bind< std::string >( cursor, argv[ 0 ], tag );
+            }
+            return SQLITE_OK;
+        }
+
+        int next( cursor_type& cursor )
+        {
+            ++cursor.position;
+            return SQLITE_OK;
+        }
+
+        bool eof( cursor_type& cursor )
+        {
+            return cursor.position >= cursor.size;
+        }
+
+        int column( cursor_type& cursor, sqlite3_context* context, int column )
+        {
+            if( column != 0 )
+            {
+                sqlite3_result_null( context );
+                return SQLITE_OK;
+            }
+
+            switch( cursor.kind )
+            {
+            case detail::carray_kind::int64:
+                sqlite3_result_int64( context, cursor.values< boost::int64_t >()[ cursor.position ] );
+                break;
+            case detail::carray_kind::real:
+                sqlite3_result_double( context, cursor.values< double >()[ cursor.position ] );
+                break;
+            case detail::carray_kind::text:
+                {
+                    std::string const& value = cursor.values< std::string >()[ cursor.position ];
+                    sqlite3_result_text( context, value.data(), static_cast< int >( value.size() ), SQLITE_STATIC );
+                }
+                break;
+            default:
+                sqlite3_result_null( context );
+                break;
+            }
+            return SQLITE_OK;
+        }
+
+        int rowid( cursor_type& cursor, sqlite3_int64* rowid )
+        {
+            *rowid = static_cast< sqlite3_int64 >( cursor.position );
+            return SQLITE_OK;
+        }
+    };
+
+    // makes carray available to a connection under the given name
+    inline void create_carray_module( database& db, std::string const& name, boost::system::error_code& error_code )
+    {
+        create_module( db, name, new carray_module(), error_code );
+    }
+    inline void create_carray_module( database& db, std::string const& name = "carray" )
+    {
+        create_module( db, name, new carray_module() );
+    }
+
+} } // namespace eggs::sqlite
+
+#endif
+
+#endif /*EGGS_SQLITE_CARRAY_HPP*/
@@ -0,0 +1,393 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/checkpoint_scheduler.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_CHECKPOINT_SCHEDULER_HPP
+#define EGGS_SQLITE_CHECKPOINT_SCHEDULER_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/pragma.hpp>
+
+#include <boost/chrono/duration.hpp>
+#include <boost/chrono/system_clocks.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <algorithm>
+#include <string>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace eggs { namespace sqlite {
+
+    struct checkpoint_options
+    {
+        checkpoint_options()
+          : wal_pages( 1000 )
+          , interval( 1000 )
+          , restart_pages( 0 )
+          , sync_log( false )
+          , busy_timeout( 1000 )
+        {}
+
+        // checkpoint once the log holds this many pages, zero for never
+        int wal_pages;
+
+        // or once this long has passed since the last one, zero for never
+        boost::chrono::milliseconds interval;
+
+        // once a log this large has been fully checkpointed, try to restart
+        // it so that it does not keep growing, zero for never; this fails
+        // while readers use the log, and briefly holds off writers, which
+        // then need a busy timeout
+        int restart_pages;
+
+        // sync the log after every checkpoint, for databases that commit
+        // with synchronous=NORMAL
+        bool sync_log;
+
+        // how long the background connection waits for locks held by others
+        boost::chrono::milliseconds busy_timeout;
+    };
+
+    struct checkpoint_statistics
+    {
+        boost::uint64_t commits;
+        boost::uint64_t checkpoints;
+        boost::uint64_t restarts;
+        boost::uint64_t busy; // restarts that readers or writers got in the way of
+        boost::uint64_t syncs;
+        boost::uint64_t errors;
+        int wal_pages; // the size of the log as of the last commit
+        int max_wal_pages;
+        boost::chrono::nanoseconds last_duration;
+        boost::chrono::nanoseconds max_duration;
+        boost::chrono::nanoseconds total_duration;
+        boost::chrono::nanoseconds max_pending_window; // the longest a commit waited for a checkpoint
+        boost::chrono::nanoseconds pending_window; // how long the oldest pending commit has waited
+    };
+
+    namespace detail {
+
+        // checkpoints need a log, which in-memory and temporary databases
+        // never have
+        inline char const* wal_database_filename( database& db )
+        {
+            char const* const filename = sqlite3_db_filename( db.native_handle(), "main" );
+            if( filename == 0 || *filename == '\0'
+             || get_pragma< pragma::journal_mode >( db ) != pragma::journal_mode::wal )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( result_code::cant_open ) );
+            }
+            return filename;
+        }
+
+        // syncs the write-ahead log through a descriptor of its own; the wal
+        // file holds no posix locks so closing it here does not drop any
+        inline bool sync_wal_file( std::string const& filename )
+        {
+#       if defined( __unix__ ) || defined( __APPLE__ )
+            int const descriptor = ::open( ( filename + "-wal" ).c_str(), O_RDONLY );
+            if( descriptor < 0 )
+                return true; // no log, nothing to sync
+
+            bool const result = ::fsync( descriptor ) == 0;
+            ::close( descriptor );
+            return result;
+#       else
+            return true;
+#       endif
+        }
+
+    } // namespace detail
+
+    // takes checkpoints off the committing connection: inline autocheckpoint
+    // is turned off and a background thread with a connection of its own
+    // runs passive checkpoints whenever the log grows too large or too old.
+    // Only commits made through the given connection are accounted for, and
+    // the connection must not get a wal hook or autocheckpoint of its own.
+    // The database must already be in WAL mode and live in a file.
+    class checkpoint_scheduler
+    {
+    public:
+        explicit checkpoint_scheduler(
+            database& db
+          , checkpoint_options const& checkpoint = checkpoint_options()
+          , database::options const& options = database::options()
+        )
+          : _db( db )
+          , _filename( detail::wal_database_filename( db ) )
+          , _background( _filename, database::mode::read_write, options )
+          , _options( checkpoint )
+          , _autocheckpoint( get_pragma< pragma::wal_autocheckpoint >( db ) )
+          , _stop( false )
+          , _requested( false )
+          , _pending( false )
+          , _last_checkpoint( boost::chrono::steady_clock::now() )
+          , _commits( 0 ), _checkpoints( 0 ), _restarts( 0 )
+          , _busy( 0 ), _syncs( 0 ), _errors( 0 )
+          , _wal_pages( 0 ), _max_wal_pages( 0 )
+          , _last_duration( 0 ), _max_duration( 0 ), _total_duration( 0 )
+          , _max_pending_window( 0 )
+        {
+            sqlite3_busy_timeout( _background.native_handle(), static_cast< int >( checkpoint.busy_timeout.count() ) );
+            set_pragma< pragma::wal_autocheckpoint >( db, 0 );
+
+            // must come after wal_autocheckpoint, which replaces the hook
+            sqlite3_wal_hook( db.native_handle(), &checkpoint_scheduler::on_commit, this );
+
+            _thread = boost::thread( &checkpoint_scheduler::run, this );
+        }
+
+        // checkpoints whatever is still pending before returning, then gives
+        // the connection back its autocheckpoint
+        ~checkpoint_scheduler()
+        {
+            sqlite3_wal_hook( _db.native_handle(), 0, 0 );
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+                _stop = true;
+            }
+            _condition.notify_one();
+            _thread.join();
+
+            sqlite3_wal_autocheckpoint( _db.native_handle(), _autocheckpoint );
+        }
+
+        // asks for a checkpoint now rather than when it is due
+        void request()
+        {
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+                _requested = true;
+            }
+            _condition.notify_one();
+        }
+
+        checkpoint_statistics statistics() const
+        {
+            boost::mutex::scoped_lock lock( _mutex );
+
+            checkpoint_statistics value;
+            value.commits = _commits;
+            value.checkpoints = _checkpoints;
+            value.restarts = _restarts;
+            value.busy = _busy;
+            value.syncs = _syncs;
+            value.errors = _errors;
+            value.wal_pages = _wal_pages;
+            value.max_wal_pages = _max_wal_pages;
+            value.last_duration = _last_duration;
+            value.max_duration = _max_duration;
+            value.total_duration = _total_duration;
+            value.max_pending_window = _max_pending_window;
+            value.pending_window = _pending
+              ? boost::chrono::duration_cast< boost::chrono::nanoseconds >(
+                    boost::chrono::steady_clock::now() - _pending_since )
+              : boost::chrono::nanoseconds( 0 );
+            return value;
+        }
+
+    private:
+        checkpoint_scheduler( checkpoint_scheduler const& );
+        checkpoint_scheduler& operator =( checkpoint_scheduler const& );
+
+        static int on_commit( void* context, sqlite3* /*handle*/, char const* /*name*/, int pages )
+        {
+            checkpoint_scheduler& self = *static_cast< checkpoint_scheduler* >( context );
+
+            bool notify = false;
+            {
+                boost::mutex::scoped_lock lock( self._mutex );
+                ++self._commits;
+                self._wal_pages = pages;
+                self._max_wal_pages = (std::max)( self._max_wal_pages, pages );
+                if( !self._pending )
+                {
+                    self._pending = true;
+                    self._pending_since = boost::chrono::steady_clock::now();
+                }
+                if( self._options.wal_pages > 0 && pages >= self._options.wal_pages && !self._requested )
+                {
+                    self._requested = true;
+                    notify = true;
+                }
+            }
+            if( notify )
+                self._condition.notify_one();
+            return SQLITE_OK;
+        }
+
+        struct outcome
+        {
+            bool checkpointed;
+            bool complete; // every pending commit is either checkpointed or synced
+            bool restarted;
+            bool busy;
+            bool synced;
+            bool error;
+        };
+
+        outcome checkpoint()
+        {
+            outcome result = { false, false, false, false, false, false };
+
+            int log = 0, checkpointed = 0;
+            try
+            {
+                // a connection does not open the log until it reads from it
+                get_pragma< pragma::schema_version >( _background );
+            } catch( sqlite_error const& ) {
+                result.error = true;
+                return result;
+            }
+
+            int code = sqlite3_wal_checkpoint_v2( _background.native_handle(), 0, SQLITE_CHECKPOINT_PASSIVE, &log, &checkpointed );
+            if( code != SQLITE_OK )
+            {
+                result.error = true;
+                return result;
+            }
+            result.checkpointed = true;
+            result.complete = checkpointed >= log;
+
+            if( result.complete && log > 0 && _options.restart_pages > 0 && log >= _options.restart_pages )
+            {
+#           if defined( SQLITE_CHECKPOINT_TRUNCATE )
+                int const mode = SQLITE_CHECKPOINT_TRUNCATE;
+#           else
+                int const mode = SQLITE_CHECKPOINT_RESTART;
+#           endif
+                code = sqlite3_wal_checkpoint_v2( _background.native_handle(), 0, mode, &log, &checkpointed );
+                if( code == SQLITE_OK )
+                    result.restarted = true;
+                else if( code == SQLITE_BUSY )
+                    result.busy = true;
+                else
+                    result.error = true;
+            }
+
+            if( _options.sync_log )
+            {
+                result.synced = detail::sync_wal_file( _filename );
+                if( !result.synced )
+                    result.error = true;
+                result.complete = result.synced;
+            }
+            return result;
+        }
+
+        void run()
+        {
+            boost::mutex::scoped_lock lock( _mutex );
+            for( bool stopping = false; !stopping; )
+            {
+                if( !_stop && !_requested )
+                {
+                    if( _options.interval.count() > 0 )
+                        _condition.wait_until( lock, _last_checkpoint + _options.interval );
+                    else
+                        _condition.wait( lock );
+                }
+                stopping = _stop;
+
+                boost::chrono::steady_clock::time_point const start = boost::chrono::steady_clock::now();
+                bool const due = _requested || stopping
+                  || ( _options.interval.count() > 0 && start >= _last_checkpoint + _options.interval );
+                if( !due )
+                    continue;
+
+                _requested = false;
+                _last_checkpoint = start;
+                if( !_pending )
+                    continue;
+
+                boost::chrono::steady_clock::time_point const since = _pending_since;
+                _pending = false;
+
+                lock.unlock();
+                outcome const result = checkpoint();
+                boost::chrono::steady_clock::time_point const end = boost::chrono::steady_clock::now();
+                lock.lock();
+
+                boost::chrono::nanoseconds const duration =
+                    boost::chrono::duration_cast< boost::chrono::nanoseconds >( end - start );
+                _last_duration = duration;
+                _max_duration = (std::max)( _max_duration, duration );
+                _total_duration += duration;
+
+                if( result.checkpointed )
+                    ++_checkpoints;
+                if( result.restarted )
+                    ++_restarts;
+                if( result.busy )
+                    ++_busy;
+                if( result.synced )
+                    ++_syncs;
+                if( result.error )
+                    ++_errors;
+
+                if( result.complete )
+                {
+                    _max_pending_window = (std::max)( _max_pending_window,
+                        boost::chrono::duration_cast< boost::chrono::nanoseconds >( end - since ) );
+                } else {
+                    // the commits before are still pending
+                    _pending = true;
+                    _pending_since = since;
+                }
+            }
+        }
+
+    private:
+        database& _db;
+        std::string _filename;
+        database _background;
+        checkpoint_options _options;
+        int _autocheckpoint;
+
+        mutable boost::mutex _mutex;
+        boost::condition_variable _condition;
+        boost::thread _thread;
+        bool _stop;
+        bool _requested;
+
+        bool _pending;
+        boost::chrono::steady_clock::time_point _pending_since;
+        boost::chrono::steady_clock::time_point _last_checkpoint;
+
+        boost::uint64_t _commits;
+        boost::uint64_t _checkpoints;
+        boost::uint64_t _restarts;
+        boost::uint64_t _busy;
+        boost::uint64_t _syncs;
+        boost::uint64_t _errors;
+        int _wal_pages;
+        int _max_wal_pages;
+        boost::chrono::nanoseconds _last_duration;
+        boost::chrono::nanoseconds _max_duration;
+        boost::chrono::nanoseconds _total_duration;
+        boost::chrono::nanoseconds _max_pending_window;
+    };
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_CHECKPOINT_SCHEDULER_HPP*/
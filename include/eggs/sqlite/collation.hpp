@@ -0,0 +1,323 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/collation.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_COLLATION_HPP
+#define EGGS_SQLITE_COLLATION_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+#include <string>
+#include <vector>
+
+namespace eggs { namespace sqlite {
+
+    namespace detail {
+
+        // a run of code points that fold by adding delta; with a stride of 2
+        // only every other one folds, as in alternating upper and lower case
+        struct case_fold_range
+        {
+            boost::uint16_t first;
+            boost::uint16_t last;
+            boost::int32_t delta;
+            int stride;
+        };
+
+        // the case folding of every code point in the basic multilingual
+        // plane, built once from the ranges below
+        class case_fold_table
+        {
+        public:
+            case_fold_table()
+              : _table( 0x10000 )
+            {
+                for( std::size_t i = 0; i < _table.size(); ++i )
+                    _table[ i ] = static_cast< boost::uint16_t >( i );
+
+                std::size_t count = 0;
+                case_fold_range const* const ranges = get_ranges( count );
+                for( std::size_t i = 0; i < count; ++i )
+                {
+                    case_fold_range const& range = ranges[ i ];
+                    for( boost::uint32_t c = range.first; c <= range.last; c += range.stride )
+                        _table[ c ] = static_cast< boost::uint16_t >( boost::int32_t( c ) + range.delta );
+                }
+            }
+
+            boost::uint32_t operator ()( boost::uint32_t c ) const
+            {
+                return c < 0x10000 ? _table[ c ] : c;
+            }
+
+        private:
+            static case_fold_range const* get_ranges( std::size_t& count )
+            {
+                // the simple case folding of the scripts most commonly found
+                // in text, code points not listed fold to themselves
+                static case_fold_range const ranges[] =
+                {
+                    { 0x0041, 0x005a, 32, 1 }, { 0x00b5, 0x00b5, 775, 1 }
+                  , { 0x00c0, 0x00d6, 32, 1 }, { 0x00d8, 0x00de, 32, 1 }
+                    // latin extended-a
+                  , { 0x0100, 0x012f, 1, 2 }, { 0x0132, 0x0137, 1, 2 }
+                  , { 0x0139, 0x0148, 1, 2 }, { 0x014a, 0x0177, 1, 2 }
+                  , { 0x0178, 0x0178, -121, 1 }, { 0x0179, 0x017e, 1, 2 }
+                  , { 0x017f, 0x017f, -268, 1 }
+                    // latin extended-b
+                  , { 0x01cd, 0x01dc, 1, 2 }, { 0x01de, 0x01ef, 1, 2 }
+                  , { 0x01f8, 0x021f, 1, 2 }, { 0x0222, 0x0233, 1, 2 }
+                  , { 0x0246, 0x024f, 1, 2 }
+                    // greek
+                  , { 0x0386, 0x0386, 38, 1 }, { 0x0388, 0x038a, 37, 1 }
+                  , { 0x038c, 0x038c, 64, 1 }, { 0x038e, 0x038f, 63, 1 }
+                  , { 0x0391, 0x03a1, 32, 1 }, { 0x03a3, 0x03ab, 32, 1 }
+                  , { 0x03c2, 0x03c2, 1, 1 }, { 0x03d8, 0x03ef, 1, 2 }
+                    // cyrillic
+                  , { 0x0400, 0x040f, 80, 1 }, { 0x0410, 0x042f, 32, 1 }
+                  , { 0x0460, 0x0481, 1, 2 }, { 0x048a, 0x04bf, 1, 2 }
+                  , { 0x04c0, 0x04c0, 15, 1 }, { 0x04c1, 0x04ce, 1, 2 }
+                  , { 0x04d0, 0x052f, 1, 2 }
+                    // armenian and georgian
+                  , { 0x0531, 0x0556, 48, 1 }, { 0x10a0, 0x10c5, 7264, 1 }
+                    // latin extended additional and greek extended
+                  , { 0x1e00, 0x1e95, 1, 2 }, { 0x1e9e, 0x1e9e, -7615, 1 }
+                  , { 0x1ea0, 0x1eff, 1, 2 }
+                  , { 0x1f08, 0x1f0f, -8, 1 }, { 0x1f18, 0x1f1d, -8, 1 }
+                  , { 0x1f28, 0x1f2f, -8, 1 }, { 0x1f38, 0x1f3f, -8, 1 }
+                  , { 0x1f48, 0x1f4d, -8, 1 }, { 0x1f68, 0x1f6f, -8, 1 }
+                    // number forms, enclosed letters, glagolitic, coptic, fullwidth
+                  , { 0x2160, 0x216f, 16, 1 }, { 0x24b6, 0x24cf, 26, 1 }
+                  , { 0x2c00, 0x2c2f, 48, 1 }, { 0x2c80, 0x2ce3, 1, 2 }
+                  , { 0xff21, 0xff3a, 32, 1 }
+                };
+
+                count = sizeof( ranges ) / sizeof( ranges[ 0 ] );
+                return ranges;
+            }
+
+        private:
+            std::vector< boost::uint16_t > _table;
+        };
+
+        inline case_fold_table const& get_case_fold_table()
+        {
+            static case_fold_table const table;
+            return table;
+        }
+
+        // a byte that does not start a valid sequence stands for itself
+        inline boost::uint32_t decode_utf8( unsigned char const*& iter, unsigned char const* end )
+        {
+            boost::uint32_t c = *iter++;
+            if( c < 0xc0 )
+                return c;
+
+            int const trail = c < 0xe0 ? 1 : c < 0xf0 ? 2 : 3;
+            if( end - iter < trail )
+                return c;
+
+            boost::uint32_t result = c & ( 0x3f >> trail );
+            for( int i = 0; i < trail; ++i )
+            {
+                if( ( iter[ i ] & 0xc0 ) != 0x80 )
+                    return c;
+                result = ( result << 6 ) | ( iter[ i ] & 0x3f );
+            }
+            iter += trail;
+            return result;
+        }
+
+        // the next code point, folded; ascii is looked up directly
+        inline boost::uint32_t next_folded( unsigned char const*& iter, unsigned char const* end, case_fold_table const& fold )
+        {
+            if( *iter < 0x80 )
+            {
+                unsigned char const c = *iter++;
+                return c >= 'A' && c <= 'Z' ? c + 32 : c;
+            }
+            return fold( decode_utf8( iter, end ) );
+        }
+
+        inline bool is_digit( unsigned char c )
+        {
+            return c >= '0' && c <= '9';
+        }
+
+        // the comparator given to SQLite, which must not throw; should it
+        // do so anyway, text is compared as BINARY would
+        template< typename Comparator >
+        int collation_callback( void* comparator, int left_size, void const* left, int right_size, void const* right )
+        {
+            try
+            {
+                return ( *static_cast< Comparator* >( comparator ) )(
+                    static_cast< char const* >( left ), left_size
+                  , static_cast< char const* >( right ), right_size );
+            } catch( ... ) {
+                int const result = std::memcmp( left, right, left_size < right_size ? left_size : right_size );
+                return result != 0 ? result : left_size - right_size;
+            }
+        }
+
+        template< typename Comparator >
+        void collation_destroy( void* comparator )
+        {
+            delete static_cast< Comparator* >( comparator );
+        }
+
+        // SQLite does not destroy the comparator on failure
+        template< typename Comparator >
+        inline int create_collation( sqlite3* db, char const* name, Comparator comparator )
+        {
+            Comparator* copy = new Comparator( comparator );
+            int const result =
+                sqlite3_create_collation_v2(
+                    db, name, SQLITE_UTF8
+                  , copy
+                  , &collation_callback< Comparator >
+                  , &collation_destroy< Comparator >
+                );
+            if( result != SQLITE_OK )
+                delete copy;
+            return result;
+        }
+
+    } // namespace detail
+
+    // orders text by unicode simple case folding, so that '' sorts along
+    // with '' where NOCASE only folds ascii
+    struct unicode_nocase_collation
+    {
+        int operator ()( char const* left, std::size_t left_size, char const* right, std::size_t right_size ) const
+        {
+            detail::case_fold_table const& fold = detail::get_case_fold_table();
+
+            unsigned char const* l = reinterpret_cast< unsigned char const* >( left );
+            unsigned char const* r = reinterpret_cast< unsigned char const* >( right );
+            unsigned char const* const l_end = l + left_size;
+            unsigned char const* const r_end = r + right_size;
+            while( l != l_end && r != r_end )
+            {
+                // equal bytes fold equally, skip over them
+                if( *l == *r && *l < 0x80 )
+                {
+                    ++l, ++r;
+                    continue;
+                }
+
+                boost::uint32_t const lc = detail::next_folded( l, l_end, fold );
+                boost::uint32_t const rc = detail::next_folded( r, r_end, fold );
+                if( lc != rc )
+                    return lc < rc ? -1 : 1;
+            }
+            return l != l_end ? 1 : r != r_end ? -1 : 0;
+        }
+    };
+
+    // orders text as unicode_nocase_collation does, except that runs of
+    // digits compare by their numeric value, so that 'file9' comes before
+    // 'file10'; numbers that differ only in leading zeros order by them
+    struct natural_collation
+    {
+        int operator ()( char const* left, std::size_t left_size, char const* right, std::size_t right_size ) const
+        {
+            detail::case_fold_table const& fold = detail::get_case_fold_table();
+
+            unsigned char const* l = reinterpret_cast< unsigned char const* >( left );
+            unsigned char const* r = reinterpret_cast< unsigned char const* >( right );
+            unsigned char const* const l_end = l + left_size;
+            unsigned char const* const r_end = r + right_size;
+            int zeros = 0;
+            while( l != l_end && r != r_end )
+            {
+                if( detail::is_digit( *l ) && detail::is_digit( *r ) )
+                {
+                    unsigned char const* const l_start = l;
+                    unsigned char const* const r_start = r;
+                    while( l != l_end && *l == '0' ) ++l;
+                    while( r != r_end && *r == '0' ) ++r;
+                    if( zeros == 0 && ( l - l_start ) != ( r - r_start ) )
+                        zeros = ( l - l_start ) < ( r - r_start ) ? -1 : 1;
+
+                    unsigned char const* l_digits = l;
+                    unsigned char const* r_digits = r;
+                    while( l != l_end && detail::is_digit( *l ) ) ++l;
+                    while( r != r_end && detail::is_digit( *r ) ) ++r;
+
+                    // longer numbers are larger, otherwise the first
+                    // differing digit decides
+                    if( ( l - l_digits ) != ( r - r_digits ) )
+                        return ( l - l_digits ) < ( r - r_digits ) ? -1 : 1;
+                    for( ; l_digits != l; ++l_digits, ++r_digits )
+                    {
+                        if( *l_digits != *r_digits )
+                            return *l_digits < *r_digits ? -1 : 1;
+                    }
+                    continue;
+                }
+
+                boost::uint32_t const lc = detail::next_folded( l, l_end, fold );
+                boost::uint32_t const rc = detail::next_folded( r, r_end, fold );
+                if( lc != rc )
+                    return lc < rc ? -1 : 1;
+            }
+            return l != l_end ? 1 : r != r_end ? -1 : zeros;
+        }
+    };
+
+    // makes a collating sequence usable from sql, in ORDER BY and COLLATE
+    // clauses as well as in indexes; the comparator is called as
+    //
+    //   int comparator( char const* left, std::size_t left_size, char const* right, std::size_t right_size );
+    //
+    // with utf-8 text, must not throw, and must give a consistent order for
+    // indexes using it to remain valid
+    template< typename Comparator >
+    inline void create_collation(
+        database& db, std::string const& name, Comparator comparator
+      , boost::system::error_code& error_code
+    )
+    {
+        int const result = detail::create_collation( db.native_handle(), name.c_str(), comparator );
+        error_code.assign( result, sqlite_category() );
+    }
+    template< typename Comparator >
+    inline void create_collation( database& db, std::string const& name, Comparator comparator )
+    {
+        int const result = detail::create_collation( db.native_handle(), name.c_str(), comparator );
+        if( result != SQLITE_OK )
+        {
+            BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+        }
+    }
+
+    // makes the built-in collations available as UNICODE_NOCASE and
+    // NATURAL_NOCASE, as NATURAL is a keyword
+    inline void create_collations( database& db )
+    {
+        create_collation( db, "unicode_nocase", unicode_nocase_collation() );
+        create_collation( db, "natural_nocase", natural_collation() );
+    }
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_COLLATION_HPP*/
@@ -0,0 +1,340 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/compressed_vfs.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_COMPRESSED_VFS_HPP
+#define EGGS_SQLITE_COMPRESSED_VFS_HPP
+
+// this header is not included by <eggs/sqlite.hpp>, it requires zlib
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/vfs.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+namespace eggs { namespace sqlite {
+
+    namespace detail {
+
+        // a compressed database starts with a header followed by an index
+        // of its extents, each one of them compressed on its own
+        //
+        //   magic[ 8 ], extent size (4), extent count (4), database size (8)
+        //   extent count * ( offset (8), compressed size (4) )
+        //
+        // all of them little endian
+        char const compressed_magic[] = "EGGSZ001";
+        std::size_t const compressed_header_size = 24;
+        std::size_t const compressed_index_entry_size = 12;
+
+        inline boost::uint64_t get_little_endian( unsigned char const* bytes, std::size_t size )
+        {
+            boost::uint64_t value = 0;
+            for( std::size_t i = size; i != 0; --i )
+                value = ( value << 8 ) | bytes[ i - 1 ];
+            return value;
+        }
+
+        inline void put_little_endian( unsigned char* bytes, boost::uint64_t value, std::size_t size )
+        {
+            for( std::size_t i = 0; i < size; ++i, value >>= 8 )
+                bytes[ i ] = static_cast< unsigned char >( value & 0xff );
+        }
+
+        struct compressed_extent
+        {
+            sqlite3_int64 offset;
+            unsigned size;
+        };
+
+        struct compressed_cache_entry
+        {
+            std::size_t extent;
+            unsigned long long last_used;
+            std::vector< unsigned char > data;
+        };
+
+        struct compressed_file : vfs_file
+        {
+            compressed_file()
+              : compressed( false )
+              , extent_size( 0 )
+              , size( 0 )
+              , clock( 0 )
+            {}
+
+            bool compressed;
+            std::size_t extent_size;
+            sqlite3_int64 size;
+            std::vector< compressed_extent > extents;
+
+            std::vector< unsigned char > input;
+            std::vector< compressed_cache_entry > cache;
+            unsigned long long clock;
+        };
+
+    } // namespace detail
+
+    // compresses a database file into the format read by compressed_vfs; the
+    // source must not be written to while it is being compressed, nor be in
+    // WAL mode
+    inline void compress_database( std::string const& source, std::string const& target, std::size_t extent_size = 1 << 16, int level = Z_BEST_COMPRESSION )
+    {
+        std::ifstream input( source.c_str(), std::ios::binary );
+        if( !input )
+        {
+            BOOST_THROW_EXCEPTION( sqlite_error( result_code::cant_open ) );
+        }
+
+        std::vector< unsigned char > body;
+        std::vector< detail::compressed_extent > extents;
+        std::vector< unsigned char > extent( extent_size );
+        std::vector< unsigned char > output( compressBound( static_cast< uLong >( extent_size ) ) );
+        sqlite3_int64 size = 0;
+        while( input )
+        {
+            input.read( reinterpret_cast< char* >( &extent[ 0 ] ), static_cast< std::streamsize >( extent_size ) );
+            std::size_t const length = static_cast< std::size_t >( input.gcount() );
+            if( length == 0 )
+                break;
+
+            uLongf compressed_size = static_cast< uLongf >( output.size() );
+            if( compress2( &output[ 0 ], &compressed_size, &extent[ 0 ], static_cast< uLong >( length ), level ) != Z_OK )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( result_code::no_mem ) );
+            }
+
+            detail::compressed_extent const entry = { static_cast< sqlite3_int64 >( body.size() ), static_cast< unsigned >( compressed_size ) };
+            extents.push_back( entry );
+            body.insert( body.end(), output.begin(), output.begin() + compressed_size );
+            size += length;
+        }
+        if( input.bad() )
+        {
+            BOOST_THROW_EXCEPTION( sqlite_error( result_code::io_error ) );
+        }
+
+        std::size_t const data_offset = detail::compressed_header_size + extents.size() * detail::compressed_index_entry_size;
+        std::vector< unsigned char > header( data_offset );
+        std::memcpy( &header[ 0 ], detail::compressed_magic, 8 );
+        detail::put_little_endian( &header[ 8 ], extent_size, 4 );
+        detail::put_little_endian( &header[ 12 ], extents.size(), 4 );
+        detail::put_little_endian( &header[ 16 ], static_cast< boost::uint64_t >( size ), 8 );
+        for( std::size_t i = 0; i < extents.size(); ++i )
+        {
+            unsigned char* const entry = &header[ detail::compressed_header_size + i * detail::compressed_index_entry_size ];
+            detail::put_little_endian( entry, static_cast< boost::uint64_t >( data_offset + extents[ i ].offset ), 8 );
+            detail::put_little_endian( entry + 8, extents[ i ].size, 4 );
+        }
+
+        std::ofstream file( target.c_str(), std::ios::binary | std::ios::trunc );
+        file.write( reinterpret_cast< char const* >( &header[ 0 ] ), static_cast< std::streamsize >( header.size() ) );
+        if( !body.empty() )
+            file.write( reinterpret_cast< char const* >( &body[ 0 ] ), static_cast< std::streamsize >( body.size() ) );
+        if( !file.flush() )
+        {
+            BOOST_THROW_EXCEPTION( sqlite_error( result_code::io_error ) );
+        }
+    }
+
+    // a vfs serving databases written by compress_database, decompressing
+    // extents on demand into a small per connection cache; compressed
+    // databases are read-only, any other file goes to the parent vfs as is
+    class compressed_vfs
+      : public basic_vfs< compressed_vfs, detail::compressed_file >
+    {
+        friend class basic_vfs< compressed_vfs, detail::compressed_file >;
+
+    public:
+        explicit compressed_vfs( std::string const& name = "eggs-compressed", std::size_t cache_extents = 16, bool make_default = false, char const* parent = 0 )
+          : basic_vfs< compressed_vfs, detail::compressed_file >( name, make_default, parent )
+          , _cache_extents( (std::max)( cache_extents, std::size_t( 1 ) ) )
+        {}
+
+    private:
+        // returns the decompressed extent, or null on failure
+        std::vector< unsigned char > const* extent( file_type& file, std::size_t index )
+        {
+            detail::compressed_cache_entry* entry = 0;
+            for( std::size_t i = 0; i < file.cache.size(); ++i )
+            {
+                if( file.cache[ i ].extent == index )
+                {
+                    file.cache[ i ].last_used = ++file.clock;
+                    return &file.cache[ i ].data;
+                }
+                if( entry == 0 || file.cache[ i ].last_used < entry->last_used )
+                    entry = &file.cache[ i ];
+            }
+            if( file.cache.size() < _cache_extents )
+            {
+                file.cache.push_back( detail::compressed_cache_entry() );
+                entry = &file.cache.back();
+            }
+
+            // the slot holds no extent until it is fully decompressed
+            entry->extent = static_cast< std::size_t >( -1 );
+            entry->last_used = ++file.clock;
+
+            detail::compressed_extent const& extent = file.extents[ index ];
+            std::size_t const expected = static_cast< std::size_t >(
+                (std::min)( sqlite3_int64( file.extent_size ), file.size - sqlite3_int64( index * file.extent_size ) ) );
+            try
+            {
+                file.input.resize( extent.size );
+                entry->data.resize( expected );
+            } catch( std::bad_alloc const& ) {
+                return 0;
+            }
+
+            if( file.real->pMethods->xRead( file.real, &file.input[ 0 ], static_cast< int >( extent.size ), extent.offset ) != SQLITE_OK )
+                return 0;
+
+            entry->extent = index;
+
+            uLongf length = static_cast< uLongf >( expected );
+            if( uncompress( &entry->data[ 0 ], &length, &file.input[ 0 ], static_cast< uLong >( extent.size ) ) != Z_OK || length != expected )
+            {
+                entry->extent = static_cast< std::size_t >( -1 );
+                return 0;
+            }
+            return &entry->data;
+        }
+
+    private:
+        int open( file_type& file, char const* path, int flags, int* out_flags )
+        {
+            int const result = basic_vfs< compressed_vfs, detail::compressed_file >::open( file, path, flags, out_flags );
+            if( result != SQLITE_OK || ( flags & SQLITE_OPEN_MAIN_DB ) == 0 )
+                return result;
+
+            sqlite3_int64 file_size = 0;
+            unsigned char header[ detail::compressed_header_size ];
+            if( file.real->pMethods->xFileSize( file.real, &file_size ) != SQLITE_OK
+             || file_size < static_cast< sqlite3_int64 >( sizeof( header ) )
+             || file.real->pMethods->xRead( file.real, header, sizeof( header ), 0 ) != SQLITE_OK
+             || std::memcmp( header, detail::compressed_magic, 8 ) != 0 )
+                return SQLITE_OK;
+
+            if( ( flags & SQLITE_OPEN_READONLY ) == 0 )
+                return SQLITE_CANTOPEN;
+
+            // the header has to describe exactly the extents that cover the
+            // database, with an index and extents that lie within the file
+            boost::uint64_t const extent_size = detail::get_little_endian( header + 8, 4 );
+            boost::uint64_t const count = detail::get_little_endian( header + 12, 4 );
+            boost::uint64_t const size = detail::get_little_endian( header + 16, 8 );
+            boost::uint64_t const data_offset = sizeof( header ) + count * detail::compressed_index_entry_size;
+            if( extent_size == 0
+             || ( size >> 63 ) != 0
+             || count != ( size + extent_size - 1 ) / extent_size
+             || data_offset > boost::uint64_t( file_size ) )
+                return SQLITE_CORRUPT;
+
+            file.extent_size = static_cast< std::size_t >( extent_size );
+            file.size = static_cast< sqlite3_int64 >( size );
+
+            std::vector< unsigned char > index( static_cast< std::size_t >( count ) * detail::compressed_index_entry_size );
+            if( !index.empty() && file.real->pMethods->xRead( file.real, &index[ 0 ], static_cast< int >( index.size() ), sizeof( header ) ) != SQLITE_OK )
+                return SQLITE_CORRUPT;
+
+            file.extents.resize( static_cast< std::size_t >( count ) );
+            for( std::size_t i = 0; i < file.extents.size(); ++i )
+            {
+                unsigned char const* const entry = &index[ i * detail::compressed_index_entry_size ];
+                boost::uint64_t const offset = detail::get_little_endian( entry, 8 );
+                boost::uint64_t const compressed_size = detail::get_little_endian( entry + 8, 4 );
+
+                // zlib never produces an empty stream
+                if( compressed_size == 0
+                 || offset < data_offset
+                 || offset > boost::uint64_t( file_size )
+                 || compressed_size > boost::uint64_t( file_size ) - offset )
+                    return SQLITE_CORRUPT;
+
+                file.extents[ i ].offset = static_cast< sqlite3_int64 >( offset );
+                file.extents[ i ].size = static_cast< unsigned >( compressed_size );
+            }
+            file.compressed = true;
+            return SQLITE_OK;
+        }
+
+        int read( file_type& file, void* buffer, int amount, sqlite3_int64 offset )
+        {
+            if( !file.compressed )
+                return file.real->pMethods->xRead( file.real, buffer, amount, offset );
+
+            unsigned char* output = static_cast< unsigned char* >( buffer );
+            sqlite3_int64 const available = offset < file.size ? (std::min)( file.size - offset, sqlite3_int64( amount ) ) : 0;
+            for( sqlite3_int64 done = 0; done < available; )
+            {
+                std::size_t const index = static_cast< std::size_t >( ( offset + done ) / file.extent_size );
+                std::size_t const extent_offset = static_cast< std::size_t >( ( offset + done ) % file.extent_size );
+
+                std::vector< unsigned char > const* const data = index < file.extents.size() ? extent( file, index ) : 0;
+                if( data == 0 )
+                    return SQLITE_IOERR_READ;
+
+                std::size_t const length = static_cast< std::size_t >( (std::min)( available - done, sqlite3_int64( data->size() - extent_offset ) ) );
+                std::memcpy( output + done, &( *data )[ extent_offset ], length );
+                done += length;
+            }
+
+            if( available < amount )
+            {
+                std::memset( output + available, 0, static_cast< std::size_t >( amount - available ) );
+                return SQLITE_IOERR_SHORT_READ;
+            }
+            return SQLITE_OK;
+        }
+        int write( file_type& file, void const* buffer, int amount, sqlite3_int64 offset )
+        {
+            if( file.compressed )
+                return SQLITE_READONLY;
+
+            return file.real->pMethods->xWrite( file.real, buffer, amount, offset );
+        }
+        int truncate( file_type& file, sqlite3_int64 size )
+        {
+            if( file.compressed )
+                return SQLITE_READONLY;
+
+            return file.real->pMethods->xTruncate( file.real, size );
+        }
+        int file_size( file_type& file, sqlite3_int64* size )
+        {
+            if( !file.compressed )
+                return file.real->pMethods->xFileSize( file.real, size );
+
+            *size = file.size;
+            return SQLITE_OK;
+        }
+
+    private:
+        std::size_t _cache_extents;
+    };
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_COMPRESSED_VFS_HPP*/
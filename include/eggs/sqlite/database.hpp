@@ -23,22 +23,59 @@
 
 #include <boost/throw_exception.hpp>
 
+#include <string>
+
 namespace eggs { namespace sqlite {
 
+    struct database_options
+    {
+        database_options()
+          : lookaside_buffer( 0 )
+          , lookaside_slot_size( 0 )
+          , lookaside_slot_count( 0 )
+        {}
+
+        // a caller-provided buffer of slot_size * slot_count bytes, or null to
+        // let SQLite allocate the slots itself; a count of zero keeps defaults
+        void* lookaside_buffer;
+        int lookaside_slot_size;
+        int lookaside_slot_count;
+
+        // the name of a registered vfs, or empty for the default one
+        std::string vfs;
+    };
+
     namespace detail {
         
         inline sqlite3* open(
             char const* filename
           , int mode
+          , database_options const& options
           , boost::system::error_code* error_code = 0
         )
         {
             sqlite3* handle = 0;
-            int const result =
+            int result =
                 sqlite3_open_v2(
                     filename, &handle
-                  , mode, 0
+                  , mode, options.vfs.empty() ? 0 : options.vfs.c_str()
                 );
+            if( result == result_code::ok && options.lookaside_slot_count != 0 )
+            {
+                result =
+                    sqlite3_db_config(
+                        handle, SQLITE_DBCONFIG_LOOKASIDE
+                      , options.lookaside_buffer
+                      , options.lookaside_slot_size, options.lookaside_slot_count
+                    );
+
+                // the connection is of no use to the caller without it
+                if( result != result_code::ok )
+                {
+                    sqlite3_close( handle );
+                    handle = 0;
+                }
+            }
             if( error_code != 0 )
             {
                 error_code->assign( result, sqlite_category() );
@@ -50,6 +87,14 @@ namespace eggs { namespace sqlite {
 
             return handle;
         }
+        inline sqlite3* open(
+            char const* filename
+          , int mode
+          , boost::system::error_code* error_code = 0
+        )
+        {
+            return open( filename, mode, database_options(), error_code );
+        }
 
     } // namespace detail
 
@@ -58,6 +103,8 @@ namespace eggs { namespace sqlite {
     public:
         typedef sqlite3* native_handle_type;
 
+        typedef database_options options;
+
         struct mode
         {
             enum enum_type
@@ -75,8 +122,8 @@ namespace eggs { namespace sqlite {
             BOOST_ASSERT(( handle != 0 ));
         }
 
-        explicit database( std::string const& filename, int mode = database::mode::read_write | database::mode::create )
-          : _handle( detail::open( filename.c_str(), mode ) )
+        explicit database( std::string const& filename, int mode = database::mode::read_write | database::mode::create, database::options const& options = database::options() )
+          : _handle( detail::open( filename.c_str(), mode, options ) )
         {}
         
     private:
@@ -125,15 +172,15 @@ namespace eggs { namespace sqlite {
         return !( left == right );
     }
 
-    inline database open( std::string const& filename, boost::system::error_code& error_code, int mode = database::mode::read_write | database::mode::create )
+    inline database open( std::string const& filename, boost::system::error_code& error_code, int mode = database::mode::read_write | database::mode::create, database::options const& options = database::options() )
     {
-        sqlite3* handle = detail::open( filename.c_str(), mode, &error_code );
+        sqlite3* handle = detail::open( filename.c_str(), mode, options, &error_code );
 
         return database( error_code ? static_cast< sqlite3* >( 0 ) : handle );
     }
-    inline database open( std::string const& filename, int mode = database::mode::read_write | database::mode::create )
+    inline database open( std::string const& filename, int mode = database::mode::read_write | database::mode::create, database::options const& options = database::options() )
     {
-        sqlite3* handle = detail::open( filename.c_str(), mode );
+        sqlite3* handle = detail::open( filename.c_str(), mode, options );
 
         return database( handle );
     }
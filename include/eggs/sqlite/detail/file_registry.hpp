@@ -0,0 +1,129 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/detail/file_registry.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_DETAIL_FILE_REGISTRY_HPP
+#define EGGS_SQLITE_DETAIL_FILE_REGISTRY_HPP
+
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace eggs { namespace sqlite { namespace detail {
+
+    // descriptors shared by every vfs file open on the same inode; closing any
+    // descriptor drops the POSIX locks every connection in the process holds
+    // on the inode, not only those of connections going through this one, so
+    // descriptors of locked files, databases, are kept open for the life of
+    // the process and reused; any other is closed with the last file using it
+    class file_registry
+    {
+    public:
+        static file_registry& instance()
+        {
+            static file_registry registry;
+            return registry;
+        }
+
+        // returns -1 on failure, or when a writable descriptor was requested
+        // but the inode was already opened read-only; locked tells whether
+        // the parent vfs takes POSIX locks on the file
+        int acquire( char const* path, bool writable, bool locked )
+        {
+            boost::mutex::scoped_lock lock( _mutex );
+
+            struct stat status;
+            if( ::stat( path, &status ) == 0 )
+            {
+                entries_type::iterator const iter = _entries.find( key_type( status.st_dev, status.st_ino ) );
+                if( iter != _entries.end() )
+                {
+                    if( writable && !iter->second.writable )
+                        return -1;
+
+                    ++iter->second.references;
+                    iter->second.locked = iter->second.locked || locked;
+                    return iter->second.descriptor;
+                }
+            }
+
+            bool opened_writable = true;
+            int descriptor = ::open( path, O_RDWR | O_CLOEXEC );
+            if( descriptor < 0 && !writable )
+            {
+                opened_writable = false;
+                descriptor = ::open( path, O_RDONLY | O_CLOEXEC );
+            }
+            if( descriptor < 0 || ::fstat( descriptor, &status ) != 0 )
+            {
+                if( descriptor >= 0 )
+                    ::close( descriptor );
+                return -1;
+            }
+
+            entry& value = _entries[ key_type( status.st_dev, status.st_ino ) ];
+            value.descriptor = descriptor;
+            value.references = 1;
+            value.writable = opened_writable;
+            value.locked = locked;
+            return descriptor;
+        }
+
+        void release( int descriptor )
+        {
+            boost::mutex::scoped_lock lock( _mutex );
+
+            for( entries_type::iterator iter = _entries.begin(); iter != _entries.end(); ++iter )
+            {
+                if( iter->second.descriptor == descriptor )
+                {
+                    if( --iter->second.references == 0 && !iter->second.locked )
+                    {
+                        ::close( descriptor );
+                        _entries.erase( iter );
+                    }
+                    return;
+                }
+            }
+        }
+
+    private:
+        typedef std::pair< dev_t, ino_t > key_type;
+
+        struct entry
+        {
+            int descriptor;
+            int references;
+            bool writable;
+            bool locked;
+        };
+
+        typedef std::map< key_type, entry > entries_type;
+
+    private:
+        file_registry() {}
+
+        file_registry( file_registry const& );
+        file_registry& operator =( file_registry const& );
+
+    private:
+        boost::mutex _mutex;
+        entries_type _entries;
+    };
+
+} } } // namespace eggs::sqlite::detail
+
+#endif /*EGGS_SQLITE_DETAIL_FILE_REGISTRY_HPP*/
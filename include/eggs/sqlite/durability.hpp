@@ -0,0 +1,104 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/durability.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_DURABILITY_HPP
+#define EGGS_SQLITE_DURABILITY_HPP
+
+#include <eggs/sqlite/checkpoint_scheduler.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/pragma.hpp>
+
+#include <boost/chrono/duration.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <boost/throw_exception.hpp>
+
+namespace eggs { namespace sqlite {
+
+    struct durability_statistics
+    {
+        boost::uint64_t commits;
+        boost::uint64_t syncs;
+        boost::uint64_t failed_syncs;
+        boost::chrono::nanoseconds max_unsynced_window; // the longest a commit waited to be synced
+        boost::chrono::nanoseconds unsynced_window; // how long the oldest unsynced commit has waited
+    };
+
+    namespace detail {
+
+        inline database& relax_durability( database& db )
+        {
+            set_pragma< pragma::journal_mode >( db, pragma::journal_mode::wal );
+            if( *sqlite3_db_filename( db.native_handle(), "main" ) == '\0'
+             || get_pragma< pragma::journal_mode >( db ) != pragma::journal_mode::wal )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( result_code::cant_open ) );
+            }
+            set_pragma< pragma::synchronous >( db, pragma::synchronous::normal );
+
+            return db;
+        }
+
+        inline checkpoint_options relaxed_checkpoint_options( boost::chrono::milliseconds interval )
+        {
+            checkpoint_options options;
+            options.interval = interval;
+            options.sync_log = true;
+            return options;
+        }
+
+    } // namespace detail
+
+    // puts a database in WAL mode with synchronous=NORMAL and no automatic
+    // checkpoints, so that commits never wait for the disk; a background
+    // thread checkpoints and syncs the log every interval instead. A crash
+    // may lose the commits of the last interval, but never corrupts the file.
+    // Only commits made through the given connection are accounted for.
+    class relaxed_durability
+    {
+    public:
+        explicit relaxed_durability(
+            database& db
+          , boost::chrono::milliseconds interval = boost::chrono::milliseconds( 1000 )
+          , database::options const& options = database::options()
+        )
+          : _scheduler(
+                detail::relax_durability( db )
+              , detail::relaxed_checkpoint_options( interval ), options
+            )
+        {}
+
+        durability_statistics statistics() const
+        {
+            checkpoint_statistics const checkpoints = _scheduler.statistics();
+
+            durability_statistics value;
+            value.commits = checkpoints.commits;
+            value.syncs = checkpoints.syncs;
+            value.failed_syncs = checkpoints.errors;
+            value.max_unsynced_window = checkpoints.max_pending_window;
+            value.unsynced_window = checkpoints.pending_window;
+            return value;
+        }
+
+    private:
+        relaxed_durability( relaxed_durability const& );
+        relaxed_durability& operator =( relaxed_durability const& );
+
+    private:
+        checkpoint_scheduler _scheduler;
+    };
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_DURABILITY_HPP*/
@@ -0,0 +1,137 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/file_control.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_FILE_CONTROL_HPP
+#define EGGS_SQLITE_FILE_CONTROL_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <boost/throw_exception.hpp>
+
+namespace eggs { namespace sqlite {
+
+    namespace detail {
+
+        inline void file_control(
+            sqlite3* db_handle
+          , int opcode, void* argument
+          , boost::system::error_code* error_code = 0
+        )
+        {
+            int const result =
+                sqlite3_file_control(
+                    db_handle, "main"
+                  , opcode, argument
+                );
+            if( error_code != 0 )
+            {
+                error_code->assign( result, sqlite_category() );
+            } else if( result != result_code::ok ) {
+                BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+            }
+        }
+
+    } // namespace detail
+
+    // file controls act on the main database file, and fail with not_found
+    // when the vfs in use does not understand them
+    namespace file_control {
+
+        // grow and shrink the file in multiples of this many bytes, rather
+        // than a page at a time
+        struct chunk_size
+        {
+            typedef int value_type;
+            typedef int argument_type;
+
+            static int opcode(){ return SQLITE_FCNTL_CHUNK_SIZE; }
+        };
+
+        // the file is about to grow to this many bytes, so the vfs may
+        // allocate them at once
+        struct size_hint
+        {
+            typedef sqlite3_int64 value_type;
+            typedef sqlite3_int64 argument_type;
+
+            static int opcode(){ return SQLITE_FCNTL_SIZE_HINT; }
+        };
+
+        // keep the write-ahead log around when the last connection closes,
+        // so that it is reused instead of being created and grown again
+        struct persist_wal
+        {
+            typedef bool value_type;
+            typedef int argument_type;
+
+            static int opcode(){ return SQLITE_FCNTL_PERSIST_WAL; }
+            static argument_type query(){ return -1; }
+        };
+
+        // tells the vfs that a sync was skipped because synchronous=OFF;
+        // SQLite sends it on its own, a custom vfs may want it forwarded
+        struct sync_omitted
+        {
+            typedef void value_type;
+
+            static int opcode(){ return SQLITE_FCNTL_SYNC_OMITTED; }
+        };
+
+    } // namespace file_control
+
+    template< typename FileControl >
+    inline void set_file_control( database& db, typename FileControl::value_type value, boost::system::error_code& error_code )
+    {
+        typename FileControl::argument_type argument = value;
+        detail::file_control( db.native_handle(), FileControl::opcode(), &argument, &error_code );
+    }
+    template< typename FileControl >
+    inline void set_file_control( database& db, typename FileControl::value_type value )
+    {
+        typename FileControl::argument_type argument = value;
+        detail::file_control( db.native_handle(), FileControl::opcode(), &argument );
+    }
+
+    template< typename FileControl >
+    inline typename FileControl::value_type get_file_control( database& db, boost::system::error_code& error_code )
+    {
+        typename FileControl::argument_type argument = FileControl::query();
+        detail::file_control( db.native_handle(), FileControl::opcode(), &argument, &error_code );
+
+        return static_cast< typename FileControl::value_type >( argument );
+    }
+    template< typename FileControl >
+    inline typename FileControl::value_type get_file_control( database& db )
+    {
+        typename FileControl::argument_type argument = FileControl::query();
+        detail::file_control( db.native_handle(), FileControl::opcode(), &argument );
+
+        return static_cast< typename FileControl::value_type >( argument );
+    }
+
+    template< typename FileControl >
+    inline void call_file_control( database& db, boost::system::error_code& error_code )
+    {
+        detail::file_control( db.native_handle(), FileControl::opcode(), 0, &error_code );
+    }
+    template< typename FileControl >
+    inline void call_file_control( database& db )
+    {
+        detail::file_control( db.native_handle(), FileControl::opcode(), 0 );
+    }
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_FILE_CONTROL_HPP*/
@@ -0,0 +1,260 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/function.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_FUNCTION_HPP
+#define EGGS_SQLITE_FUNCTION_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/raw_traits.hpp>
+
+#include <boost/function.hpp>
+
+#include <boost/function_types/function_arity.hpp>
+#include <boost/function_types/parameter_types.hpp>
+#include <boost/function_types/result_type.hpp>
+
+#include <boost/fusion/include/as_vector.hpp>
+#include <boost/fusion/include/fold.hpp>
+#include <boost/fusion/include/invoke.hpp>
+#include <boost/fusion/include/mpl.hpp>
+
+#include <boost/mpl/transform.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <boost/type_traits/is_void.hpp>
+#include <boost/type_traits/remove_cv.hpp>
+#include <boost/type_traits/remove_reference.hpp>
+
+#include <boost/utility/enable_if.hpp>
+
+#include <cstddef>
+
+#include <exception>
+#include <new>
+#include <string>
+
+namespace eggs { namespace sqlite {
+
+    // flags that are not known to the SQLite in use are left out as zero
+    struct function_flags
+    {
+        enum enum_type
+        {
+            none = 0
+#       if defined( SQLITE_DETERMINISTIC )
+          , deterministic = SQLITE_DETERMINISTIC
+#       else
+          , deterministic = 0
+#       endif
+#       if defined( SQLITE_DIRECTONLY )
+          , direct_only = SQLITE_DIRECTONLY
+#       else
+          , direct_only = 0
+#       endif
+#       if defined( SQLITE_INNOCUOUS )
+          , innocuous = SQLITE_INNOCUOUS
+#       else
+          , innocuous = 0
+#       endif
+        };
+    };
+
+    namespace detail {
+
+        template< typename Type >
+        struct function_argument
+          : boost::remove_cv<
+                typename boost::remove_reference< Type >::type
+            >
+        {};
+
+        // the arguments of a call, held by value
+        template< typename Signature >
+        struct function_arguments
+          : boost::fusion::result_of::as_vector<
+                typename boost::mpl::transform<
+                    typename boost::function_types::parameter_types< Signature >::type
+                  , function_argument< boost::mpl::_1 >
+                >::type
+            >
+        {};
+
+        class function_argument_fold
+        {
+        public:
+            typedef std::size_t result_type;
+
+        public:
+            explicit function_argument_fold( sqlite3_value** values )
+              : _values( values )
+            {}
+
+            template< typename T >
+            std::size_t operator ()( std::size_t index, T& v ) const
+            {
+                v = raw_traits< T >::get( _values[ index ] );
+
+                return index + 1;
+            }
+
+        private:
+            sqlite3_value** _values;
+        };
+
+        template< typename Signature, typename Result >
+        inline typename boost::disable_if<
+            boost::is_void< Result >
+        >::type call_function(
+            boost::function< Signature >& function
+          , sqlite3_context* context, sqlite3_value** values
+        )
+        {
+            typename function_arguments< Signature >::type arguments;
+            boost::fusion::fold( arguments, 0, function_argument_fold( values ) );
+
+            raw_traits< Result >::result( context, boost::fusion::invoke( function, arguments ) );
+        }
+        template< typename Signature, typename Result >
+        inline typename boost::enable_if<
+            boost::is_void< Result >
+        >::type call_function(
+            boost::function< Signature >& function
+          , sqlite3_context* context, sqlite3_value** values
+        )
+        {
+            typename function_arguments< Signature >::type arguments;
+            boost::fusion::fold( arguments, 0, function_argument_fold( values ) );
+
+            boost::fusion::invoke( function, arguments );
+            sqlite3_result_null( context );
+        }
+
+        // reports the exception being handled as the error of a call
+        inline void function_error( sqlite3_context* context )
+        {
+            try
+            {
+                throw;
+            } catch( std::bad_alloc const& ) {
+                sqlite3_result_error_nomem( context );
+            } catch( sqlite_error const& e ) {
+                sqlite3_result_error_code( context, e.code().value() );
+            } catch( std::exception const& e ) {
+                sqlite3_result_error( context, e.what(), -1 );
+            } catch( ... ) {
+                sqlite3_result_error( context, "unknown exception", -1 );
+            }
+        }
+
+        // the callback given to SQLite, exceptions are reported as errors
+        template< typename Signature >
+        void function_callback( sqlite3_context* context, int /*count*/, sqlite3_value** values )
+        {
+            typedef typename boost::function_types::result_type< Signature >::type result_type;
+
+            boost::function< Signature >& function =
+                *static_cast< boost::function< Signature >* >( sqlite3_user_data( context ) );
+            try
+            {
+                call_function< Signature, result_type >( function, context, values );
+            } catch( ... ) {
+                function_error( context );
+            }
+        }
+
+        template< typename Signature >
+        void function_destroy( void* function )
+        {
+            delete static_cast< boost::function< Signature >* >( function );
+        }
+
+        // SQLite takes ownership of the function, even on failure
+        template< typename Signature, typename Function >
+        inline int create_function( sqlite3* db, char const* name, Function function, int flags )
+        {
+            return
+                sqlite3_create_function_v2(
+                    db, name
+                  , boost::function_types::function_arity< Signature >::value
+                  , SQLITE_UTF8 | flags
+                  , new boost::function< Signature >( function )
+                  , &function_callback< Signature >, 0, 0
+                  , &function_destroy< Signature >
+                );
+        }
+
+    } // namespace detail
+
+    // makes a scalar function callable from sql; arguments and result are
+    // converted as for statements, and exceptions thrown by the function
+    // become sql errors. the signature is given explicitly for function
+    // objects, and deduced for plain functions
+    template< typename Signature, typename Function >
+    inline void create_function(
+        database& db, std::string const& name, Function function
+      , int flags, boost::system::error_code& error_code
+    )
+    {
+        int const result = detail::create_function< Signature >( db.native_handle(), name.c_str(), function, flags );
+        error_code.assign( result, sqlite_category() );
+    }
+    template< typename Signature, typename Function >
+    inline void create_function(
+        database& db, std::string const& name, Function function
+      , int flags = function_flags::none
+    )
+    {
+        int const result = detail::create_function< Signature >( db.native_handle(), name.c_str(), function, flags );
+        if( result != SQLITE_OK )
+        {
+            BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+        }
+    }
+
+    template< typename Signature >
+    inline void create_function(
+        database& db, std::string const& name, Signature* function
+      , int flags, boost::system::error_code& error_code
+    )
+    {
+        create_function< Signature, Signature* >( db, name, function, flags, error_code );
+    }
+    template< typename Signature >
+    inline void create_function(
+        database& db, std::string const& name, Signature* function
+      , int flags = function_flags::none
+    )
+    {
+        create_function< Signature, Signature* >( db, name, function, flags );
+    }
+
+    // removes a function previously created with the given number of arguments
+    inline void drop_function( database& db, std::string const& name, int arity )
+    {
+        int const result =
+            sqlite3_create_function_v2(
+                db.native_handle(), name.c_str(), arity, SQLITE_UTF8
+              , 0, 0, 0, 0, 0
+            );
+        if( result != SQLITE_OK )
+        {
+            BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+        }
+    }
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_FUNCTION_HPP*/
@@ -0,0 +1,188 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/instrumented_vfs.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_INSTRUMENTED_VFS_HPP
+#define EGGS_SQLITE_INSTRUMENTED_VFS_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/vfs.hpp>
+
+#include <boost/atomic.hpp>
+
+#include <boost/chrono/duration.hpp>
+#include <boost/chrono/system_clocks.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <string>
+
+namespace eggs { namespace sqlite {
+
+    struct file_kind
+    {
+        enum enum_type
+        {
+            main_db
+          , journal
+          , wal
+          , temp
+        };
+    };
+
+    struct io_statistics
+    {
+        boost::uint64_t reads;
+        boost::uint64_t writes;
+        boost::uint64_t syncs;
+        boost::uint64_t bytes_read;
+        boost::uint64_t bytes_written;
+        boost::chrono::nanoseconds read_time;
+        boost::chrono::nanoseconds write_time;
+        boost::chrono::nanoseconds sync_time;
+    };
+
+    namespace detail {
+
+        inline file_kind::enum_type classify_file( int flags )
+        {
+            if( flags & SQLITE_OPEN_MAIN_DB )
+                return file_kind::main_db;
+            if( flags & ( SQLITE_OPEN_MAIN_JOURNAL | SQLITE_OPEN_MASTER_JOURNAL ) )
+                return file_kind::journal;
+            if( flags & SQLITE_OPEN_WAL )
+                return file_kind::wal;
+            return file_kind::temp;
+        }
+
+        struct io_counters
+        {
+            io_counters()
+              : reads( 0 ), writes( 0 ), syncs( 0 )
+              , bytes_read( 0 ), bytes_written( 0 )
+              , read_time( 0 ), write_time( 0 ), sync_time( 0 )
+            {}
+
+            boost::atomic< boost::uint64_t > reads;
+            boost::atomic< boost::uint64_t > writes;
+            boost::atomic< boost::uint64_t > syncs;
+            boost::atomic< boost::uint64_t > bytes_read;
+            boost::atomic< boost::uint64_t > bytes_written;
+            boost::atomic< boost::int64_t > read_time;
+            boost::atomic< boost::int64_t > write_time;
+            boost::atomic< boost::int64_t > sync_time;
+        };
+
+        struct instrumented_file : vfs_file
+        {
+            file_kind::enum_type type;
+        };
+
+        inline boost::int64_t elapsed_since( boost::chrono::steady_clock::time_point start )
+        {
+            return boost::chrono::duration_cast< boost::chrono::nanoseconds >(
+                boost::chrono::steady_clock::now() - start ).count();
+        }
+
+    } // namespace detail
+
+    // a pass-through vfs counting reads, writes and syncs per file type; open
+    // a database with options.vfs set to its name to have it accounted for
+    class instrumented_vfs
+      : public basic_vfs< instrumented_vfs, detail::instrumented_file >
+    {
+        friend class basic_vfs< instrumented_vfs, detail::instrumented_file >;
+
+    public:
+        explicit instrumented_vfs( std::string const& name = "eggs-instrumented", bool make_default = false, char const* parent = 0 )
+          : basic_vfs< instrumented_vfs, detail::instrumented_file >( name, make_default, parent )
+        {}
+
+        io_statistics statistics( file_kind::enum_type type ) const
+        {
+            detail::io_counters const& counters = _counters[ type ];
+
+            io_statistics value;
+            value.reads = counters.reads.load( boost::memory_order_relaxed );
+            value.writes = counters.writes.load( boost::memory_order_relaxed );
+            value.syncs = counters.syncs.load( boost::memory_order_relaxed );
+            value.bytes_read = counters.bytes_read.load( boost::memory_order_relaxed );
+            value.bytes_written = counters.bytes_written.load( boost::memory_order_relaxed );
+            value.read_time = boost::chrono::nanoseconds( counters.read_time.load( boost::memory_order_relaxed ) );
+            value.write_time = boost::chrono::nanoseconds( counters.write_time.load( boost::memory_order_relaxed ) );
+            value.sync_time = boost::chrono::nanoseconds( counters.sync_time.load( boost::memory_order_relaxed ) );
+            return value;
+        }
+
+        void reset()
+        {
+            for( int type = file_kind::main_db; type <= file_kind::temp; ++type )
+            {
+                detail::io_counters& counters = _counters[ type ];
+
+                counters.reads.store( 0, boost::memory_order_relaxed );
+                counters.writes.store( 0, boost::memory_order_relaxed );
+                counters.syncs.store( 0, boost::memory_order_relaxed );
+                counters.bytes_read.store( 0, boost::memory_order_relaxed );
+                counters.bytes_written.store( 0, boost::memory_order_relaxed );
+                counters.read_time.store( 0, boost::memory_order_relaxed );
+                counters.write_time.store( 0, boost::memory_order_relaxed );
+                counters.sync_time.store( 0, boost::memory_order_relaxed );
+            }
+        }
+
+    private:
+        int open( file_type& file, char const* path, int flags, int* out_flags )
+        {
+            file.type = detail::classify_file( flags );
+
+            return basic_vfs< instrumented_vfs, detail::instrumented_file >::open( file, path, flags, out_flags );
+        }
+
+        int read( file_type& file, void* buffer, int amount, sqlite3_int64 offset )
+        {
+            boost::chrono::steady_clock::time_point const start = boost::chrono::steady_clock::now();
+            int const result = file.real->pMethods->xRead( file.real, buffer, amount, offset );
+
+            detail::io_counters& counters = _counters[ file.type ];
+            counters.read_time.fetch_add( detail::elapsed_since( start ), boost::memory_order_relaxed );
+            counters.reads.fetch_add( 1, boost::memory_order_relaxed );
+            counters.bytes_read.fetch_add( amount, boost::memory_order_relaxed );
+            return result;
+        }
+        int write( file_type& file, void const* buffer, int amount, sqlite3_int64 offset )
+        {
+            boost::chrono::steady_clock::time_point const start = boost::chrono::steady_clock::now();
+            int const result = file.real->pMethods->xWrite( file.real, buffer, amount, offset );
+
+            detail::io_counters& counters = _counters[ file.type ];
+            counters.write_time.fetch_add( detail::elapsed_since( start ), boost::memory_order_relaxed );
+            counters.writes.fetch_add( 1, boost::memory_order_relaxed );
+            counters.bytes_written.fetch_add( amount, boost::memory_order_relaxed );
+            return result;
+        }
+        int sync( file_type& file, int flags )
+        {
+            boost::chrono::steady_clock::time_point const start = boost::chrono::steady_clock::now();
+            int const result = file.real->pMethods->xSync( file.real, flags );
+
+            detail::io_counters& counters = _counters[ file.type ];
+            counters.sync_time.fetch_add( detail::elapsed_since( start ), boost::memory_order_relaxed );
+            counters.syncs.fetch_add( 1, boost::memory_order_relaxed );
+            return result;
+        }
+
+    private:
+        detail::io_counters _counters[ file_kind::temp + 1 ];
+    };
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_INSTRUMENTED_VFS_HPP*/
@@ -0,0 +1,776 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/knn_table.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_KNN_TABLE_HPP
+#define EGGS_SQLITE_KNN_TABLE_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/similarity.hpp>
+#include <eggs/sqlite/statement.hpp>
+#include <eggs/sqlite/virtual_table.hpp>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <boost/thread/thread.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <boost/unordered_map.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <functional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace eggs { namespace sqlite {
+
+    struct knn_metric
+    {
+        enum enum_type
+        {
+            l2 // the euclidean distance
+          , cosine // one minus the cosine similarity
+          , dot // the dot product, negated so that nearer is smaller
+        };
+    };
+
+    struct knn_options
+    {
+        knn_options()
+          : threads( boost::thread::hardware_concurrency() )
+          , rows_per_thread( 16384 )
+          , max_pending( 4096 )
+          , update_hook( 0 ), update_hook_argument( 0 )
+          , rollback_hook( 0 ), rollback_hook_argument( 0 )
+        {}
+
+        // the most threads to scan with
+        unsigned threads;
+
+        // the fewest rows worth a thread of their own
+        std::size_t rows_per_thread;
+
+        // changed rows are read back one by one on the next search, past this
+        // many the whole column is read again instead
+        std::size_t max_pending;
+
+        // hooks of the connection's own, called after those of the module
+        // and put back once its last table is gone; SQLite does not hand
+        // back the hooks it replaces, so they have to be given here
+        void ( *update_hook )( void*, int, char const*, char const*, sqlite3_int64 );
+        void* update_hook_argument;
+        void ( *rollback_hook )( void* );
+        void* rollback_hook_argument;
+    };
+
+    namespace detail {
+
+        // a distance and the rowid it belongs to
+        typedef std::pair< float, sqlite3_int64 > knn_match;
+
+        struct knn_constraint
+        {
+            enum enum_type
+            {
+                match = 1
+              , k = 2
+              , limit = 4
+            };
+        };
+
+        struct knn_table : virtual_table
+        {
+            knn_table()
+              : db( 0 )
+              , metric( knn_metric::l2 )
+              , dimension( 0 ), stride( 0 )
+              , rows( 0 ), capacity( 0 )
+              , matrix( 0 )
+              , loaded( false ), reload( false )
+              , unique( false ), written( false )
+              , changes( 0 ), notifications( 0 )
+              , data_version( 0 )
+            {}
+
+            sqlite3* db;
+            std::string schema_name;
+            std::string name;
+            std::string column;
+            knn_metric::enum_type metric;
+
+            // rows are padded to a multiple of 8 floats, and the matrix is
+            // aligned to 32 bytes, so that every row is
+            std::size_t dimension;
+            std::size_t stride;
+            std::size_t rows;
+            std::size_t capacity;
+            std::vector< float > storage;
+            float* matrix;
+            std::vector< float > norms;
+            std::vector< sqlite3_int64 > rowids;
+            boost::unordered_map< sqlite3_int64, std::size_t > slots;
+
+            std::set< sqlite3_int64 > pending;
+            bool loaded;
+            bool reload;
+
+            // a REPLACE deletes the rows it conflicts with on unique columns
+            // without a notification, so tables with unique indexes count
+            // their rows again after rows were written
+            bool unique;
+            bool written;
+
+            // changes made through the connection as of the last refresh,
+            // and how many of them were notified
+            int changes;
+            boost::uint64_t notifications;
+            int data_version;
+        };
+
+        struct knn_cursor : virtual_table_cursor
+        {
+            knn_cursor()
+              : position( 0 )
+              , k( 0 )
+              , heap( false )
+            {}
+
+            knn_match const& current() const
+            {
+                return heap ? matches.front() : matches[ position ];
+            }
+
+            std::vector< knn_match > matches;
+            std::size_t position;
+            sqlite3_int64 k;
+            bool heap;
+        };
+
+        class knn_statement
+        {
+        public:
+            explicit knn_statement( sqlite3* db, std::string const& sql )
+              : _handle( prepare( db, sql.c_str(), static_cast< int >( sql.size() ) ) )
+            {}
+
+            ~knn_statement()
+            {
+                sqlite3_finalize( _handle );
+            }
+
+            sqlite3_stmt* native_handle() const
+            {
+                return _handle;
+            }
+
+        private:
+            knn_statement( knn_statement const& );
+            knn_statement& operator =( knn_statement const& );
+
+        private:
+            sqlite3_stmt* _handle;
+        };
+
+        inline std::string knn_select( knn_table const& table, char const* format )
+        {
+            char* sql = sqlite3_mprintf( format, table.column.c_str(), table.schema_name.c_str(), table.name.c_str() );
+            if( sql == 0 )
+                throw std::bad_alloc();
+
+            std::string const result( sql );
+            sqlite3_free( sql );
+            return result;
+        }
+
+        inline float knn_norm( float const* row, std::size_t dimension )
+        {
+            return std::sqrt( get_similarity_kernels().dot( row, row, dimension ) );
+        }
+
+        inline void knn_reserve( knn_table& table, std::size_t rows )
+        {
+            if( rows <= table.capacity )
+                return;
+
+            std::size_t const capacity = (std::max)( rows, (std::max)( table.capacity * 2, std::size_t( 1024 ) ) );
+            std::vector< float > storage( capacity * table.stride + 32 / sizeof( float ) );
+            std::size_t const misalignment = reinterpret_cast< std::size_t >( &storage[ 0 ] ) % 32;
+            float* const matrix = &storage[ 0 ] + ( misalignment != 0 ? ( 32 - misalignment ) / sizeof( float ) : 0 );
+
+            if( table.rows != 0 )
+                std::memcpy( matrix, table.matrix, table.rows * table.stride * sizeof( float ) );
+
+            table.storage.swap( storage );
+            table.matrix = matrix;
+            table.capacity = capacity;
+        }
+
+        inline void knn_remove( knn_table& table, sqlite3_int64 rowid )
+        {
+            boost::unordered_map< sqlite3_int64, std::size_t >::iterator const iter = table.slots.find( rowid );
+            if( iter == table.slots.end() )
+                return;
+
+            // the last row takes the place of the removed one
+            std::size_t const slot = iter->second, last = table.rows - 1;
+            if( slot != last )
+            {
+                std::memcpy( table.matrix + slot * table.stride, table.matrix + last * table.stride, table.stride * sizeof( float ) );
+                table.norms[ slot ] = table.norms[ last ];
+                table.rowids[ slot ] = table.rowids[ last ];
+                table.slots[ table.rowids[ slot ] ] = slot;
+            }
+            table.norms.pop_back();
+            table.rowids.pop_back();
+            table.slots.erase( rowid );
+            --table.rows;
+        }
+
+        inline void knn_put( knn_table& table, sqlite3_int64 rowid, void const* bytes, std::size_t size )
+        {
+            if( bytes == 0 || size == 0 )
+            {
+                knn_remove( table, rowid );
+                return;
+            }
+
+            if( table.dimension == 0 )
+            {
+                table.dimension = size / sizeof( float );
+                table.stride = ( table.dimension + 7 ) & ~std::size_t( 7 );
+            }
+            if( size != table.dimension * sizeof( float ) )
+            {
+                throw std::invalid_argument( "vectors of different dimensions in knn column" );
+            }
+
+            std::size_t slot;
+            boost::unordered_map< sqlite3_int64, std::size_t >::const_iterator const iter = table.slots.find( rowid );
+            if( iter != table.slots.end() )
+            {
+                slot = iter->second;
+            } else {
+                knn_reserve( table, table.rows + 1 );
+                slot = table.rows++;
+                table.norms.push_back( 0 );
+                table.rowids.push_back( rowid );
+                table.slots[ rowid ] = slot;
+            }
+
+            float* const row = table.matrix + slot * table.stride;
+            std::memcpy( row, bytes, size );
+            table.norms[ slot ] = knn_norm( row, table.dimension );
+        }
+
+        inline void knn_load( knn_table& table )
+        {
+            table.dimension = table.stride = table.rows = table.capacity = 0;
+            table.storage.clear();
+            table.matrix = 0;
+            table.norms.clear();
+            table.rowids.clear();
+            table.slots.clear();
+            table.pending.clear();
+
+            {
+                char* sql = sqlite3_mprintf( "PRAGMA \"%w\".index_list( \"%w\" )", table.schema_name.c_str(), table.name.c_str() );
+                if( sql == 0 )
+                    throw std::bad_alloc();
+                knn_statement indexes( table.db, sql );
+                sqlite3_free( sql );
+
+                table.unique = false;
+                while( step( indexes.native_handle() ) == result_code::row )
+                {
+                    if( sqlite3_column_int( indexes.native_handle(), 2 ) != 0 )
+                        table.unique = true;
+                }
+            }
+
+            knn_statement scan( table.db, knn_select( table, "SELECT rowid, \"%w\" FROM \"%w\".\"%w\"" ) );
+            while( step( scan.native_handle() ) == result_code::row )
+            {
+                knn_put(
+                    table, sqlite3_column_int64( scan.native_handle(), 0 )
+                  , sqlite3_column_blob( scan.native_handle(), 1 ), sqlite3_column_bytes( scan.native_handle(), 1 ) );
+            }
+
+            table.loaded = true;
+            table.reload = false;
+            table.written = false;
+        }
+
+        // brings the matrix up to date with the column it mirrors, given how
+        // many changes the connection has notified so far
+        inline void knn_refresh( knn_table& table, boost::uint64_t notifications )
+        {
+            // rows deleted by the truncate optimization are counted as
+            // changes but not notified
+            {
+                int const changes = sqlite3_total_changes( table.db );
+                unsigned const delta = static_cast< unsigned >( changes ) - static_cast< unsigned >( table.changes );
+                if( delta > notifications - table.notifications )
+                    table.reload = true;
+                table.changes = changes;
+                table.notifications = notifications;
+            }
+
+#       if SQLITE_VERSION_NUMBER >= 3012000
+            // writes made through other connections are only seen through this
+            {
+                char* sql = sqlite3_mprintf( "PRAGMA \"%w\".data_version", table.schema_name.c_str() );
+                if( sql == 0 )
+                    throw std::bad_alloc();
+                knn_statement version( table.db, sql );
+                sqlite3_free( sql );
+
+                step( version.native_handle() );
+                int const data_version = sqlite3_column_int( version.native_handle(), 0 );
+                if( data_version != table.data_version )
+                    table.reload = true;
+                table.data_version = data_version;
+            }
+#       endif
+
+            if( !table.loaded || table.reload )
+            {
+                knn_load( table );
+                return;
+            }
+            if( table.pending.empty() )
+                return;
+
+            knn_statement fetch( table.db, knn_select( table, "SELECT \"%w\" FROM \"%w\".\"%w\" WHERE rowid = ?" ) );
+            for( std::set< sqlite3_int64 >::const_iterator iter = table.pending.begin(); iter != table.pending.end(); ++iter )
+            {
+                sqlite3_bind_int64( fetch.native_handle(), 1, *iter );
+                if( step( fetch.native_handle() ) == result_code::row )
+                {
+                    knn_put(
+                        table, *iter
+                      , sqlite3_column_blob( fetch.native_handle(), 0 ), sqlite3_column_bytes( fetch.native_handle(), 0 ) );
+                } else {
+                    knn_remove( table, *iter );
+                }
+                sqlite3_reset( fetch.native_handle() );
+            }
+            table.pending.clear();
+
+            if( table.unique && table.written )
+            {
+                knn_statement count( table.db, knn_select( table, "SELECT count( * ) FROM ( SELECT \"%w\" AS value FROM \"%w\".\"%w\" ) WHERE length( value ) > 0" ) );
+                step( count.native_handle() );
+                if( static_cast< std::size_t >( sqlite3_column_int64( count.native_handle(), 0 ) ) != table.rows )
+                {
+                    knn_load( table );
+                    return;
+                }
+                table.written = false;
+            }
+        }
+
+        inline float knn_distance( knn_table const& table, float const* query, float query_norm, std::size_t slot )
+        {
+            float const* const row = table.matrix + slot * table.stride;
+            similarity_kernels const& kernels = get_similarity_kernels();
+
+            switch( table.metric )
+            {
+            case knn_metric::l2:
+                return kernels.squared_l2( row, query, table.dimension );
+            case knn_metric::cosine:
+                if( table.norms[ slot ] == 0 || query_norm == 0 )
+                    return 1;
+                return 1 - kernels.dot( row, query, table.dimension ) / ( table.norms[ slot ] * query_norm );
+            default:
+                return -kernels.dot( row, query, table.dimension );
+            }
+        }
+
+        // keeps the k nearest rows of a part of the matrix in a max-heap, or
+        // every row when k is zero
+        struct knn_scan
+        {
+            void operator ()() const
+            {
+                if( k == 0 )
+                {
+                    result->reserve( last - first );
+                    for( std::size_t slot = first; slot < last; ++slot )
+                        result->push_back( knn_match( knn_distance( *table, query, query_norm, slot ), table->rowids[ slot ] ) );
+                    return;
+                }
+
+                result->reserve( k );
+                for( std::size_t slot = first; slot < last; ++slot )
+                {
+                    float const distance = knn_distance( *table, query, query_norm, slot );
+                    if( result->size() < k )
+                    {
+                        result->push_back( knn_match( distance, table->rowids[ slot ] ) );
+                        std::push_heap( result->begin(), result->end() );
+                    } else if( distance < result->front().first ) {
+                        std::pop_heap( result->begin(), result->end() );
+                        result->back() = knn_match( distance, table->rowids[ slot ] );
+                        std::push_heap( result->begin(), result->end() );
+                    }
+                }
+            }
+
+            knn_table const* table;
+            float const* query;
+            float query_norm;
+            std::size_t first;
+            std::size_t last;
+            std::size_t k;
+            std::vector< knn_match >* result;
+        };
+
+        // the k nearest rows, nearest first; for a k of zero every row, as a
+        // min-heap to be popped only as far as they are read
+        inline std::vector< knn_match > knn_search( knn_table const& table, knn_options const& options, float_span query, std::size_t k )
+        {
+            std::vector< float > aligned_query( query.size() );
+            if( !aligned_query.empty() )
+                std::memcpy( &aligned_query[ 0 ], query.data(), query.size() * sizeof( float ) );
+
+            float const query_norm = aligned_query.empty() ? 0 : knn_norm( &aligned_query[ 0 ], aligned_query.size() );
+
+            if( k > table.rows )
+                k = table.rows;
+
+            std::size_t const parts =
+                (std::max)( std::size_t( 1 ), (std::min)( std::size_t( options.threads ), table.rows / (std::max)( options.rows_per_thread, std::size_t( 1 ) ) ) );
+            std::vector< std::vector< knn_match > > results( parts );
+
+            boost::thread_group threads;
+            try
+            {
+                for( std::size_t part = 0; part < parts; ++part )
+                {
+                    knn_scan scan;
+                    scan.table = &table;
+                    scan.query = aligned_query.empty() ? 0 : &aligned_query[ 0 ];
+                    scan.query_norm = query_norm;
+                    scan.first = table.rows * part / parts;
+                    scan.last = table.rows * ( part + 1 ) / parts;
+                    scan.k = k;
+                    scan.result = &results[ part ];
+
+                    if( part + 1 < parts )
+                        threads.create_thread( scan );
+                    else
+                        scan();
+                }
+            } catch( ... ) {
+                threads.join_all();
+                throw;
+            }
+            threads.join_all();
+
+            std::vector< knn_match > matches;
+            matches.reserve( k != 0 ? parts * k : table.rows );
+            for( std::size_t part = 0; part < parts; ++part )
+                matches.insert( matches.end(), results[ part ].begin(), results[ part ].end() );
+
+            if( k == 0 )
+            {
+                std::make_heap( matches.begin(), matches.end(), std::greater< knn_match >() );
+                return matches;
+            }
+
+            std::partial_sort( matches.begin(), matches.begin() + k, matches.end() );
+            matches.resize( k );
+            return matches;
+        }
+
+    } // namespace detail
+
+    // a virtual table searching the k nearest rows of a table by a column of
+    // packed float blobs, declared as
+    //
+    //   CREATE VIRTUAL TABLE name USING knn( table, column[, l2|cosine|dot] )
+    //
+    // with a distance column, and the rowid of the matching row as its own;
+    // searched as
+    //
+    //   SELECT rowid, distance FROM name WHERE query_vec MATCH ? AND k = 10
+    //
+    // or with a LIMIT in place of k when SQLite is recent enough to pass it
+    // on. The column is kept in memory and refreshed from the update hook of
+    // the connection, which the module takes over; hooks of the connection's
+    // own are given in knn_options to be chained to. Changes SQLite does not
+    // notify, counted in sqlite3_total_changes, have the column read again,
+    // and so do writes to tables without rowid. Writes made through other
+    // connections are noticed through PRAGMA data_version, which needs
+    // SQLite 3.12 or later; with older versions they stay unseen until the
+    // table is connected again
+    class knn_module
+      : public basic_module< knn_module, detail::knn_table, detail::knn_cursor >
+    {
+        friend class basic_module< knn_module, detail::knn_table, detail::knn_cursor >;
+
+    public:
+        explicit knn_module( knn_options const& options = knn_options() )
+          : _options( options )
+          , _notifications( 0 )
+        {}
+
+    private:
+        int connect( sqlite3* db, table_type& table, int argc, char const* const* argv, std::string& schema )
+        {
+            if( argc < 5 || argc > 6 )
+            {
+                throw std::invalid_argument( "knn takes a table, a column and an optional metric" );
+            }
+
+            table.db = db;
+            table.schema_name = argv[ 1 ];
+            table.name = detail::virtual_table_argument( argv[ 3 ] );
+            table.column = detail::virtual_table_argument( argv[ 4 ] );
+            if( argc == 6 )
+            {
+                std::string const metric = detail::virtual_table_argument( argv[ 5 ] );
+                if( boost::algorithm::iequals( metric, "l2" ) )
+                    table.metric = knn_metric::l2;
+                else if( boost::algorithm::iequals( metric, "cosine" ) )
+                    table.metric = knn_metric::cosine;
+                else if( boost::algorithm::iequals( metric, "dot" ) )
+                    table.metric = knn_metric::dot;
+                else
+                    throw std::invalid_argument( "unknown knn metric: " + metric );
+            }
+
+            if( _tables.empty() )
+            {
+                sqlite3_update_hook( db, &knn_module::on_update, this );
+                sqlite3_rollback_hook( db, &knn_module::on_rollback, this );
+            }
+            _tables.push_back( &table );
+
+            schema = "CREATE TABLE x( distance REAL, query_vec HIDDEN, k HIDDEN )";
+            return SQLITE_OK;
+        }
+
+        int disconnect( table_type& table )
+        {
+            _tables.erase( std::remove( _tables.begin(), _tables.end(), &table ), _tables.end() );
+            if( _tables.empty() )
+            {
+                sqlite3_update_hook( table.db, _options.update_hook, _options.update_hook_argument );
+                sqlite3_rollback_hook( table.db, _options.rollback_hook, _options.rollback_hook_argument );
+            }
+            return SQLITE_OK;
+        }
+
+        int best_index( table_type& table, sqlite3_index_info* info )
+        {
+            int match = -1, k = -1, limit = -1;
+            bool offset = false;
+            for( int i = 0; i < info->nConstraint; ++i )
+            {
+                sqlite3_index_info::sqlite3_index_constraint const& constraint = info->aConstraint[ i ];
+                if( !constraint.usable )
+                    continue;
+
+                if( constraint.iColumn == 1 && constraint.op == SQLITE_INDEX_CONSTRAINT_MATCH )
+                    match = i;
+                else if( constraint.iColumn == 2 && constraint.op == SQLITE_INDEX_CONSTRAINT_EQ )
+                    k = i;
+#           if defined( SQLITE_INDEX_CONSTRAINT_LIMIT )
+                else if( constraint.op == SQLITE_INDEX_CONSTRAINT_LIMIT )
+                    limit = i;
+                else if( constraint.op == SQLITE_INDEX_CONSTRAINT_OFFSET )
+                    offset = true;
+#           endif
+            }
+
+            // without a query every row would be as near as any other
+            if( match < 0 )
+            {
+                info->estimatedCost = 1e99;
+                return SQLITE_OK;
+            }
+
+            int arguments = 0;
+            info->idxNum = detail::knn_constraint::match;
+            info->aConstraintUsage[ match ].argvIndex = ++arguments;
+            info->aConstraintUsage[ match ].omit = 1;
+            if( k >= 0 )
+            {
+                info->idxNum |= detail::knn_constraint::k;
+                info->aConstraintUsage[ k ].argvIndex = ++arguments;
+                info->aConstraintUsage[ k ].omit = 1;
+            }
+            if( limit >= 0 && !offset )
+            {
+                info->idxNum |= detail::knn_constraint::limit;
+                info->aConstraintUsage[ limit ].argvIndex = ++arguments;
+                info->aConstraintUsage[ limit ].omit = 1;
+            }
+
+            if( info->nOrderBy == 1 && info->aOrderBy[ 0 ].iColumn == 0 && !info->aOrderBy[ 0 ].desc )
+                info->orderByConsumed = 1;
+
+            info->estimatedCost = table.loaded ? double( table.rows ) : 1e6;
+            return SQLITE_OK;
+        }
+
+        int filter( cursor_type& cursor, int index, char const* /*index_string*/, int /*argc*/, sqlite3_value** argv )
+        {
+            table_type& t = table( cursor );
+
+            cursor.matches.clear();
+            cursor.position = 0;
+            cursor.k = 0;
+            cursor.heap = false;
+            if( ( index & detail::knn_constraint::match ) == 0 )
+            {
+                throw std::invalid_argument( "knn tables are searched with query_vec MATCH" );
+            }
+
+            detail::knn_refresh( t, _notifications );
+
+            int argument = 0;
+            float_span const query = raw_traits< float_span >::get( argv[ argument++ ] );
+            if( ( index & detail::knn_constraint::k ) != 0 )
+                cursor.k = sqlite3_value_int64( argv[ argument++ ] );
+            if( ( index & detail::knn_constraint::limit ) != 0 )
+            {
+                sqlite3_int64 const limit = sqlite3_value_int64( argv[ argument++ ] );
+                cursor.k = cursor.k > 0 ? (std::min)( cursor.k, limit ) : limit;
+            }
+            if( cursor.k < 0 )
+                cursor.k = 0;
+
+            if( t.rows == 0 )
+                return SQLITE_OK;
+            if( query.size() != t.dimension )
+            {
+                throw std::invalid_argument( "the query vector has the wrong dimension" );
+            }
+
+            // a limit of zero asks for no rows, a missing k for all of them
+            if( ( index & ( detail::knn_constraint::k | detail::knn_constraint::limit ) ) != 0 && cursor.k == 0 )
+                return SQLITE_OK;
+
+            cursor.matches = detail::knn_search( t, _options, query, static_cast< std::size_t >( cursor.k ) );
+            cursor.heap = cursor.k == 0;
+            return SQLITE_OK;
+        }
+
+        int next( cursor_type& cursor )
+        {
+            if( cursor.heap )
+            {
+                std::pop_heap( cursor.matches.begin(), cursor.matches.end(), std::greater< detail::knn_match >() );
+                cursor.matches.pop_back();
+            } else {
+                ++cursor.position;
+            }
+            return SQLITE_OK;
+        }
+
+        bool eof( cursor_type& cursor )
+        {
+            return cursor.heap ? cursor.matches.empty() : cursor.position >= cursor.matches.size();
+        }
+
+        int column( cursor_type& cursor, sqlite3_context* context, int column )
+        {
+            switch( column )
+            {
+            case 0:
+                {
+                    double const distance = cursor.current().first;
+                    sqlite3_result_double( context, table( cursor ).metric == knn_metric::l2 ? std::sqrt( distance ) : distance );
+                }
+                break;
+            case 2:
+                sqlite3_result_int64( context, cursor.k );
+                break;
+            default:
+                sqlite3_result_null( context );
+                break;
+            }
+            return SQLITE_OK;
+        }
+
+        int rowid( cursor_type& cursor, sqlite3_int64* rowid )
+        {
+            *rowid = cursor.current().second;
+            return SQLITE_OK;
+        }
+
+    private:
+        // changed rows are only noted here, SQLite may not be used from a hook
+        static void on_update( void* self, int operation, char const* schema_name, char const* name, sqlite3_int64 rowid )
+        {
+            knn_module& module = *static_cast< knn_module* >( self );
+            ++module._notifications;
+            for( std::size_t i = 0; i < module._tables.size(); ++i )
+            {
+                detail::knn_table& table = *module._tables[ i ];
+                if( !table.loaded || table.reload )
+                    continue;
+                if( !boost::algorithm::iequals( table.name, name ) || !boost::algorithm::iequals( table.schema_name, schema_name ) )
+                    continue;
+
+                if( table.pending.size() < module._options.max_pending )
+                {
+                    table.pending.insert( rowid );
+                    if( operation != SQLITE_DELETE )
+                        table.written = true;
+                } else {
+                    table.pending.clear();
+                    table.reload = true;
+                }
+            }
+
+            if( module._options.update_hook != 0 )
+                module._options.update_hook( module._options.update_hook_argument, operation, schema_name, name, rowid );
+        }
+
+        static void on_rollback( void* self )
+        {
+            knn_module& module = *static_cast< knn_module* >( self );
+            for( std::size_t i = 0; i < module._tables.size(); ++i )
+                module._tables[ i ]->reload = true;
+
+            if( module._options.rollback_hook != 0 )
+                module._options.rollback_hook( module._options.rollback_hook_argument );
+        }
+
+    private:
+        knn_options _options;
+        std::vector< detail::knn_table* > _tables;
+        boost::uint64_t _notifications;
+    };
+
+    inline void create_knn_module( database& db, knn_options const& options = knn_options(), std::string const& name = "knn" )
+    {
+        create_module( db, name, new knn_module( options ) );
+    }
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_KNN_TABLE_HPP*/
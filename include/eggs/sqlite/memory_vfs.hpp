@@ -0,0 +1,685 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/memory_vfs.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_MEMORY_VFS_HPP
+#define EGGS_SQLITE_MEMORY_VFS_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/vfs.hpp>
+
+#include <boost/atomic.hpp>
+
+#include <boost/make_shared.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <boost/thread/mutex.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace eggs { namespace sqlite {
+
+    namespace detail {
+
+        std::size_t const memory_chunk_size = 1 << 16;
+
+        struct memory_chunk
+        {
+            unsigned char data[ memory_chunk_size ];
+        };
+
+        // chunks never written to are null and read as zeros
+        typedef std::vector< boost::shared_ptr< memory_chunk > > memory_chunk_table;
+
+        // the contents of a file; copying one shares every chunk, which is
+        // only copied once written to
+        struct memory_content
+        {
+            memory_content()
+              : chunks( boost::make_shared< memory_chunk_table >() )
+              , size( 0 )
+            {}
+
+            boost::shared_ptr< memory_chunk_table > chunks;
+            sqlite3_int64 size;
+        };
+
+        struct memory_lock
+        {
+            enum enum_type
+            {
+                shared = 1
+              , reserved = 2
+              , pending = 4
+              , exclusive = 8
+            };
+        };
+
+        class memory_storage
+        {
+        public:
+            memory_storage()
+              : _shared( 0 )
+              , _reserved( false )
+              , _pending( false )
+              , _exclusive( false )
+              , _shm_mappers( 0 )
+            {
+                std::fill( _shm_shared, _shm_shared + SQLITE_SHM_NLOCK, 0 );
+                std::fill( _shm_exclusive, _shm_exclusive + SQLITE_SHM_NLOCK, false );
+            }
+
+            memory_content content()
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+
+                return _content;
+            }
+
+            // discards the wal index as well, no connection may be using it
+            void assign( memory_content const& content )
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+
+                _content = content;
+                _shm_regions.clear();
+            }
+
+            sqlite3_int64 size()
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+
+                return _content.size;
+            }
+
+            int read( void* buffer, int amount, sqlite3_int64 offset )
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+
+                unsigned char* output = static_cast< unsigned char* >( buffer );
+                sqlite3_int64 const available = offset < _content.size ? (std::min)( _content.size - offset, sqlite3_int64( amount ) ) : 0;
+
+                memory_chunk_table const& chunks = *_content.chunks;
+                for( sqlite3_int64 done = 0; done < available; )
+                {
+                    std::size_t const index = static_cast< std::size_t >( ( offset + done ) / memory_chunk_size );
+                    std::size_t const chunk_offset = static_cast< std::size_t >( ( offset + done ) % memory_chunk_size );
+                    std::size_t const length = static_cast< std::size_t >( (std::min)( available - done, sqlite3_int64( memory_chunk_size - chunk_offset ) ) );
+
+                    if( index < chunks.size() && chunks[ index ] )
+                        std::memcpy( output + done, chunks[ index ]->data + chunk_offset, length );
+                    else
+                        std::memset( output + done, 0, length );
+                    done += length;
+                }
+
+                if( available < amount )
+                {
+                    std::memset( output + available, 0, static_cast< std::size_t >( amount - available ) );
+                    return SQLITE_IOERR_SHORT_READ;
+                }
+                return SQLITE_OK;
+            }
+
+            int write( void const* buffer, int amount, sqlite3_int64 offset )
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+
+                unsigned char const* input = static_cast< unsigned char const* >( buffer );
+                sqlite3_int64 const end = offset + amount;
+
+                memory_chunk_table& chunks = writable_chunks();
+                if( chunks.size() < static_cast< std::size_t >( ( end + memory_chunk_size - 1 ) / memory_chunk_size ) )
+                    chunks.resize( static_cast< std::size_t >( ( end + memory_chunk_size - 1 ) / memory_chunk_size ) );
+
+                for( sqlite3_int64 done = 0; done < amount; )
+                {
+                    std::size_t const index = static_cast< std::size_t >( ( offset + done ) / memory_chunk_size );
+                    std::size_t const chunk_offset = static_cast< std::size_t >( ( offset + done ) % memory_chunk_size );
+                    std::size_t const length = static_cast< std::size_t >( (std::min)( amount - done, sqlite3_int64( memory_chunk_size - chunk_offset ) ) );
+
+                    memory_chunk* const chunk = writable_chunk( chunks[ index ] );
+                    if( chunk == 0 )
+                        return SQLITE_IOERR_NOMEM;
+
+                    std::memcpy( chunk->data + chunk_offset, input + done, length );
+                    done += length;
+                }
+
+                _content.size = (std::max)( _content.size, end );
+                return SQLITE_OK;
+            }
+
+            int truncate( sqlite3_int64 size )
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+
+                if( size >= _content.size )
+                    return SQLITE_OK;
+
+                memory_chunk_table& chunks = writable_chunks();
+                chunks.resize( (std::min)( chunks.size(), static_cast< std::size_t >( ( size + memory_chunk_size - 1 ) / memory_chunk_size ) ) );
+
+                // the tail must read as zeros should the file grow again
+                std::size_t const tail = static_cast< std::size_t >( size % memory_chunk_size );
+                if( tail != 0 && static_cast< std::size_t >( size / memory_chunk_size ) < chunks.size() && chunks.back() )
+                {
+                    memory_chunk* const chunk = writable_chunk( chunks.back() );
+                    if( chunk == 0 )
+                        return SQLITE_IOERR_NOMEM;
+
+                    std::memset( chunk->data + tail, 0, memory_chunk_size - tail );
+                }
+
+                _content.size = size;
+                return SQLITE_OK;
+            }
+
+            int lock( int& held, int level )
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+
+                switch( level )
+                {
+                case SQLITE_LOCK_SHARED:
+                    if( held & memory_lock::shared )
+                        break;
+                    if( _pending || _exclusive )
+                        return SQLITE_BUSY;
+
+                    ++_shared;
+                    held |= memory_lock::shared;
+                    break;
+                case SQLITE_LOCK_RESERVED:
+                    if( held & memory_lock::reserved )
+                        break;
+                    if( _reserved )
+                        return SQLITE_BUSY;
+
+                    _reserved = true;
+                    held |= memory_lock::reserved;
+                    break;
+                case SQLITE_LOCK_EXCLUSIVE:
+                    if( held & memory_lock::exclusive )
+                        break;
+                    if( !( held & memory_lock::pending ) )
+                    {
+                        if( _pending )
+                            return SQLITE_BUSY;
+
+                        _pending = true;
+                        held |= memory_lock::pending;
+                    }
+                    // pending keeps new readers out while these ones finish
+                    if( _shared > 1 )
+                        return SQLITE_BUSY;
+
+                    _exclusive = true;
+                    held |= memory_lock::exclusive;
+                    break;
+                }
+                return SQLITE_OK;
+            }
+
+            int unlock( int& held, int level )
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+
+                if( held & memory_lock::exclusive )
+                    _exclusive = false;
+                if( held & memory_lock::pending )
+                    _pending = false;
+                if( held & memory_lock::reserved )
+                    _reserved = false;
+                held &= memory_lock::shared;
+
+                if( level == SQLITE_LOCK_NONE && ( held & memory_lock::shared ) )
+                {
+                    --_shared;
+                    held = 0;
+                }
+                return SQLITE_OK;
+            }
+
+            bool reserved()
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+
+                return _reserved || _pending || _exclusive;
+            }
+
+            int shm_map( int region, int region_size, bool extend, void volatile** address )
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+
+                std::size_t const index = static_cast< std::size_t >( region );
+                if( index >= _shm_regions.size() )
+                {
+                    if( !extend )
+                    {
+                        *address = 0;
+                        return SQLITE_OK;
+                    }
+
+                    while( _shm_regions.size() <= index )
+                    {
+                        boost::shared_array< unsigned char > memory( new ( std::nothrow ) unsigned char[ region_size ] );
+                        if( !memory )
+                            return SQLITE_IOERR_NOMEM;
+
+                        std::memset( memory.get(), 0, region_size );
+                        _shm_regions.push_back( memory );
+                    }
+                }
+
+                *address = _shm_regions[ index ].get();
+                return SQLITE_OK;
+            }
+
+            int shm_lock( unsigned& shared, unsigned& exclusive, int offset, int n, int flags )
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+
+                unsigned const mask = ( ( 1u << n ) - 1 ) << offset;
+                if( flags & SQLITE_SHM_UNLOCK )
+                {
+                    for( int i = offset; i < offset + n; ++i )
+                    {
+                        if( exclusive & ( 1u << i ) )
+                            _shm_exclusive[ i ] = false;
+                        if( shared & ( 1u << i ) )
+                            --_shm_shared[ i ];
+                    }
+                    shared &= ~mask;
+                    exclusive &= ~mask;
+                } else if( flags & SQLITE_SHM_SHARED ) {
+                    if( shared & mask )
+                        return SQLITE_OK;
+                    if( _shm_exclusive[ offset ] )
+                        return SQLITE_BUSY;
+
+                    ++_shm_shared[ offset ];
+                    shared |= mask;
+                } else {
+                    for( int i = offset; i < offset + n; ++i )
+                    {
+                        bool const mine = ( exclusive & ( 1u << i ) ) != 0;
+                        if( ( _shm_exclusive[ i ] && !mine ) || _shm_shared[ i ] - ( ( shared & ( 1u << i ) ) ? 1 : 0 ) > 0 )
+                            return SQLITE_BUSY;
+                    }
+                    for( int i = offset; i < offset + n; ++i )
+                        _shm_exclusive[ i ] = true;
+                    exclusive |= mask;
+                }
+                return SQLITE_OK;
+            }
+
+            void shm_attach()
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+
+                ++_shm_mappers;
+            }
+
+            void shm_detach( bool remove )
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+
+                if( --_shm_mappers == 0 && remove )
+                    _shm_regions.clear();
+            }
+
+        private:
+            memory_chunk_table& writable_chunks()
+            {
+                if( !_content.chunks.unique() )
+                    _content.chunks = boost::make_shared< memory_chunk_table >( *_content.chunks );
+                return *_content.chunks;
+            }
+
+            static memory_chunk* writable_chunk( boost::shared_ptr< memory_chunk >& chunk )
+            {
+                if( !chunk )
+                {
+                    chunk.reset( new ( std::nothrow ) memory_chunk() );
+                } else if( !chunk.unique() ) {
+                    chunk.reset( new ( std::nothrow ) memory_chunk( *chunk ) );
+                }
+                return chunk.get();
+            }
+
+        private:
+            boost::mutex _mutex;
+            memory_content _content;
+
+            int _shared;
+            bool _reserved;
+            bool _pending;
+            bool _exclusive;
+
+            std::vector< boost::shared_array< unsigned char > > _shm_regions;
+            int _shm_mappers;
+            int _shm_shared[ SQLITE_SHM_NLOCK ];
+            bool _shm_exclusive[ SQLITE_SHM_NLOCK ];
+        };
+
+        struct memory_file : vfs_file
+        {
+            memory_file()
+              : held( 0 )
+              , shm_shared( 0 )
+              , shm_exclusive( 0 )
+              , shm_mapped( false )
+            {}
+
+            boost::shared_ptr< memory_storage > storage;
+            int held;
+            unsigned shm_shared;
+            unsigned shm_exclusive;
+            bool shm_mapped;
+        };
+
+    } // namespace detail
+
+    // the contents of a database and its WAL at some point in time
+    class memory_snapshot
+    {
+    public:
+        memory_snapshot()
+          : _has_wal( false )
+        {}
+
+        sqlite3_int64 size() const
+        {
+            return _main.size + ( _has_wal ? _wal.size : 0 );
+        }
+
+    private:
+        friend class memory_vfs;
+
+        detail::memory_content _main;
+        detail::memory_content _wal;
+        bool _has_wal;
+    };
+
+    // a vfs keeping its files in memory, shared by every connection in the
+    // process opening the same name and kept until deleted; WAL mode is
+    // supported, and snapshots are copy-on-write
+    class memory_vfs
+      : public basic_vfs< memory_vfs, detail::memory_file >
+    {
+        friend class basic_vfs< memory_vfs, detail::memory_file >;
+
+    public:
+        explicit memory_vfs( std::string const& name = "eggs-memory", bool make_default = false, char const* parent = 0 )
+          : basic_vfs< memory_vfs, detail::memory_file >( name, make_default, parent )
+        {}
+
+        // no write transaction may be in progress on the database
+        memory_snapshot snapshot( std::string const& filename )
+        {
+            boost::shared_ptr< detail::memory_storage > const main = find( filename );
+            if( !main )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( result_code::cant_open ) );
+            }
+            boost::shared_ptr< detail::memory_storage > const wal = find( filename + "-wal" );
+
+            memory_snapshot snapshot;
+            snapshot._main = main->content();
+            if( wal )
+            {
+                snapshot._wal = wal->content();
+                snapshot._has_wal = true;
+            }
+            return snapshot;
+        }
+
+        // no connection may have the database open
+        void restore( std::string const& filename, memory_snapshot const& snapshot )
+        {
+            storage( filename )->assign( snapshot._main );
+            if( snapshot._has_wal )
+            {
+                storage( filename + "-wal" )->assign( snapshot._wal );
+            } else {
+                remove( ( filename + "-wal" ).c_str(), 0 );
+            }
+        }
+
+        // writes the database out as a regular database file, a database in
+        // WAL mode has to be checkpointed first
+        void dump( std::string const& filename, std::string const& path )
+        {
+            boost::shared_ptr< detail::memory_storage > const main = find( filename );
+            if( !main )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( result_code::cant_open ) );
+            }
+
+            detail::memory_content const content = main->content();
+            std::ofstream output( path.c_str(), std::ios::binary | std::ios::trunc );
+
+            static detail::memory_chunk const zeros = {};
+            for( std::size_t i = 0; i < content.chunks->size() && output; ++i )
+            {
+                sqlite3_int64 const length = (std::min)( content.size - sqlite3_int64( i * detail::memory_chunk_size ), sqlite3_int64( detail::memory_chunk_size ) );
+                detail::memory_chunk const& chunk = ( *content.chunks )[ i ] ? *( *content.chunks )[ i ] : zeros;
+                output.write( reinterpret_cast< char const* >( chunk.data ), static_cast< std::streamsize >( length ) );
+            }
+            if( !output.flush() )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( result_code::io_error ) );
+            }
+        }
+
+        // no connection may have the database open
+        void load( std::string const& filename, std::string const& path )
+        {
+            std::ifstream input( path.c_str(), std::ios::binary );
+            if( !input )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( result_code::cant_open ) );
+            }
+
+            detail::memory_storage loaded;
+            std::vector< char > buffer( detail::memory_chunk_size );
+            for( sqlite3_int64 offset = 0; input; )
+            {
+                input.read( &buffer[ 0 ], static_cast< std::streamsize >( buffer.size() ) );
+                int const length = static_cast< int >( input.gcount() );
+                if( length == 0 )
+                    break;
+
+                if( loaded.write( &buffer[ 0 ], length, offset ) != SQLITE_OK )
+                {
+                    BOOST_THROW_EXCEPTION( sqlite_error( result_code::no_mem ) );
+                }
+                offset += length;
+            }
+            if( input.bad() )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( result_code::io_error ) );
+            }
+
+            storage( filename )->assign( loaded.content() );
+            remove( ( filename + "-wal" ).c_str(), 0 );
+        }
+
+    private:
+        boost::shared_ptr< detail::memory_storage > find( std::string const& filename )
+        {
+            boost::mutex::scoped_lock lock( _files_mutex );
+
+            files_type::const_iterator const iter = _files.find( filename );
+            return iter != _files.end() ? iter->second : boost::shared_ptr< detail::memory_storage >();
+        }
+
+        boost::shared_ptr< detail::memory_storage > storage( std::string const& filename )
+        {
+            boost::mutex::scoped_lock lock( _files_mutex );
+
+            boost::shared_ptr< detail::memory_storage >& storage = _files[ filename ];
+            if( !storage )
+                storage = boost::make_shared< detail::memory_storage >();
+            return storage;
+        }
+
+    private:
+        int open( file_type& file, char const* path, int flags, int* out_flags )
+        {
+            if( path == 0 || ( flags & SQLITE_OPEN_DELETEONCLOSE ) != 0 )
+            {
+                file.storage = boost::make_shared< detail::memory_storage >();
+            } else if( ( flags & SQLITE_OPEN_CREATE ) != 0 ) {
+                file.storage = storage( path );
+            } else {
+                file.storage = find( path );
+                if( !file.storage )
+                    return SQLITE_CANTOPEN;
+            }
+
+            if( out_flags != 0 )
+                *out_flags = flags;
+            return SQLITE_OK;
+        }
+        int close( file_type& file )
+        {
+            if( file.held != 0 )
+                file.storage->unlock( file.held, SQLITE_LOCK_NONE );
+            if( file.shm_mapped )
+                shm_unmap( file, 0 );
+            return SQLITE_OK;
+        }
+
+        int methods_version( file_type const& /*file*/ ) const
+        {
+            return 2;
+        }
+
+        int read( file_type& file, void* buffer, int amount, sqlite3_int64 offset )
+        {
+            return file.storage->read( buffer, amount, offset );
+        }
+        int write( file_type& file, void const* buffer, int amount, sqlite3_int64 offset )
+        {
+            return file.storage->write( buffer, amount, offset );
+        }
+        int truncate( file_type& file, sqlite3_int64 size )
+        {
+            return file.storage->truncate( size );
+        }
+        int sync( file_type& /*file*/, int /*flags*/ )
+        {
+            return SQLITE_OK;
+        }
+        int file_size( file_type& file, sqlite3_int64* size )
+        {
+            *size = file.storage->size();
+            return SQLITE_OK;
+        }
+        int lock( file_type& file, int level )
+        {
+            return file.storage->lock( file.held, level );
+        }
+        int unlock( file_type& file, int level )
+        {
+            return file.storage->unlock( file.held, level );
+        }
+        int check_reserved_lock( file_type& file, int* reserved )
+        {
+            *reserved = file.storage->reserved() ? 1 : 0;
+            return SQLITE_OK;
+        }
+        int file_control( file_type& /*file*/, int /*op*/, void* /*argument*/ )
+        {
+            return SQLITE_NOTFOUND;
+        }
+        int sector_size( file_type& /*file*/ )
+        {
+            return 512;
+        }
+        int device_characteristics( file_type& /*file*/ )
+        {
+            return SQLITE_IOCAP_ATOMIC | SQLITE_IOCAP_SAFE_APPEND | SQLITE_IOCAP_SEQUENTIAL | SQLITE_IOCAP_POWERSAFE_OVERWRITE;
+        }
+        int shm_map( file_type& file, int region, int region_size, int extend, void volatile** address )
+        {
+            if( !file.shm_mapped )
+            {
+                file.storage->shm_attach();
+                file.shm_mapped = true;
+            }
+            return file.storage->shm_map( region, region_size, extend != 0, address );
+        }
+        int shm_lock( file_type& file, int offset, int n, int flags )
+        {
+            return file.storage->shm_lock( file.shm_shared, file.shm_exclusive, offset, n, flags );
+        }
+        void shm_barrier( file_type& /*file*/ )
+        {
+            boost::atomic_thread_fence( boost::memory_order_seq_cst );
+        }
+        int shm_unmap( file_type& file, int remove )
+        {
+            if( file.shm_shared | file.shm_exclusive )
+                file.storage->shm_lock( file.shm_shared, file.shm_exclusive, 0, SQLITE_SHM_NLOCK, SQLITE_SHM_UNLOCK );
+            if( file.shm_mapped )
+            {
+                file.storage->shm_detach( remove != 0 );
+                file.shm_mapped = false;
+            }
+            return SQLITE_OK;
+        }
+
+        int remove( char const* path, int /*sync_directory*/ )
+        {
+            boost::mutex::scoped_lock lock( _files_mutex );
+
+            _files.erase( path );
+            return SQLITE_OK;
+        }
+        int access( char const* path, int /*flags*/, int* result )
+        {
+            boost::mutex::scoped_lock lock( _files_mutex );
+
+            *result = _files.find( path ) != _files.end() ? 1 : 0;
+            return SQLITE_OK;
+        }
+        int full_pathname( char const* path, int size, char* output )
+        {
+            std::size_t const length = (std::min)( std::strlen( path ), static_cast< std::size_t >( size - 1 ) );
+            std::memcpy( output, path, length );
+            output[ length ] = '\0';
+            return SQLITE_OK;
+        }
+
+    private:
+        typedef std::map< std::string, boost::shared_ptr< detail::memory_storage > > files_type;
+
+        boost::mutex _files_mutex;
+        files_type _files;
+    };
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_MEMORY_VFS_HPP*/
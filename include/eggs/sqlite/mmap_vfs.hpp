@@ -0,0 +1,224 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/mmap_vfs.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_MMAP_VFS_HPP
+#define EGGS_SQLITE_MMAP_VFS_HPP
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+
+#include <eggs/sqlite/detail/file_registry.hpp>
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/vfs.hpp>
+
+#include <boost/thread/mutex.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+#include <set>
+#include <string>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace eggs { namespace sqlite {
+
+    namespace detail {
+
+        struct mmap_file : vfs_file
+        {
+            mmap_file()
+              : descriptor( -1 )
+              , data( 0 )
+              , size( 0 )
+            {}
+
+            int descriptor;
+            unsigned char const* data; // null when passed through
+            sqlite3_int64 size;
+            std::string path; // set while mapped
+        };
+
+    } // namespace detail
+
+    // a vfs for databases that never change while open, opened read-only the
+    // main database is mapped whole and served from memory with no locking;
+    // snapshots must not be in WAL mode nor have journals lying around.
+    // Databases opened read-write are passed through to the parent vfs
+    class mmap_vfs
+      : public basic_vfs< mmap_vfs, detail::mmap_file >
+    {
+        friend class basic_vfs< mmap_vfs, detail::mmap_file >;
+
+    public:
+        explicit mmap_vfs( std::string const& name = "eggs-mmap", bool make_default = false, char const* parent = 0 )
+          : basic_vfs< mmap_vfs, detail::mmap_file >( name, make_default, parent )
+        {}
+
+        // asks the kernel to page in a range of a mapped database ahead of
+        // time; returns false if the database is not mapped by this vfs
+        bool will_need( database const& db, sqlite3_int64 offset = 0, sqlite3_int64 length = -1 ) const
+        {
+            sqlite3_file* handle = 0;
+            sqlite3_file_control( db.native_handle(), "main", SQLITE_FCNTL_FILE_POINTER, &handle );
+
+            file_type const* const file = find_file( handle );
+            if( file == 0 || file->data == 0 || offset >= file->size )
+                return false;
+
+            std::size_t const page_size = static_cast< std::size_t >( sysconf( _SC_PAGESIZE ) );
+            std::size_t const begin = static_cast< std::size_t >( offset ) & ~( page_size - 1 );
+            std::size_t const end = static_cast< std::size_t >(
+                length < 0 || offset + length > file->size ? file->size : offset + length );
+
+            return madvise( const_cast< unsigned char* >( file->data ) + begin, end - begin, MADV_WILLNEED ) == 0;
+        }
+
+    private:
+        int open( file_type& file, char const* path, int flags, int* out_flags )
+        {
+            int const result = basic_vfs< mmap_vfs, detail::mmap_file >::open( file, path, flags, out_flags );
+            if( result != SQLITE_OK || path == 0 || ( flags & SQLITE_OPEN_MAIN_DB ) == 0 || ( flags & SQLITE_OPEN_READONLY ) == 0 )
+                return result;
+
+            file.descriptor = detail::file_registry::instance().acquire( path, false, true );
+            if( file.descriptor < 0 )
+                return SQLITE_OK;
+
+            struct stat status;
+            if( ::fstat( file.descriptor, &status ) != 0 || status.st_size == 0 )
+                return SQLITE_OK;
+
+            void* const data = mmap( 0, static_cast< std::size_t >( status.st_size ), PROT_READ, MAP_SHARED, file.descriptor, 0 );
+            if( data != MAP_FAILED )
+            {
+                file.data = static_cast< unsigned char const* >( data );
+                file.size = status.st_size;
+                file.path = path;
+
+                boost::mutex::scoped_lock lock( _mutex );
+                _mapped.insert( file.path );
+            }
+            return SQLITE_OK;
+        }
+        int close( file_type& file )
+        {
+            if( file.data != 0 )
+            {
+                munmap( const_cast< unsigned char* >( file.data ), static_cast< std::size_t >( file.size ) );
+
+                boost::mutex::scoped_lock lock( _mutex );
+                _mapped.erase( _mapped.find( file.path ) );
+            }
+            if( file.descriptor >= 0 )
+                detail::file_registry::instance().release( file.descriptor );
+
+            return basic_vfs< mmap_vfs, detail::mmap_file >::close( file );
+        }
+
+        int methods_version( file_type const& file ) const
+        {
+            return file.data != 0 ? 1 : basic_vfs< mmap_vfs, detail::mmap_file >::methods_version( file );
+        }
+
+        int read( file_type& file, void* buffer, int amount, sqlite3_int64 offset )
+        {
+            if( file.data == 0 )
+                return file.real->pMethods->xRead( file.real, buffer, amount, offset );
+
+            sqlite3_int64 const available = offset < file.size ? file.size - offset : 0;
+            if( available >= amount )
+            {
+                std::memcpy( buffer, file.data + offset, amount );
+                return SQLITE_OK;
+            }
+
+            // SQLite expects the missing part of short reads to be zeroed
+            std::memcpy( buffer, file.data + offset, static_cast< std::size_t >( available ) );
+            std::memset( static_cast< unsigned char* >( buffer ) + available, 0, static_cast< std::size_t >( amount - available ) );
+            return SQLITE_IOERR_SHORT_READ;
+        }
+        int write( file_type& file, void const* buffer, int amount, sqlite3_int64 offset )
+        {
+            if( file.data != 0 )
+                return SQLITE_READONLY;
+
+            return file.real->pMethods->xWrite( file.real, buffer, amount, offset );
+        }
+        int file_size( file_type& file, sqlite3_int64* size )
+        {
+            if( file.data == 0 )
+                return file.real->pMethods->xFileSize( file.real, size );
+
+            *size = file.size;
+            return SQLITE_OK;
+        }
+        int lock( file_type& file, int level )
+        {
+            return file.data != 0 ? SQLITE_OK : file.real->pMethods->xLock( file.real, level );
+        }
+        int unlock( file_type& file, int level )
+        {
+            return file.data != 0 ? SQLITE_OK : file.real->pMethods->xUnlock( file.real, level );
+        }
+        int check_reserved_lock( file_type& file, int* reserved )
+        {
+            if( file.data == 0 )
+                return file.real->pMethods->xCheckReservedLock( file.real, reserved );
+
+            *reserved = 0;
+            return SQLITE_OK;
+        }
+        int device_characteristics( file_type& file )
+        {
+            int const characteristics = file.real->pMethods->xDeviceCharacteristics( file.real );
+#       if defined( SQLITE_IOCAP_IMMUTABLE )
+            if( file.data != 0 )
+                return characteristics | SQLITE_IOCAP_IMMUTABLE;
+#       endif
+            return characteristics;
+        }
+
+        // a mapped snapshot never has a hot journal to roll back nor a log to
+        // recover, databases passed through are left to the parent vfs
+        int access( char const* path, int flags, int* result )
+        {
+            std::size_t const length = std::strlen( path );
+            std::size_t suffix = 0;
+            if( length > 8 && std::strcmp( path + length - 8, "-journal" ) == 0 )
+                suffix = 8;
+            else if( length > 4 && std::strcmp( path + length - 4, "-wal" ) == 0 )
+                suffix = 4;
+
+            if( flags == SQLITE_ACCESS_EXISTS && suffix != 0 )
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+                if( _mapped.count( std::string( path, length - suffix ) ) != 0 )
+                {
+                    *result = 0;
+                    return SQLITE_OK;
+                }
+            }
+            return basic_vfs< mmap_vfs, detail::mmap_file >::access( path, flags, result );
+        }
+
+    private:
+        boost::mutex _mutex;
+        std::multiset< std::string > _mapped;
+    };
+
+} } // namespace eggs::sqlite
+
+#endif
+
+#endif /*EGGS_SQLITE_MMAP_VFS_HPP*/
@@ -0,0 +1,685 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/page_cache.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_PAGE_CACHE_HPP
+#define EGGS_SQLITE_PAGE_CACHE_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/error.hpp>
+
+#include <boost/assert.hpp>
+
+#include <boost/atomic.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <boost/functional/hash.hpp>
+
+#include <boost/scoped_array.hpp>
+
+#include <boost/thread/mutex.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+namespace eggs { namespace sqlite {
+
+    struct page_cache_statistics
+    {
+        boost::uint64_t hits;
+        boost::uint64_t misses;
+        boost::uint64_t evictions;
+        std::size_t pages;
+    };
+
+    namespace detail {
+
+        struct page_cache_page;
+        struct page_cache_instance;
+
+        struct page_cache_link
+        {
+            page_cache_page* previous;
+            page_cache_page* next;
+        };
+
+        struct page_cache_list
+        {
+            page_cache_page* head;
+            page_cache_page* tail;
+        };
+
+        // the sqlite3_pcache_page must come first, SQLite hands it back to us
+        struct page_cache_page
+        {
+            sqlite3_pcache_page base;
+            page_cache_instance* cache;
+            unsigned key;
+            bool pinned;
+            std::size_t allocation_size;
+            std::size_t hash;
+            page_cache_page* hash_next;
+
+            page_cache_link shard_lru; // unpinned pages in the shard, any cache
+            page_cache_link cache_lru; // unpinned pages in the shard, this cache
+            page_cache_link cache_pages; // all pages in the shard, this cache
+        };
+
+        typedef page_cache_link page_cache_page::*page_cache_link_ptr;
+
+        inline void page_cache_push_front( page_cache_list& list, page_cache_page* page, page_cache_link_ptr link )
+        {
+            ( page->*link ).previous = 0;
+            ( page->*link ).next = list.head;
+            if( list.head != 0 )
+                ( list.head->*link ).previous = page;
+            else
+                list.tail = page;
+            list.head = page;
+        }
+
+        inline void page_cache_remove( page_cache_list& list, page_cache_page* page, page_cache_link_ptr link )
+        {
+            if( ( page->*link ).previous != 0 )
+                ( ( page->*link ).previous->*link ).next = ( page->*link ).next;
+            else
+                list.head = ( page->*link ).next;
+            if( ( page->*link ).next != 0 )
+                ( ( page->*link ).next->*link ).previous = ( page->*link ).previous;
+            else
+                list.tail = ( page->*link ).previous;
+        }
+
+        struct page_cache_slot
+        {
+            page_cache_list lru;
+            page_cache_list pages;
+        };
+
+        struct page_cache_instance
+        {
+            std::size_t page_size;
+            std::size_t extra_size;
+            bool purgeable;
+            boost::atomic< std::size_t > max_pages;
+            boost::atomic< std::size_t > page_count;
+            boost::scoped_array< page_cache_slot > slots;
+        };
+
+        struct page_cache_shard
+        {
+            page_cache_shard()
+              : count( 0 )
+              , hits( 0 )
+              , misses( 0 )
+              , evictions( 0 )
+            {
+                buckets.assign( 64, static_cast< page_cache_page* >( 0 ) );
+                lru.head = lru.tail = 0;
+            }
+
+            boost::mutex mutex;
+            std::vector< page_cache_page* > buckets;
+            std::size_t count;
+            page_cache_list lru;
+
+            boost::uint64_t hits;
+            boost::uint64_t misses;
+            boost::uint64_t evictions;
+        };
+
+        // pages from every connection are spread over lock-striped shards by
+        // hashing their cache and key, each shard keeping its own LRU; when a
+        // shared budget is set, unpinned pages from any cache can be evicted
+        class page_cache_group
+        {
+        public:
+            static page_cache_group& instance()
+            {
+                static page_cache_group instance;
+
+                return instance;
+            }
+
+            void configure( std::size_t shard_count, std::size_t shared_budget )
+            {
+                BOOST_ASSERT(( shard_count > 0 ));
+
+                _shards.reset( new page_cache_shard[ shard_count ] );
+                _shard_count = shard_count;
+                _shared_budget = shared_budget;
+                _purgeable_pages.store( 0, boost::memory_order_relaxed );
+            }
+
+            page_cache_statistics statistics()
+            {
+                page_cache_statistics result = {};
+                for( std::size_t i = 0; i < _shard_count; ++i )
+                {
+                    page_cache_shard& shard = _shards[ i ];
+                    boost::mutex::scoped_lock lock( shard.mutex );
+
+                    result.hits += shard.hits;
+                    result.misses += shard.misses;
+                    result.evictions += shard.evictions;
+                    result.pages += shard.count;
+                }
+                return result;
+            }
+
+            page_cache_instance* create( std::size_t page_size, std::size_t extra_size, bool purgeable )
+            {
+                page_cache_instance* cache = new ( std::nothrow ) page_cache_instance;
+                if( cache == 0 )
+                    return 0;
+
+                cache->slots.reset( new ( std::nothrow ) page_cache_slot[ _shard_count ] );
+                if( !cache->slots )
+                {
+                    delete cache;
+                    return 0;
+                }
+                for( std::size_t i = 0; i < _shard_count; ++i )
+                {
+                    cache->slots[ i ].lru.head = cache->slots[ i ].lru.tail = 0;
+                    cache->slots[ i ].pages.head = cache->slots[ i ].pages.tail = 0;
+                }
+
+                cache->page_size = page_size;
+                cache->extra_size = extra_size;
+                cache->purgeable = purgeable;
+                cache->max_pages.store( 100, boost::memory_order_relaxed );
+                cache->page_count.store( 0, boost::memory_order_relaxed );
+                return cache;
+            }
+
+            void destroy( page_cache_instance* cache )
+            {
+                for( std::size_t i = 0; i < _shard_count; ++i )
+                {
+                    page_cache_shard& shard = _shards[ i ];
+                    boost::mutex::scoped_lock lock( shard.mutex );
+
+                    while( cache->slots[ i ].pages.head != 0 )
+                    {
+                        free_page( remove( shard, cache->slots[ i ].pages.head ) );
+                    }
+                }
+                delete cache;
+            }
+
+            page_cache_page* fetch( page_cache_instance* cache, unsigned key, int create_flag )
+            {
+                std::size_t const hash = page_hash( cache, key );
+                std::size_t const shard_index = hash % _shard_count;
+                page_cache_shard& shard = _shards[ shard_index ];
+                boost::mutex::scoped_lock lock( shard.mutex );
+
+                page_cache_page* page = shard.buckets[ bucket( shard, hash ) ];
+                while( page != 0 && !( page->cache == cache && page->key == key ) )
+                {
+                    page = page->hash_next;
+                }
+
+                if( page != 0 )
+                {
+                    if( !page->pinned )
+                        pin( shard, page );
+
+                    ++shard.hits;
+                    return page;
+                }
+
+                ++shard.misses;
+                if( create_flag == 0 )
+                    return 0;
+
+                std::size_t const allocation_size = page_allocation_size( cache );
+
+                page_cache_page* victim = 0;
+                if( cache->purgeable )
+                {
+                    bool const cache_full =
+                        cache->page_count.load( boost::memory_order_relaxed ) >= cache->max_pages.load( boost::memory_order_relaxed );
+                    bool const budget_full =
+                        _shared_budget != 0 && _purgeable_pages.load( boost::memory_order_relaxed ) >= _shared_budget;
+
+                    if( cache_full || budget_full )
+                    {
+                        victim = evict( shard_index, cache_full ? cache : 0 );
+                        if( victim == 0 && create_flag == 1 )
+                            return 0;
+                    }
+                }
+
+                if( victim != 0 && victim->allocation_size == allocation_size )
+                {
+                    page = victim;
+                } else {
+                    free_page( victim );
+
+                    page = static_cast< page_cache_page* >( sqlite3_malloc( static_cast< int >( allocation_size ) ) );
+                    if( page == 0 )
+                        return 0;
+                    page->allocation_size = allocation_size;
+                }
+
+                page->base.pBuf = page_buffer( page );
+                page->base.pExtra = static_cast< unsigned char* >( page->base.pBuf ) + cache->page_size;
+                std::memset( page->base.pExtra, 0, cache->extra_size );
+                page->cache = cache;
+                page->key = key;
+                page->pinned = true;
+                page->hash = hash;
+
+                insert( shard, shard_index, page );
+                return page;
+            }
+
+            void unpin( page_cache_instance* cache, page_cache_page* page, bool discard )
+            {
+                page_cache_shard& shard = _shards[ page->hash % _shard_count ];
+                boost::mutex::scoped_lock lock( shard.mutex );
+
+                if( discard || ( cache->purgeable && cache->page_count.load( boost::memory_order_relaxed ) > cache->max_pages.load( boost::memory_order_relaxed ) ) )
+                {
+                    free_page( remove( shard, page ) );
+                    return;
+                }
+
+                page->pinned = false;
+                if( cache->purgeable )
+                {
+                    std::size_t const shard_index = page->hash % _shard_count;
+                    page_cache_push_front( shard.lru, page, &page_cache_page::shard_lru );
+                    page_cache_push_front( cache->slots[ shard_index ].lru, page, &page_cache_page::cache_lru );
+                }
+            }
+
+            void rekey( page_cache_instance* cache, page_cache_page* page, unsigned new_key )
+            {
+                std::size_t const old_index = page->hash % _shard_count;
+                std::size_t const new_hash = page_hash( cache, new_key );
+                std::size_t const new_index = new_hash % _shard_count;
+
+                page_cache_shard& old_shard = _shards[ old_index ];
+                page_cache_shard& new_shard = _shards[ new_index ];
+
+                // always lock shards in index order
+                boost::mutex::scoped_lock first_lock( _shards[ std::min( old_index, new_index ) ].mutex );
+                boost::mutex::scoped_lock second_lock( _shards[ std::max( old_index, new_index ) ].mutex, boost::defer_lock );
+                if( old_index != new_index )
+                    second_lock.lock();
+
+                page_cache_page* existing = new_shard.buckets[ bucket( new_shard, new_hash ) ];
+                while( existing != 0 && !( existing->cache == cache && existing->key == new_key ) )
+                {
+                    existing = existing->hash_next;
+                }
+                if( existing != 0 )
+                {
+                    BOOST_ASSERT(( !existing->pinned ));
+                    free_page( remove( new_shard, existing ) );
+                }
+
+                bool const pinned = page->pinned;
+                remove( old_shard, page );
+                page->cache = cache;
+                page->key = new_key;
+                page->hash = new_hash;
+                page->pinned = true;
+                insert( new_shard, new_index, page );
+                if( !pinned )
+                    unpin_locked( new_shard, new_index, page );
+            }
+
+            void truncate( page_cache_instance* cache, unsigned limit )
+            {
+                for( std::size_t i = 0; i < _shard_count; ++i )
+                {
+                    page_cache_shard& shard = _shards[ i ];
+                    boost::mutex::scoped_lock lock( shard.mutex );
+
+                    page_cache_page* page = cache->slots[ i ].pages.head;
+                    while( page != 0 )
+                    {
+                        page_cache_page* next = page->cache_pages.next;
+                        if( page->key >= limit )
+                            free_page( remove( shard, page ) );
+                        page = next;
+                    }
+                }
+            }
+
+            void shrink( page_cache_instance* cache, std::size_t max_pages )
+            {
+                for( std::size_t i = 0; i < _shard_count; ++i )
+                {
+                    page_cache_shard& shard = _shards[ i ];
+                    boost::mutex::scoped_lock lock( shard.mutex );
+
+                    while( cache->page_count.load( boost::memory_order_relaxed ) > max_pages
+                        && cache->slots[ i ].lru.tail != 0 )
+                    {
+                        ++shard.evictions;
+                        free_page( remove( shard, cache->slots[ i ].lru.tail ) );
+                    }
+                }
+            }
+
+        private:
+            page_cache_group()
+              : _shard_count( 0 )
+              , _shared_budget( 0 )
+            {
+                configure( 16, 0 );
+            }
+
+            static std::size_t page_hash( page_cache_instance const* cache, unsigned key )
+            {
+                std::size_t seed = 0;
+                boost::hash_combine( seed, cache );
+                boost::hash_combine( seed, key );
+
+                return seed;
+            }
+
+            std::size_t bucket( page_cache_shard const& shard, std::size_t hash ) const
+            {
+                return ( hash / _shard_count ) & ( shard.buckets.size() - 1 );
+            }
+
+            static void* page_buffer( page_cache_page* page )
+            {
+                return reinterpret_cast< unsigned char* >( page ) + ( ( sizeof( page_cache_page ) + 7 ) & ~std::size_t( 7 ) );
+            }
+
+            static std::size_t page_allocation_size( page_cache_instance const* cache )
+            {
+                return ( ( sizeof( page_cache_page ) + 7 ) & ~std::size_t( 7 ) ) + cache->page_size + cache->extra_size;
+            }
+
+            void pin( page_cache_shard& shard, page_cache_page* page )
+            {
+                page->pinned = true;
+                if( page->cache->purgeable )
+                {
+                    std::size_t const shard_index = page->hash % _shard_count;
+                    page_cache_remove( shard.lru, page, &page_cache_page::shard_lru );
+                    page_cache_remove( page->cache->slots[ shard_index ].lru, page, &page_cache_page::cache_lru );
+                }
+            }
+
+            void unpin_locked( page_cache_shard& shard, std::size_t shard_index, page_cache_page* page )
+            {
+                page->pinned = false;
+                if( page->cache->purgeable )
+                {
+                    page_cache_push_front( shard.lru, page, &page_cache_page::shard_lru );
+                    page_cache_push_front( page->cache->slots[ shard_index ].lru, page, &page_cache_page::cache_lru );
+                }
+            }
+
+            void insert( page_cache_shard& shard, std::size_t shard_index, page_cache_page* page )
+            {
+                if( shard.count >= shard.buckets.size() )
+                    rehash( shard );
+
+                page_cache_page*& head = shard.buckets[ bucket( shard, page->hash ) ];
+                page->hash_next = head;
+                head = page;
+                ++shard.count;
+
+                page_cache_push_front( page->cache->slots[ shard_index ].pages, page, &page_cache_page::cache_pages );
+
+                page->cache->page_count.fetch_add( 1, boost::memory_order_relaxed );
+                if( page->cache->purgeable )
+                    _purgeable_pages.fetch_add( 1, boost::memory_order_relaxed );
+            }
+
+            // unlinks the page from every structure; the memory is kept and the
+            // page marked as orphaned so that it can be recycled by the caller
+            page_cache_page* remove( page_cache_shard& shard, page_cache_page* page )
+            {
+                std::size_t const shard_index = page->hash % _shard_count;
+                page_cache_instance* cache = page->cache;
+
+                page_cache_page** link = &shard.buckets[ bucket( shard, page->hash ) ];
+                while( *link != page )
+                {
+                    link = &( *link )->hash_next;
+                }
+                *link = page->hash_next;
+                --shard.count;
+
+                if( !page->pinned && cache->purgeable )
+                {
+                    page_cache_remove( shard.lru, page, &page_cache_page::shard_lru );
+                    page_cache_remove( cache->slots[ shard_index ].lru, page, &page_cache_page::cache_lru );
+                }
+                page_cache_remove( cache->slots[ shard_index ].pages, page, &page_cache_page::cache_pages );
+
+                cache->page_count.fetch_sub( 1, boost::memory_order_relaxed );
+                if( cache->purgeable )
+                    _purgeable_pages.fetch_sub( 1, boost::memory_order_relaxed );
+
+                page->cache = 0;
+                return page;
+            }
+
+            void rehash( page_cache_shard& shard )
+            {
+                std::vector< page_cache_page* > buckets( shard.buckets.size() * 2, static_cast< page_cache_page* >( 0 ) );
+                for( std::size_t i = 0; i < shard.buckets.size(); ++i )
+                {
+                    page_cache_page* page = shard.buckets[ i ];
+                    while( page != 0 )
+                    {
+                        page_cache_page* next = page->hash_next;
+                        page_cache_page*& head = buckets[ ( page->hash / _shard_count ) & ( buckets.size() - 1 ) ];
+                        page->hash_next = head;
+                        head = page;
+                        page = next;
+                    }
+                }
+                shard.buckets.swap( buckets );
+            }
+
+            // evicts the least recently used unpinned page, either from the given
+            // cache or from any cache when none is given, looking first at the
+            // shard already locked and then at those that can be locked at once
+            page_cache_page* evict( std::size_t shard_index, page_cache_instance* cache )
+            {
+                page_cache_shard& shard = _shards[ shard_index ];
+                page_cache_page* victim = cache != 0 ? cache->slots[ shard_index ].lru.tail : shard.lru.tail;
+                if( victim != 0 )
+                {
+                    ++shard.evictions;
+                    return remove( shard, victim );
+                }
+
+                for( std::size_t i = 1; i < _shard_count; ++i )
+                {
+                    std::size_t const other_index = ( shard_index + i ) % _shard_count;
+                    page_cache_shard& other = _shards[ other_index ];
+
+                    boost::mutex::scoped_lock lock( other.mutex, boost::try_to_lock );
+                    if( !lock.owns_lock() )
+                        continue;
+
+                    victim = cache != 0 ? cache->slots[ other_index ].lru.tail : other.lru.tail;
+                    if( victim != 0 )
+                    {
+                        ++other.evictions;
+                        return remove( other, victim );
+                    }
+                }
+                return 0;
+            }
+
+            static void free_page( page_cache_page* page )
+            {
+                sqlite3_free( page );
+            }
+
+        private:
+            boost::scoped_array< page_cache_shard > _shards;
+            std::size_t _shard_count;
+            std::size_t _shared_budget;
+            boost::atomic< std::size_t > _purgeable_pages;
+        };
+
+        struct page_cache_methods
+        {
+            static int init( void* )
+            {
+                return SQLITE_OK;
+            }
+
+            static void shutdown( void* )
+            {}
+
+            static sqlite3_pcache* create( int page_size, int extra_size, int purgeable )
+            {
+                return
+                    reinterpret_cast< sqlite3_pcache* >(
+                        page_cache_group::instance().create( page_size, extra_size, purgeable != 0 )
+                    );
+            }
+
+            static void cache_size( sqlite3_pcache* cache, int max_pages )
+            {
+                page_cache_instance* instance = reinterpret_cast< page_cache_instance* >( cache );
+                instance->max_pages.store( max_pages > 0 ? max_pages : 0, boost::memory_order_relaxed );
+
+                page_cache_group::instance().shrink( instance, instance->max_pages.load( boost::memory_order_relaxed ) );
+            }
+
+            static int page_count( sqlite3_pcache* cache )
+            {
+                return
+                    static_cast< int >(
+                        reinterpret_cast< page_cache_instance* >( cache )->page_count.load( boost::memory_order_relaxed )
+                    );
+            }
+
+            static sqlite3_pcache_page* fetch( sqlite3_pcache* cache, unsigned key, int create_flag )
+            {
+                page_cache_page* page =
+                    page_cache_group::instance().fetch(
+                        reinterpret_cast< page_cache_instance* >( cache ), key, create_flag
+                    );
+
+                return page != 0 ? &page->base : 0;
+            }
+
+            static void unpin( sqlite3_pcache* cache, sqlite3_pcache_page* page, int discard )
+            {
+                page_cache_group::instance().unpin(
+                    reinterpret_cast< page_cache_instance* >( cache )
+                  , reinterpret_cast< page_cache_page* >( page ), discard != 0
+                );
+            }
+
+            static void rekey( sqlite3_pcache* cache, sqlite3_pcache_page* page, unsigned /*old_key*/, unsigned new_key )
+            {
+                page_cache_group::instance().rekey(
+                    reinterpret_cast< page_cache_instance* >( cache )
+                  , reinterpret_cast< page_cache_page* >( page ), new_key
+                );
+            }
+
+            static void truncate( sqlite3_pcache* cache, unsigned limit )
+            {
+                page_cache_group::instance().truncate(
+                    reinterpret_cast< page_cache_instance* >( cache ), limit
+                );
+            }
+
+            static void destroy( sqlite3_pcache* cache )
+            {
+                page_cache_group::instance().destroy(
+                    reinterpret_cast< page_cache_instance* >( cache )
+                );
+            }
+
+            static void shrink( sqlite3_pcache* cache )
+            {
+                page_cache_group::instance().shrink(
+                    reinterpret_cast< page_cache_instance* >( cache ), 0
+                );
+            }
+
+            static sqlite3_pcache_methods2* get()
+            {
+                static sqlite3_pcache_methods2 methods =
+                {
+                    1, 0
+                  , &init, &shutdown, &create, &cache_size, &page_count
+                  , &fetch, &unpin, &rekey, &truncate, &destroy, &shrink
+                };
+
+                return &methods;
+            }
+        };
+
+        inline void configure_page_cache(
+            std::size_t shard_count
+          , std::size_t shared_budget
+          , boost::system::error_code* error_code = 0
+        )
+        {
+            // the configuration is rejected once SQLite is initialized, at
+            // which point no cache may be touched; check before reconfiguring
+            sqlite3_pcache_methods2 current;
+            int result = sqlite3_config( SQLITE_CONFIG_GETPCACHE2, &current );
+            if( result == result_code::ok )
+            {
+                page_cache_group::instance().configure( shard_count, shared_budget );
+                result = sqlite3_config( SQLITE_CONFIG_PCACHE2, page_cache_methods::get() );
+            }
+
+            if( error_code != 0 )
+            {
+                error_code->assign( result, sqlite_category() );
+            } else if( result != result_code::ok ) {
+                BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+            }
+        }
+
+    } // namespace detail
+
+    // must be called before the first database is opened, or after
+    // sqlite3_shutdown; a shared_budget of zero leaves each connection
+    // bound by its own cache_size alone
+    inline void configure_page_cache( boost::system::error_code& error_code, std::size_t shard_count = 16, std::size_t shared_budget = 0 )
+    {
+        detail::configure_page_cache( shard_count, shared_budget, &error_code );
+    }
+    inline void configure_page_cache( std::size_t shard_count = 16, std::size_t shared_budget = 0 )
+    {
+        detail::configure_page_cache( shard_count, shared_budget );
+    }
+
+    inline page_cache_statistics get_page_cache_statistics()
+    {
+        return detail::page_cache_group::instance().statistics();
+    }
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_PAGE_CACHE_HPP*/
@@ -16,6 +16,8 @@
 #include <eggs/sqlite/database.hpp>
 #include <eggs/sqlite/statement.hpp>
 
+#include <boost/algorithm/string/predicate.hpp>
+
 #include <boost/optional.hpp>
 
 #include <boost/type_traits/is_void.hpp>
@@ -125,7 +127,10 @@ namespace eggs { namespace sqlite {
         {
             istatement pragma_statement( db, query );
 
-            pragma_statement.step();
+            // some procedures, like incremental_vacuum, do one unit of work
+            // per step
+            while( pragma_statement.step() != istatement::status_code::done )
+                ;
         }
         template< typename Type >
         inline void invoke_pragma( database& db, std::string const& query, Type& value )
@@ -162,6 +167,11 @@ namespace eggs { namespace sqlite {
               , incremental = 2
             };
 
+            friend void extract( istatement& left, value_type& right )
+            {
+                right = static_cast< value_type >( left.get< int >( 0 ) );
+            }
+
             static char const* name(){ return "auto_vacuum"; }
         };
 
@@ -232,7 +242,7 @@ namespace eggs { namespace sqlite {
               , utf16be
             };
 
-            friend void extract( istatement& left, value_type right )
+            friend void extract( istatement& left, value_type& right )
             {
                 std::string const& value = left.get< std::string >( 0 );
                 if( value == "UTF-8" )
@@ -380,20 +390,20 @@ namespace eggs { namespace sqlite {
               , off
             };
 
-            friend void extract( istatement& left, value_type right )
+            friend void extract( istatement& left, value_type& right )
             {
                 std::string const& value = left.get< std::string >( 0 );
-                if( value == "DELETE" )
+                if( boost::algorithm::iequals( value, "DELETE" ) )
                     right = delete_;
-                else if( value == "TRUNCATE" )
+                else if( boost::algorithm::iequals( value, "TRUNCATE" ) )
                     right = truncate;
-                else if( value == "PERSIST" )
+                else if( boost::algorithm::iequals( value, "PERSIST" ) )
                     right = persist;
-                else if( value == "MEMORY" )
+                else if( boost::algorithm::iequals( value, "MEMORY" ) )
                     right = memory;
-                else if( value == "WAL" )
+                else if( boost::algorithm::iequals( value, "WAL" ) )
                     right = wal;
-                else if( value == "OFF" )
+                else if( boost::algorithm::iequals( value, "OFF" ) )
                     right = off;
             }
 
@@ -721,8 +731,7 @@ namespace eggs { namespace sqlite {
         boost::is_void<
             typename Pragma::template param< Pragma >::type
         >
-      , typename Pragma::template result< Pragma >::type
-    >
+    >::type
     call_pragma( database& db )
     {
         std::ostringstream query;
@@ -731,12 +740,25 @@ namespace eggs { namespace sqlite {
         detail::invoke_pragma( db, query.str() );
     }
     template< typename Pragma >
+    inline typename boost::enable_if<
+        boost::is_void<
+            typename Pragma::template result< Pragma >::type
+        >
+    >::type
+    call_pragma( database& db, typename Pragma::template param< Pragma >::type const& param )
+    {
+        std::ostringstream query;
+        query << "PRAGMA " << Pragma::name() << "(" << param << ");";
+
+        detail::invoke_pragma( db, query.str() );
+    }
+    template< typename Pragma >
     inline typename boost::disable_if<
         boost::is_void<
-            typename Pragma::template param< Pragma >::type
+            typename Pragma::template result< Pragma >::type
         >
       , typename Pragma::template result< Pragma >::type
-    >
+    >::type
     call_pragma( database& db, typename Pragma::template param< Pragma >::type const& param )
     {
         std::ostringstream query;
@@ -63,6 +63,21 @@ namespace eggs { namespace sqlite {
                   , conversion_traits< Type >::to_raw( value )
                 );
             }
+
+            static Type get( sqlite3_value* value_handle )
+            {
+                return
+                    conversion_traits< Type >::from_raw(
+                        raw_traits< RawType >::get( value_handle )
+                    );
+            }
+            static void result( sqlite3_context* context, Type value )
+            {
+                raw_traits< RawType >::result(
+                    context
+                  , conversion_traits< Type >::to_raw( value )
+                );
+            }
         };
 
         template< typename Type >
@@ -93,6 +108,15 @@ namespace eggs { namespace sqlite {
         {
             sqlite3_bind_null( statement_handle, index );
         }
+
+        static value_type get( sqlite3_value* /*value_handle*/ )
+        {
+            return boost::none;
+        }
+        static void result( sqlite3_context* context, value_type /*value*/ )
+        {
+            sqlite3_result_null( context );
+        }
     };
 
     template<>
@@ -114,6 +138,21 @@ namespace eggs { namespace sqlite {
               , value
             );
         }
+
+        static value_type get( sqlite3_value* value_handle )
+        {
+            return
+                sqlite3_value_int(
+                    value_handle
+                );
+        }
+        static void result( sqlite3_context* context, value_type value )
+        {
+            sqlite3_result_int(
+                context
+              , value
+            );
+        }
     };
 
     template<>
@@ -135,6 +174,21 @@ namespace eggs { namespace sqlite {
               , value
             );
         }
+
+        static value_type get( sqlite3_value* value_handle )
+        {
+            return
+                sqlite3_value_int64(
+                    value_handle
+                );
+        }
+        static void result( sqlite3_context* context, value_type value )
+        {
+            sqlite3_result_int64(
+                context
+              , value
+            );
+        }
     };
     
     template<>
@@ -156,6 +210,21 @@ namespace eggs { namespace sqlite {
               , value
             );
         }
+
+        static value_type get( sqlite3_value* value_handle )
+        {
+            return
+                sqlite3_value_double(
+                    value_handle
+                );
+        }
+        static void result( sqlite3_context* context, value_type value )
+        {
+            sqlite3_result_double(
+                context
+              , value
+            );
+        }
     };
 
     template<>
@@ -181,6 +250,25 @@ namespace eggs { namespace sqlite {
               , value, -1, SQLITE_TRANSIENT
             );
         }
+
+        static value_type get( sqlite3_value* value_handle )
+        {
+            return
+                static_cast< char const* >(
+                    static_cast< void const* >(
+                        sqlite3_value_text(
+                            value_handle
+                        )
+                    )
+                );
+        }
+        static void result( sqlite3_context* context, value_type value )
+        {
+            sqlite3_result_text(
+                context
+              , value, -1, SQLITE_TRANSIENT
+            );
+        }
     };
 
     template<>
@@ -202,6 +290,47 @@ namespace eggs { namespace sqlite {
               , value.bytes(), value.size(), SQLITE_TRANSIENT
             );
         }
+
+        static value_type get( sqlite3_value* value_handle )
+        {
+            void const* bytes = sqlite3_value_blob( value_handle );
+            std::size_t const size = sqlite3_value_bytes( value_handle );
+
+            return value_type( bytes, size );
+        }
+        static void result( sqlite3_context* context, value_type value )
+        {
+            sqlite3_result_blob(
+                context
+              , value.bytes(), value.size(), SQLITE_TRANSIENT
+            );
+        }
+    };
+
+    // a value as SQLite holds it, for functions that take any kind of value;
+    // when read from a statement it is only valid until the next step
+    template<>
+    struct raw_traits< sqlite3_value* >
+    {
+        typedef sqlite3_value* value_type;
+
+        static value_type get( sqlite3_stmt* statement_handle, std::size_t index )
+        {
+            return sqlite3_column_value( statement_handle, index );
+        }
+        static void bind( sqlite3_stmt* statement_handle, std::size_t index, value_type value )
+        {
+            sqlite3_bind_value( statement_handle, index, value );
+        }
+
+        static value_type get( sqlite3_value* value_handle )
+        {
+            return value_handle;
+        }
+        static void result( sqlite3_context* context, value_type value )
+        {
+            sqlite3_result_value( context, value );
+        }
     };
 
     template< typename T >
@@ -234,6 +363,25 @@ namespace eggs { namespace sqlite {
                 sqlite3_bind_null( statement_handle, index );
             }
         }
+
+        static value_type get( sqlite3_value* value_handle )
+        {
+            if( sqlite3_value_type( value_handle ) != SQLITE_NULL )
+            {
+                return base_traits::get( value_handle );
+            } else {
+                return boost::none;
+            }
+        }
+        static void result( sqlite3_context* context, value_type value )
+        {
+            if( value )
+            {
+                base_traits::result( context, *value );
+            } else {
+                sqlite3_result_null( context );
+            }
+        }
     };
 
 } } // namespace eggs::sqlite
@@ -0,0 +1,206 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/readahead_vfs.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_READAHEAD_VFS_HPP
+#define EGGS_SQLITE_READAHEAD_VFS_HPP
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+
+#include <eggs/sqlite/detail/file_registry.hpp>
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/vfs.hpp>
+
+#include <boost/atomic.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <cstddef>
+
+#include <algorithm>
+#include <string>
+
+#include <fcntl.h>
+
+namespace eggs { namespace sqlite {
+
+    struct readahead_statistics
+    {
+        boost::uint64_t reads;
+        boost::uint64_t sequential_reads;
+        boost::uint64_t prefetches;
+        boost::uint64_t prefetched_bytes;
+        boost::uint64_t hits; // reads that fell within a prefetched range
+    };
+
+    namespace detail {
+
+        struct readahead_file : vfs_file
+        {
+            readahead_file()
+              : descriptor( -1 )
+              , enabled( false )
+              , next_offset( -1 )
+              , run( 0 )
+              , prefetched_begin( 0 )
+              , prefetched_end( 0 )
+            {}
+
+            int descriptor;
+            bool enabled;
+            sqlite3_int64 next_offset; // where a sequential read would start
+            unsigned run;
+            sqlite3_int64 prefetched_begin;
+            sqlite3_int64 prefetched_end;
+        };
+
+        inline bool advise_will_need( int descriptor, sqlite3_int64 offset, sqlite3_int64 length )
+        {
+#       if defined( POSIX_FADV_WILLNEED )
+            return posix_fadvise( descriptor, offset, length, POSIX_FADV_WILLNEED ) == 0;
+#       elif defined( F_RDADVISE )
+            radvisory advice;
+            advice.ra_offset = offset;
+            advice.ra_count = static_cast< int >( length );
+            return fcntl( descriptor, F_RDADVISE, &advice ) != -1;
+#       else
+            return false;
+#       endif
+        }
+
+    } // namespace detail
+
+    // a pass-through vfs that detects sequential reads of the main database
+    // and asks the kernel to read the next extents ahead of them; advice is
+    // given through a descriptor of its own, which is kept open for the life
+    // of the process since closing it would drop the POSIX locks held on the
+    // database by every connection in the process
+    class readahead_vfs
+      : public basic_vfs< readahead_vfs, detail::readahead_file >
+    {
+        friend class basic_vfs< readahead_vfs, detail::readahead_file >;
+
+    public:
+        explicit readahead_vfs(
+            std::string const& name = "eggs-readahead"
+          , std::size_t extent_size = 1 << 20, unsigned extents_ahead = 4
+          , unsigned sequential_threshold = 4, bool enabled = true
+          , bool make_default = false, char const* parent = 0
+        )
+          : basic_vfs< readahead_vfs, detail::readahead_file >( name, make_default, parent )
+          , _extent_size( extent_size )
+          , _extents_ahead( extents_ahead )
+          , _sequential_threshold( sequential_threshold )
+          , _enabled( enabled )
+          , _reads( 0 ), _sequential_reads( 0 )
+          , _prefetches( 0 ), _prefetched_bytes( 0 )
+          , _hits( 0 )
+        {}
+
+        // turns prefetching on or off for a database opened through this vfs;
+        // returns false if it was not
+        bool enable( database const& db, bool enabled = true )
+        {
+            sqlite3_file* handle = 0;
+            sqlite3_file_control( db.native_handle(), "main", SQLITE_FCNTL_FILE_POINTER, &handle );
+
+            file_type* const file = find_file( handle );
+            if( file == 0 || file->descriptor < 0 )
+                return false;
+
+            file->enabled = enabled;
+            return true;
+        }
+
+        readahead_statistics statistics() const
+        {
+            readahead_statistics value;
+            value.reads = _reads.load( boost::memory_order_relaxed );
+            value.sequential_reads = _sequential_reads.load( boost::memory_order_relaxed );
+            value.prefetches = _prefetches.load( boost::memory_order_relaxed );
+            value.prefetched_bytes = _prefetched_bytes.load( boost::memory_order_relaxed );
+            value.hits = _hits.load( boost::memory_order_relaxed );
+            return value;
+        }
+
+    private:
+        int open( file_type& file, char const* path, int flags, int* out_flags )
+        {
+            int const result = basic_vfs< readahead_vfs, detail::readahead_file >::open( file, path, flags, out_flags );
+            if( result == SQLITE_OK && path != 0 && ( flags & SQLITE_OPEN_MAIN_DB ) != 0 )
+            {
+                file.descriptor = detail::file_registry::instance().acquire( path, false, true );
+                file.enabled = _enabled && file.descriptor >= 0;
+            }
+            return result;
+        }
+        int close( file_type& file )
+        {
+            int const result = basic_vfs< readahead_vfs, detail::readahead_file >::close( file );
+            if( file.descriptor >= 0 )
+                detail::file_registry::instance().release( file.descriptor );
+            return result;
+        }
+
+        int read( file_type& file, void* buffer, int amount, sqlite3_int64 offset )
+        {
+            if( file.enabled )
+            {
+                _reads.fetch_add( 1, boost::memory_order_relaxed );
+                if( offset >= file.prefetched_begin && offset + amount <= file.prefetched_end )
+                    _hits.fetch_add( 1, boost::memory_order_relaxed );
+
+                if( offset == file.next_offset )
+                {
+                    _sequential_reads.fetch_add( 1, boost::memory_order_relaxed );
+                    ++file.run;
+                } else {
+                    file.run = 0;
+                }
+                file.next_offset = offset + amount;
+
+                // keep at least half the window ahead of the reader
+                sqlite3_int64 const window = static_cast< sqlite3_int64 >( _extent_size ) * _extents_ahead;
+                if( file.run >= _sequential_threshold && file.next_offset + window / 2 > file.prefetched_end )
+                {
+                    sqlite3_int64 const begin = (std::max)( file.prefetched_end, file.next_offset );
+                    sqlite3_int64 const end = file.next_offset + window;
+                    if( detail::advise_will_need( file.descriptor, begin, end - begin ) )
+                    {
+                        _prefetches.fetch_add( 1, boost::memory_order_relaxed );
+                        _prefetched_bytes.fetch_add( end - begin, boost::memory_order_relaxed );
+                    }
+                    if( begin != file.prefetched_end )
+                        file.prefetched_begin = begin;
+                    file.prefetched_end = end;
+                }
+            }
+            return file.real->pMethods->xRead( file.real, buffer, amount, offset );
+        }
+
+    private:
+        std::size_t _extent_size;
+        unsigned _extents_ahead;
+        unsigned _sequential_threshold;
+        bool _enabled;
+
+        boost::atomic< boost::uint64_t > _reads;
+        boost::atomic< boost::uint64_t > _sequential_reads;
+        boost::atomic< boost::uint64_t > _prefetches;
+        boost::atomic< boost::uint64_t > _prefetched_bytes;
+        boost::atomic< boost::uint64_t > _hits;
+    };
+
+} } // namespace eggs::sqlite
+
+#endif
+
+#endif /*EGGS_SQLITE_READAHEAD_VFS_HPP*/
@@ -0,0 +1,175 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/regexp.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_REGEXP_HPP
+#define EGGS_SQLITE_REGEXP_HPP
+
+// this header is not included by <eggs/sqlite.hpp>, it requires the compiled
+// Boost.Regex library
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/function.hpp>
+
+#include <boost/regex.hpp>
+
+#include <boost/shared_ptr.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <cstddef>
+
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+
+namespace eggs { namespace sqlite {
+
+    namespace detail {
+
+        // compiled patterns of a connection, shared by all its statements;
+        // calls for a connection are serialized by SQLite, so it needs no
+        // locking of its own
+        class regex_cache
+        {
+        public:
+            typedef boost::shared_ptr< boost::regex const > regex_pointer;
+
+        public:
+            explicit regex_cache( std::size_t capacity )
+              : _capacity( capacity )
+            {}
+
+            regex_pointer get( std::string const& pattern )
+            {
+                std::map< std::string, entry_list::iterator >::iterator iter =
+                    _index.find( pattern );
+                if( iter != _index.end() )
+                {
+                    _entries.splice( _entries.begin(), _entries, iter->second );
+                    return iter->second->second;
+                }
+
+                regex_pointer regex( new boost::regex( pattern, boost::regex::perl ) );
+                if( _capacity == 0 )
+                    return regex;
+
+                if( _entries.size() >= _capacity )
+                {
+                    _index.erase( _entries.back().first );
+                    _entries.pop_back();
+                }
+                _entries.push_front( std::make_pair( pattern, regex ) );
+                _index[ pattern ] = _entries.begin();
+                return regex;
+            }
+
+        private:
+            regex_cache( regex_cache const& );
+            regex_cache& operator =( regex_cache const& );
+
+        private:
+            typedef std::list< std::pair< std::string, regex_pointer > > entry_list;
+
+            std::size_t _capacity;
+            entry_list _entries;
+            std::map< std::string, entry_list::iterator > _index;
+        };
+
+        inline void regex_destroy( void* regex )
+        {
+            delete static_cast< regex_cache::regex_pointer* >( regex );
+        }
+
+        inline void regex_cache_destroy( void* cache )
+        {
+            delete static_cast< regex_cache* >( cache );
+        }
+
+        // regexp( pattern, text ), as called for text REGEXP pattern; the
+        // compiled pattern is kept as auxiliary data for as long as the
+        // pattern argument of a statement stays the same
+        inline void regexp_callback( sqlite3_context* context, int /*count*/, sqlite3_value** values )
+        {
+            if( sqlite3_value_type( values[ 0 ] ) == SQLITE_NULL
+             || sqlite3_value_type( values[ 1 ] ) == SQLITE_NULL )
+            {
+                sqlite3_result_null( context );
+                return;
+            }
+
+            try
+            {
+                regex_cache::regex_pointer regex;
+
+                regex_cache::regex_pointer* compiled =
+                    static_cast< regex_cache::regex_pointer* >( sqlite3_get_auxdata( context, 0 ) );
+                if( compiled != 0 )
+                {
+                    regex = *compiled;
+                } else {
+                    regex_cache& cache = *static_cast< regex_cache* >( sqlite3_user_data( context ) );
+
+                    char const* pattern = reinterpret_cast< char const* >( sqlite3_value_text( values[ 0 ] ) );
+                    regex = cache.get( std::string( pattern, sqlite3_value_bytes( values[ 0 ] ) ) );
+
+                    // SQLite may destroy the data right away, the local
+                    // copy keeps the pattern alive for this call
+                    sqlite3_set_auxdata( context, 0, new regex_cache::regex_pointer( regex ), &regex_destroy );
+                }
+
+                char const* text = reinterpret_cast< char const* >( sqlite3_value_text( values[ 1 ] ) );
+                std::size_t const size = sqlite3_value_bytes( values[ 1 ] );
+                sqlite3_result_int( context, boost::regex_search( text, text + size, *regex ) ? 1 : 0 );
+            } catch( ... ) {
+                function_error( context );
+            }
+        }
+
+        inline int create_regexp_function( sqlite3* db, std::size_t capacity )
+        {
+            return
+                sqlite3_create_function_v2(
+                    db, "regexp", 2
+                  , SQLITE_UTF8 | function_flags::deterministic
+                  , new regex_cache( capacity )
+                  , &regexp_callback, 0, 0
+                  , &regex_cache_destroy
+                );
+        }
+
+    } // namespace detail
+
+    // makes the REGEXP operator available, with perl syntax and matching
+    // anywhere in the text; compiled patterns are kept for the duration of
+    // a statement, and the last capacity of them are shared by every
+    // statement of the connection
+    inline void create_regexp_function( database& db, std::size_t capacity, boost::system::error_code& error_code )
+    {
+        int const result = detail::create_regexp_function( db.native_handle(), capacity );
+        error_code.assign( result, sqlite_category() );
+    }
+    inline void create_regexp_function( database& db, std::size_t capacity = 64 )
+    {
+        int const result = detail::create_regexp_function( db.native_handle(), capacity );
+        if( result != SQLITE_OK )
+        {
+            BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+        }
+    }
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_REGEXP_HPP*/
@@ -0,0 +1,373 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/sequence_table.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_SEQUENCE_TABLE_HPP
+#define EGGS_SQLITE_SEQUENCE_TABLE_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/raw_traits.hpp>
+#include <eggs/sqlite/virtual_table.hpp>
+
+#include <boost/fusion/include/adapt_struct.hpp>
+#include <boost/fusion/include/at_c.hpp>
+#include <boost/fusion/include/fold.hpp>
+#include <boost/fusion/include/size.hpp>
+#include <boost/fusion/include/tag_of.hpp>
+#include <boost/fusion/include/value_at.hpp>
+
+#include <boost/mpl/for_each.hpp>
+#include <boost/mpl/range_c.hpp>
+
+#include <boost/range/begin.hpp>
+#include <boost/range/iterator.hpp>
+#include <boost/range/size.hpp>
+#include <boost/range/value_type.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <boost/type_traits/remove_cv.hpp>
+#include <boost/type_traits/remove_reference.hpp>
+
+#include <cmath>
+#include <cstddef>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+namespace eggs { namespace sqlite {
+
+    namespace detail {
+
+        struct sequence_constraint
+        {
+            enum enum_type
+            {
+                first = 1 // equality on the first column
+              , rowid = 2 // equality on the rowid
+            };
+        };
+
+        struct sequence_table_cursor
+          : virtual_table_cursor
+        {
+            sequence_table_cursor()
+              : position( 0 )
+              , end( 0 )
+            {}
+
+            std::size_t position;
+            std::size_t end;
+        };
+
+        // members of adapted structs are named after them, members of other
+        // sequences after their position
+        template< typename Sequence, int Index, typename Tag = typename boost::fusion::traits::tag_of< Sequence >::type >
+        struct sequence_column_name
+        {
+            static std::string call()
+            {
+                std::ostringstream name;
+                name << 'c' << Index;
+                return name.str();
+            }
+        };
+        template< typename Sequence, int Index >
+        struct sequence_column_name< Sequence, Index, boost::fusion::struct_tag >
+        {
+            static std::string call()
+            {
+                return boost::fusion::extension::struct_member_name< Sequence, Index >::call();
+            }
+        };
+
+        template< typename Sequence >
+        class sequence_schema_builder
+        {
+        public:
+            explicit sequence_schema_builder( std::string& schema )
+              : _schema( &schema )
+            {}
+
+            template< typename Index >
+            void operator ()( Index ) const
+            {
+                std::string const name = sequence_column_name< Sequence, Index::value >::call();
+
+                *_schema += Index::value == 0 ? "\"" : ", \"";
+                for( std::size_t i = 0; i < name.size(); ++i )
+                {
+                    if( name[ i ] == '"' )
+                        *_schema += '"';
+                    *_schema += name[ i ];
+                }
+                *_schema += '"';
+            }
+
+        private:
+            std::string* _schema;
+        };
+
+        // text is handed to SQLite in place, the range outlives the table
+        template< typename T >
+        inline void sequence_column_result( sqlite3_context* context, T const& value )
+        {
+            raw_traits< T >::result( context, value );
+        }
+        inline void sequence_column_result( sqlite3_context* context, std::string const& value )
+        {
+            sqlite3_result_text( context, value.data(), static_cast< int >( value.size() ), SQLITE_STATIC );
+        }
+
+        class sequence_column_fold
+        {
+        public:
+            typedef int result_type;
+
+        public:
+            sequence_column_fold( sqlite3_context* context, int column )
+              : _context( context )
+              , _column( column )
+            {}
+
+            template< typename T >
+            int operator ()( int index, T const& value ) const
+            {
+                if( index == _column )
+                    sequence_column_result( _context, value );
+
+                return index + 1;
+            }
+
+        private:
+            sqlite3_context* _context;
+            int _column;
+        };
+
+        template< typename Sequence >
+        struct sequence_key
+        {
+            typedef typename boost::remove_cv<
+                typename boost::remove_reference<
+                    typename boost::fusion::result_of::value_at_c< Sequence, 0 >::type
+                >::type
+            >::type type;
+        };
+
+        template< typename Sequence >
+        struct sequence_key_less
+        {
+            typedef typename sequence_key< Sequence >::type key_type;
+
+            bool operator ()( Sequence const& left, key_type const& right ) const
+            {
+                return boost::fusion::at_c< 0 >( left ) < right;
+            }
+            bool operator ()( key_type const& left, Sequence const& right ) const
+            {
+                return left < boost::fusion::at_c< 0 >( right );
+            }
+        };
+
+    } // namespace detail
+
+    // a read-only virtual table over a random-access range of Fusion
+    // sequences, one column per member and the index of an element as its
+    // rowid; rows are read in place, so the range must outlive the
+    // connection and not change while a statement reads from it. When the
+    // range is sorted by its first member, equality on the first column
+    // is looked up by binary search. The table is eponymous, a connection
+    // can query it by the name of the module, which needs SQLite 3.9 or
+    // later at run time; with older versions it has to be created with
+    // CREATE VIRTUAL TABLE, which is persisted in the schema, so it is best
+    // created as temp.name to keep it out of the database file
+    template< typename Range >
+    class sequence_table_module
+      : public basic_module< sequence_table_module< Range >, virtual_table, detail::sequence_table_cursor >
+    {
+        friend class basic_module< sequence_table_module< Range >, virtual_table, detail::sequence_table_cursor >;
+
+        typedef typename boost::range_value< Range const >::type sequence_type;
+        typedef typename detail::sequence_key< sequence_type >::type key_type;
+
+        typedef typename sequence_table_module::table_type table_type;
+        typedef typename sequence_table_module::cursor_type cursor_type;
+
+    public:
+        explicit sequence_table_module( Range const& range, bool sorted = false )
+          : basic_module< sequence_table_module< Range >, virtual_table, detail::sequence_table_cursor >( true )
+          , _range( &range )
+          , _sorted( sorted )
+        {}
+
+    private:
+        int connect( sqlite3* /*db*/, table_type& /*table*/, int /*argc*/, char const* const* /*argv*/, std::string& schema )
+        {
+            schema = "CREATE TABLE x( ";
+            boost::mpl::for_each<
+                boost::mpl::range_c< int, 0, boost::fusion::result_of::size< sequence_type >::type::value >
+            >( detail::sequence_schema_builder< sequence_type >( schema ) );
+            schema += " )";
+            return SQLITE_OK;
+        }
+
+        int best_index( table_type& /*table*/, sqlite3_index_info* info )
+        {
+            int first = -1, rowid = -1;
+            for( int i = 0; i < info->nConstraint; ++i )
+            {
+                sqlite3_index_info::sqlite3_index_constraint const& constraint = info->aConstraint[ i ];
+                if( !constraint.usable || constraint.op != SQLITE_INDEX_CONSTRAINT_EQ )
+                    continue;
+
+                if( constraint.iColumn == -1 )
+                    rowid = i;
+                else if( constraint.iColumn == 0 && _sorted )
+                    first = i;
+            }
+
+            double const rows = double( boost::size( *_range ) );
+            if( rowid >= 0 )
+            {
+                info->idxNum = detail::sequence_constraint::rowid;
+                info->aConstraintUsage[ rowid ].argvIndex = 1;
+                info->aConstraintUsage[ rowid ].omit = 1;
+                info->estimatedCost = 1;
+#           if SQLITE_VERSION_NUMBER >= 3008002
+                info->estimatedRows = 1;
+#           endif
+            } else if( first >= 0 ) {
+                // SQLite checks the constraint again, values are compared as
+                // the first member and conversions may be lossy
+                info->idxNum = detail::sequence_constraint::first;
+                info->aConstraintUsage[ first ].argvIndex = 1;
+                info->estimatedCost = std::log( rows + 1 ) + 1;
+#           if SQLITE_VERSION_NUMBER >= 3008002
+                info->estimatedRows = 1;
+#           endif
+            } else {
+                info->idxNum = 0;
+                info->estimatedCost = rows;
+#           if SQLITE_VERSION_NUMBER >= 3008002
+                info->estimatedRows = static_cast< sqlite3_int64 >( rows );
+#           endif
+            }
+
+            // rows come in the order of the range
+            if( info->nOrderBy == 1 && !info->aOrderBy[ 0 ].desc
+             && ( info->aOrderBy[ 0 ].iColumn == -1 || ( info->aOrderBy[ 0 ].iColumn == 0 && _sorted ) ) )
+            {
+                info->orderByConsumed = 1;
+            }
+            return SQLITE_OK;
+        }
+
+        int filter( cursor_type& cursor, int index, char const* /*index_string*/, int /*argc*/, sqlite3_value** argv )
+        {
+            std::size_t const size = boost::size( *_range );
+
+            cursor.position = 0;
+            cursor.end = size;
+            if( index == detail::sequence_constraint::rowid )
+            {
+                // the constraint is omitted, so a real equal to an integer
+                // has to match as well
+                int const type = sqlite3_value_numeric_type( argv[ 0 ] );
+                double const real = type == SQLITE_FLOAT ? sqlite3_value_double( argv[ 0 ] ) : 0;
+                bool const integral =
+                    type == SQLITE_INTEGER
+                 || ( type == SQLITE_FLOAT && real >= 0 && real < 9.2e18 && real == std::floor( real ) );
+
+                sqlite3_int64 const rowid = type == SQLITE_INTEGER
+                  ? sqlite3_value_int64( argv[ 0 ] ) : static_cast< sqlite3_int64 >( real );
+                bool const found =
+                    integral && rowid >= 0 && static_cast< std::size_t >( rowid ) < size;
+
+                cursor.position = found ? static_cast< std::size_t >( rowid ) : 0;
+                cursor.end = found ? cursor.position + 1 : 0;
+            } else if( index == detail::sequence_constraint::first ) {
+                if( sqlite3_value_type( argv[ 0 ] ) == SQLITE_NULL )
+                {
+                    cursor.end = 0;
+                    return SQLITE_OK;
+                }
+
+                key_type const key = raw_traits< key_type >::get( argv[ 0 ] );
+                std::pair<
+                    typename boost::range_iterator< Range const >::type
+                  , typename boost::range_iterator< Range const >::type
+                > const range =
+                    std::equal_range(
+                        boost::begin( *_range ), boost::begin( *_range ) + size
+                      , key, detail::sequence_key_less< sequence_type >()
+                    );
+                cursor.position = range.first - boost::begin( *_range );
+                cursor.end = range.second - boost::begin( *_range );
+            }
+            return SQLITE_OK;
+        }
+
+        int next( cursor_type& cursor )
+        {
+            ++cursor.position;
+            return SQLITE_OK;
+        }
+
+        bool eof( cursor_type& cursor )
+        {
+            return cursor.position >= cursor.end;
+        }
+
+        int column( cursor_type& cursor, sqlite3_context* context, int column )
+        {
+            boost::fusion::fold(
+                boost::begin( *_range )[ cursor.position ]
+              , 0, detail::sequence_column_fold( context, column )
+            );
+            return SQLITE_OK;
+        }
+
+        int rowid( cursor_type& cursor, sqlite3_int64* rowid )
+        {
+            *rowid = static_cast< sqlite3_int64 >( cursor.position );
+            return SQLITE_OK;
+        }
+
+    private:
+        Range const* _range;
+        bool _sorted;
+    };
+
+    // exposes a range as a table of the given name, see sequence_table_module
+    template< typename Range >
+    inline void create_sequence_table(
+        database& db, std::string const& name, Range const& range
+      , bool sorted, boost::system::error_code& error_code
+    )
+    {
+        create_module( db, name, new sequence_table_module< Range >( range, sorted ), error_code );
+    }
+    template< typename Range >
+    inline void create_sequence_table(
+        database& db, std::string const& name, Range const& range
+      , bool sorted = false
+    )
+    {
+        create_module( db, name, new sequence_table_module< Range >( range, sorted ) );
+    }
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_SEQUENCE_TABLE_HPP*/
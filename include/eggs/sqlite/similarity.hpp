@@ -0,0 +1,429 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/similarity.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_SIMILARITY_HPP
+#define EGGS_SQLITE_SIMILARITY_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/function.hpp>
+#include <eggs/sqlite/raw_traits.hpp>
+
+#include <boost/optional.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#include <vector>
+
+#if defined( __x86_64__ ) || defined( __i386__ ) || defined( _M_X64 ) || defined( _M_IX86 )
+#   define EGGS_SQLITE_SIMILARITY_AVX2
+#   include <immintrin.h>
+#   if defined( _MSC_VER )
+#       include <intrin.h>
+#       define EGGS_SQLITE_TARGET_AVX2
+#   else
+#       define EGGS_SQLITE_TARGET_AVX2 __attribute__(( target( "avx2,fma" ) ))
+#   endif
+#elif defined( __ARM_NEON ) || defined( __ARM_NEON__ )
+#   define EGGS_SQLITE_SIMILARITY_NEON
+#   include <arm_neon.h>
+#endif
+
+namespace eggs { namespace sqlite {
+
+    // a view of packed floats, as stored in a blob in native byte order;
+    // when read from a statement it is only valid until the next step, and
+    // when bound it has to outlive the binding, as the floats are not copied
+    class float_span
+    {
+    public:
+        float_span()
+          : _data( 0 )
+          , _size( 0 )
+        {}
+
+        float_span( float const* data, std::size_t size )
+          : _data( data )
+          , _size( size )
+        {}
+
+        explicit float_span( std::vector< float > const& values )
+          : _data( values.empty() ? 0 : &values[ 0 ] )
+          , _size( values.size() )
+        {}
+
+        float const* data() const
+        {
+            return _data;
+        }
+
+        std::size_t size() const
+        {
+            return _size;
+        }
+
+        float const* begin() const
+        {
+            return _data;
+        }
+        float const* end() const
+        {
+            return _data + _size;
+        }
+
+    private:
+        float const* _data;
+        std::size_t _size;
+    };
+
+    template<>
+    struct raw_traits< float_span >
+    {
+        typedef float_span value_type;
+
+        static value_type get( sqlite3_stmt* statement_handle, std::size_t index )
+        {
+            void const* bytes = sqlite3_column_blob( statement_handle, index );
+            std::size_t const size = sqlite3_column_bytes( statement_handle, index );
+
+            return value_type( static_cast< float const* >( bytes ), size / sizeof( float ) );
+        }
+        static void bind( sqlite3_stmt* statement_handle, std::size_t index, value_type value )
+        {
+            sqlite3_bind_blob(
+                statement_handle, index
+              , value.data(), value.size() * sizeof( float ), SQLITE_STATIC
+            );
+        }
+
+        static value_type get( sqlite3_value* value_handle )
+        {
+            void const* bytes = sqlite3_value_blob( value_handle );
+            std::size_t const size = sqlite3_value_bytes( value_handle );
+
+            return value_type( static_cast< float const* >( bytes ), size / sizeof( float ) );
+        }
+        static void result( sqlite3_context* context, value_type value )
+        {
+            sqlite3_result_blob(
+                context
+              , value.data(), value.size() * sizeof( float ), SQLITE_TRANSIENT
+            );
+        }
+    };
+
+    template<>
+    struct raw_traits< std::vector< float > >
+    {
+        typedef std::vector< float > value_type;
+
+        static value_type get( sqlite3_stmt* statement_handle, std::size_t index )
+        {
+            return to_vector( raw_traits< float_span >::get( statement_handle, index ) );
+        }
+        static void bind( sqlite3_stmt* statement_handle, std::size_t index, value_type const& value )
+        {
+            sqlite3_bind_blob(
+                statement_handle, index
+              , value.empty() ? 0 : &value[ 0 ], value.size() * sizeof( float ), SQLITE_TRANSIENT
+            );
+        }
+
+        static value_type get( sqlite3_value* value_handle )
+        {
+            return to_vector( raw_traits< float_span >::get( value_handle ) );
+        }
+        static void result( sqlite3_context* context, value_type const& value )
+        {
+            sqlite3_result_blob(
+                context
+              , value.empty() ? 0 : &value[ 0 ], value.size() * sizeof( float ), SQLITE_TRANSIENT
+            );
+        }
+
+    private:
+        // the blob is not necessarily aligned for floats
+        static value_type to_vector( float_span span )
+        {
+            value_type result( span.size() );
+            if( !result.empty() )
+                std::memcpy( &result[ 0 ], span.data(), span.size() * sizeof( float ) );
+            return result;
+        }
+    };
+
+    namespace detail {
+
+        // blobs may sit anywhere within a page, loads do not assume alignment
+        inline float load_float( float const* address )
+        {
+            float value;
+            std::memcpy( &value, address, sizeof( float ) );
+            return value;
+        }
+
+        inline float scalar_dot( float const* left, float const* right, std::size_t size )
+        {
+            float sum = 0;
+            for( std::size_t i = 0; i < size; ++i )
+                sum += load_float( left + i ) * load_float( right + i );
+            return sum;
+        }
+
+        inline float scalar_squared_l2( float const* left, float const* right, std::size_t size )
+        {
+            float sum = 0;
+            for( std::size_t i = 0; i < size; ++i )
+            {
+                float const difference = load_float( left + i ) - load_float( right + i );
+                sum += difference * difference;
+            }
+            return sum;
+        }
+
+        // the dot product and both squared norms, in a single pass
+        inline void scalar_cosine( float const* left, float const* right, std::size_t size, float* sums )
+        {
+            sums[ 0 ] = sums[ 1 ] = sums[ 2 ] = 0;
+            for( std::size_t i = 0; i < size; ++i )
+            {
+                float const l = load_float( left + i ), r = load_float( right + i );
+                sums[ 0 ] += l * r;
+                sums[ 1 ] += l * l;
+                sums[ 2 ] += r * r;
+            }
+        }
+
+#   if defined( EGGS_SQLITE_SIMILARITY_AVX2 )
+        inline bool cpu_has_avx2()
+        {
+#       if defined( _MSC_VER )
+            int info[ 4 ];
+            __cpuid( info, 1 );
+            bool const fma = ( info[ 2 ] & ( 1 << 12 ) ) != 0;
+            bool const os_saves_ymm = ( info[ 2 ] & ( 1 << 27 ) ) != 0 && ( _xgetbv( 0 ) & 6 ) == 6;
+            __cpuidex( info, 7, 0 );
+            bool const avx2 = ( info[ 1 ] & ( 1 << 5 ) ) != 0;
+            return fma && os_saves_ymm && avx2;
+#       else
+            return __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" );
+#       endif
+        }
+
+        EGGS_SQLITE_TARGET_AVX2 inline float avx2_sum( __m256 value )
+        {
+            __m128 sum = _mm_add_ps( _mm256_castps256_ps128( value ), _mm256_extractf128_ps( value, 1 ) );
+            sum = _mm_hadd_ps( sum, sum );
+            sum = _mm_hadd_ps( sum, sum );
+            return _mm_cvtss_f32( sum );
+        }
+
+        EGGS_SQLITE_TARGET_AVX2 inline float avx2_dot( float const* left, float const* right, std::size_t size )
+        {
+            __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+            std::size_t i = 0;
+            for( ; i + 16 <= size; i += 16 )
+            {
+                sum0 = _mm256_fmadd_ps( _mm256_loadu_ps( left + i ), _mm256_loadu_ps( right + i ), sum0 );
+                sum1 = _mm256_fmadd_ps( _mm256_loadu_ps( left + i + 8 ), _mm256_loadu_ps( right + i + 8 ), sum1 );
+            }
+            for( ; i + 8 <= size; i += 8 )
+                sum0 = _mm256_fmadd_ps( _mm256_loadu_ps( left + i ), _mm256_loadu_ps( right + i ), sum0 );
+            return avx2_sum( _mm256_add_ps( sum0, sum1 ) ) + scalar_dot( left + i, right + i, size - i );
+        }
+
+        EGGS_SQLITE_TARGET_AVX2 inline float avx2_squared_l2( float const* left, float const* right, std::size_t size )
+        {
+            __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+            std::size_t i = 0;
+            for( ; i + 16 <= size; i += 16 )
+            {
+                __m256 const difference0 = _mm256_sub_ps( _mm256_loadu_ps( left + i ), _mm256_loadu_ps( right + i ) );
+                __m256 const difference1 = _mm256_sub_ps( _mm256_loadu_ps( left + i + 8 ), _mm256_loadu_ps( right + i + 8 ) );
+                sum0 = _mm256_fmadd_ps( difference0, difference0, sum0 );
+                sum1 = _mm256_fmadd_ps( difference1, difference1, sum1 );
+            }
+            for( ; i + 8 <= size; i += 8 )
+            {
+                __m256 const difference = _mm256_sub_ps( _mm256_loadu_ps( left + i ), _mm256_loadu_ps( right + i ) );
+                sum0 = _mm256_fmadd_ps( difference, difference, sum0 );
+            }
+            return avx2_sum( _mm256_add_ps( sum0, sum1 ) ) + scalar_squared_l2( left + i, right + i, size - i );
+        }
+
+        EGGS_SQLITE_TARGET_AVX2 inline void avx2_cosine( float const* left, float const* right, std::size_t size, float* sums )
+        {
+            __m256 lr = _mm256_setzero_ps(), ll = _mm256_setzero_ps(), rr = _mm256_setzero_ps();
+            std::size_t i = 0;
+            for( ; i + 8 <= size; i += 8 )
+            {
+                __m256 const l = _mm256_loadu_ps( left + i ), r = _mm256_loadu_ps( right + i );
+                lr = _mm256_fmadd_ps( l, r, lr );
+                ll = _mm256_fmadd_ps( l, l, ll );
+                rr = _mm256_fmadd_ps( r, r, rr );
+            }
+            scalar_cosine( left + i, right + i, size - i, sums );
+            sums[ 0 ] += avx2_sum( lr );
+            sums[ 1 ] += avx2_sum( ll );
+            sums[ 2 ] += avx2_sum( rr );
+        }
+#   endif
+
+#   if defined( EGGS_SQLITE_SIMILARITY_NEON )
+        inline float32x4_t neon_load( float const* address )
+        {
+            return vreinterpretq_f32_u8( vld1q_u8( reinterpret_cast< unsigned char const* >( address ) ) );
+        }
+
+        inline float neon_sum( float32x4_t value )
+        {
+            float32x2_t const sum = vadd_f32( vget_low_f32( value ), vget_high_f32( value ) );
+            return vget_lane_f32( vpadd_f32( sum, sum ), 0 );
+        }
+
+        inline float neon_dot( float const* left, float const* right, std::size_t size )
+        {
+            float32x4_t sum = vdupq_n_f32( 0 );
+            std::size_t i = 0;
+            for( ; i + 4 <= size; i += 4 )
+                sum = vmlaq_f32( sum, neon_load( left + i ), neon_load( right + i ) );
+            return neon_sum( sum ) + scalar_dot( left + i, right + i, size - i );
+        }
+
+        inline float neon_squared_l2( float const* left, float const* right, std::size_t size )
+        {
+            float32x4_t sum = vdupq_n_f32( 0 );
+            std::size_t i = 0;
+            for( ; i + 4 <= size; i += 4 )
+            {
+                float32x4_t const difference = vsubq_f32( neon_load( left + i ), neon_load( right + i ) );
+                sum = vmlaq_f32( sum, difference, difference );
+            }
+            return neon_sum( sum ) + scalar_squared_l2( left + i, right + i, size - i );
+        }
+
+        inline void neon_cosine( float const* left, float const* right, std::size_t size, float* sums )
+        {
+            float32x4_t lr = vdupq_n_f32( 0 ), ll = vdupq_n_f32( 0 ), rr = vdupq_n_f32( 0 );
+            std::size_t i = 0;
+            for( ; i + 4 <= size; i += 4 )
+            {
+                float32x4_t const l = neon_load( left + i ), r = neon_load( right + i );
+                lr = vmlaq_f32( lr, l, r );
+                ll = vmlaq_f32( ll, l, l );
+                rr = vmlaq_f32( rr, r, r );
+            }
+            scalar_cosine( left + i, right + i, size - i, sums );
+            sums[ 0 ] += neon_sum( lr );
+            sums[ 1 ] += neon_sum( ll );
+            sums[ 2 ] += neon_sum( rr );
+        }
+#   endif
+
+        struct similarity_kernels
+        {
+            float ( *dot )( float const*, float const*, std::size_t );
+            float ( *squared_l2 )( float const*, float const*, std::size_t );
+            void ( *cosine )( float const*, float const*, std::size_t, float* );
+        };
+
+        // picks the widest instructions available on the running cpu, once
+        inline similarity_kernels select_similarity_kernels()
+        {
+#       if defined( EGGS_SQLITE_SIMILARITY_AVX2 )
+            if( cpu_has_avx2() )
+            {
+                similarity_kernels const kernels = { &avx2_dot, &avx2_squared_l2, &avx2_cosine };
+                return kernels;
+            }
+#       elif defined( EGGS_SQLITE_SIMILARITY_NEON )
+            similarity_kernels const kernels = { &neon_dot, &neon_squared_l2, &neon_cosine };
+            return kernels;
+#       endif
+            similarity_kernels const fallback = { &scalar_dot, &scalar_squared_l2, &scalar_cosine };
+            return fallback;
+        }
+
+        inline similarity_kernels const& get_similarity_kernels()
+        {
+            static similarity_kernels const kernels = select_similarity_kernels();
+            return kernels;
+        }
+
+        inline void check_dimensions( float_span const& left, float_span const& right )
+        {
+            if( left.size() != right.size() )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( result_code::mismatch ) );
+            }
+        }
+
+    } // namespace detail
+
+    inline double dot_product( float_span left, float_span right )
+    {
+        detail::check_dimensions( left, right );
+
+        return detail::get_similarity_kernels().dot( left.data(), right.data(), left.size() );
+    }
+
+    inline double l2_distance( float_span left, float_span right )
+    {
+        detail::check_dimensions( left, right );
+
+        return std::sqrt( detail::get_similarity_kernels().squared_l2( left.data(), right.data(), left.size() ) );
+    }
+
+    // zero for a zero vector, which points nowhere
+    inline double cosine_similarity( float_span left, float_span right )
+    {
+        detail::check_dimensions( left, right );
+
+        float sums[ 3 ];
+        detail::get_similarity_kernels().cosine( left.data(), right.data(), left.size(), sums );
+        if( sums[ 1 ] == 0 || sums[ 2 ] == 0 )
+            return 0;
+        return sums[ 0 ] / std::sqrt( double( sums[ 1 ] ) * sums[ 2 ] );
+    }
+
+    namespace detail {
+
+        // null in, null out, as with the functions built into SQLite
+        template< double ( *Function )( float_span, float_span ) >
+        inline boost::optional< double > similarity_function(
+            boost::optional< float_span > left, boost::optional< float_span > right )
+        {
+            if( !left || !right )
+                return boost::none;
+
+            return Function( *left, *right );
+        }
+
+    } // namespace detail
+
+    // makes dot, l2 and cosine callable from sql over blobs of packed floats;
+    // vectors of different dimensions are an error, and a null vector gives
+    // null
+    inline void create_similarity_functions( database& db )
+    {
+        create_function( db, "dot", &detail::similarity_function< &dot_product >, function_flags::deterministic );
+        create_function( db, "l2", &detail::similarity_function< &l2_distance >, function_flags::deterministic );
+        create_function( db, "cosine", &detail::similarity_function< &cosine_similarity >, function_flags::deterministic );
+    }
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_SIMILARITY_HPP*/
@@ -317,6 +317,19 @@ namespace eggs { namespace sqlite {
                 return _handle;
             }
 
+            // gives up ownership of the handle, leaving the statement empty
+            native_handle_type release()
+            {
+                native_handle_type const handle = _handle;
+
+                _db = 0;
+                _handle = 0;
+                _status = status_code::reset;
+                _params.clear();
+
+                return handle;
+            }
+
         protected:
             database* _db;
             native_handle_type _handle;        
@@ -0,0 +1,152 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/statement_cache.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_STATEMENT_CACHE_HPP
+#define EGGS_SQLITE_STATEMENT_CACHE_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/statement.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <cstddef>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace eggs { namespace sqlite {
+
+    // keeps prepared statements of a connection around so that they are
+    // compiled once; statements are acquired from the cache and released
+    // back to it once done with, several of them may be out for the same sql;
+    // statements are kept under the text SQLite keeps for them, which stops
+    // at the end of the first statement, so any sql sharing it shares them
+    class statement_cache
+    {
+    public:
+        explicit statement_cache( database& db )
+          : _db( db )
+          , _misses( 0 )
+        {}
+
+        ~statement_cache()
+        {
+            clear();
+        }
+
+        // compiles a statement ahead of its first use
+        void prepare( std::string const& sql, boost::system::error_code& error_code )
+        {
+            sqlite3_stmt* handle = detail::prepare( _db.native_handle(), sql.c_str(), sql.size(), &error_code );
+            if( !error_code && handle != 0 )
+                _idle[ key( sql, handle ) ].push_back( handle );
+        }
+        void prepare( std::string const& sql )
+        {
+            sqlite3_stmt* handle = detail::prepare( _db.native_handle(), sql.c_str(), sql.size() );
+
+            if( handle != 0 )
+                _idle[ key( sql, handle ) ].push_back( handle );
+        }
+
+        template< typename Statement >
+        Statement acquire( std::string const& sql )
+        {
+            std::map< std::string, std::string >::const_iterator const key_iter
+                = _keys.find( sql );
+            std::map< std::string, std::vector< sqlite3_stmt* > >::iterator iter
+                = _idle.find( key_iter == _keys.end() ? sql : key_iter->second );
+
+            sqlite3_stmt* handle = 0;
+            if( iter == _idle.end() || iter->second.empty() )
+            {
+                ++_misses;
+                handle = detail::prepare( _db.native_handle(), sql.c_str(), sql.size() );
+                if( handle != 0 )
+                    key( sql, handle );
+            } else {
+                handle = iter->second.back();
+                iter->second.pop_back();
+            }
+
+            return Statement( _db, handle );
+        }
+
+        template< typename Statement >
+        void release( Statement& statement )
+        {
+            if( statement.native_handle() == 0 )
+                return;
+
+            sqlite3_reset( statement.native_handle() );
+            sqlite3_clear_bindings( statement.native_handle() );
+
+            sqlite3_stmt* handle = statement.release();
+            _idle[ sqlite3_sql( handle ) ].push_back( handle );
+        }
+
+        // how many statements are waiting to be acquired
+        std::size_t size() const
+        {
+            std::size_t result = 0;
+            for(
+                std::map< std::string, std::vector< sqlite3_stmt* > >::const_iterator iter = _idle.begin();
+                iter != _idle.end(); ++iter
+            )
+            {
+                result += iter->second.size();
+            }
+            return result;
+        }
+
+        // how many statements had to be compiled on acquisition
+        std::size_t misses() const
+        {
+            return _misses;
+        }
+
+        void clear()
+        {
+            for(
+                std::map< std::string, std::vector< sqlite3_stmt* > >::iterator iter = _idle.begin();
+                iter != _idle.end(); ++iter
+            )
+            {
+                for( std::size_t i = 0; i < iter->second.size(); ++i )
+                    sqlite3_finalize( iter->second[ i ] );
+            }
+            _idle.clear();
+        }
+
+    private:
+        statement_cache( statement_cache const& );
+        statement_cache& operator =( statement_cache const& );
+
+        // remembers the text SQLite keeps for the statements of the given sql
+        std::string const& key( std::string const& sql, sqlite3_stmt* handle )
+        {
+            std::string& text = _keys[ sql ];
+            text = sqlite3_sql( handle );
+            return text;
+        }
+
+    private:
+        database& _db;
+        std::map< std::string, std::vector< sqlite3_stmt* > > _idle;
+        std::map< std::string, std::string > _keys;
+        std::size_t _misses;
+    };
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_STATEMENT_CACHE_HPP*/
@@ -0,0 +1,208 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/statement_registry.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_STATEMENT_REGISTRY_HPP
+#define EGGS_SQLITE_STATEMENT_REGISTRY_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/statement.hpp>
+
+#include <boost/array.hpp>
+
+#include <boost/fusion/include/is_sequence.hpp>
+#include <boost/fusion/include/size.hpp>
+
+#include <boost/mpl/begin_end.hpp>
+#include <boost/mpl/distance.hpp>
+#include <boost/mpl/eval_if.hpp>
+#include <boost/mpl/find.hpp>
+#include <boost/mpl/for_each.hpp>
+#include <boost/mpl/if.hpp>
+#include <boost/mpl/int.hpp>
+#include <boost/mpl/placeholders.hpp>
+#include <boost/mpl/size.hpp>
+
+#include <boost/static_assert.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <boost/type_traits/add_pointer.hpp>
+#include <boost/type_traits/is_void.hpp>
+
+#include <cstddef>
+
+namespace eggs { namespace sqlite {
+
+    namespace detail {
+
+        // statements with no result are written to, the rest are read from
+        template< typename Declaration >
+        struct registered_statement
+          : boost::mpl::if_<
+                boost::is_void< typename Declaration::result_type >
+              , ostatement
+              , istatement
+            >
+        {};
+
+        // the number of values in a params_type or result_type
+        template< typename Type >
+        struct declared_size
+          : boost::mpl::eval_if<
+                boost::is_void< Type >
+              , boost::mpl::int_< 0 >
+              , boost::mpl::eval_if<
+                    boost::fusion::traits::is_sequence< Type >
+                  , boost::fusion::result_of::size< Type >
+                  , boost::mpl::int_< 1 >
+                >
+            >::type
+        {};
+
+        struct registry_slot
+        {
+            virtual ~registry_slot() {}
+        };
+
+        template< typename Statement >
+        struct registry_slot_for
+          : registry_slot
+        {
+            explicit registry_slot_for( database& db, char const* sql )
+              : statement( db, sql )
+            {}
+
+            Statement statement;
+        };
+
+        template< typename Slots >
+        class registry_prepare
+        {
+        public:
+            explicit registry_prepare( database& db, Slots& slots )
+              : _db( &db )
+              , _slots( &slots )
+              , _index( 0 )
+            {}
+
+            template< typename Declaration >
+            void operator ()( Declaration* ) const
+            {
+                typedef typename registered_statement< Declaration >::type statement_type;
+
+                registry_slot_for< statement_type >* slot =
+                    new registry_slot_for< statement_type >( *_db, Declaration::sql() );
+                ( *_slots )[ _index++ ] = slot;
+
+                sqlite3_stmt* const handle = slot->statement.native_handle();
+                if( sqlite3_bind_parameter_count( handle ) != declared_size< typename Declaration::params_type >::value )
+                {
+                    BOOST_THROW_EXCEPTION( sqlite_error( result_code::range ) );
+                }
+                if( sqlite3_column_count( handle ) != declared_size< typename Declaration::result_type >::value )
+                {
+                    BOOST_THROW_EXCEPTION( sqlite_error( result_code::mismatch ) );
+                }
+            }
+
+        private:
+            database* _db;
+            Slots* _slots;
+            mutable std::size_t _index;
+        };
+
+    } // namespace detail
+
+    // prepares a fixed set of statements for a connection up front, so that
+    // bad sql or a statement that does not match its declaration is caught
+    // right away; each declaration is a type, used as the id to get at its
+    // statement, with
+    //
+    //   static char const* sql();
+    //   typedef ... params_type; // a fusion sequence, a single value or void
+    //   typedef ... result_type; // a fusion sequence, a single value or void
+    //
+    // statements with a void result_type are ostatements, istatements else
+    template< typename Statements >
+    class statement_registry
+    {
+    public:
+        template< typename Declaration >
+        struct index
+          : boost::mpl::distance<
+                typename boost::mpl::begin< Statements >::type
+              , typename boost::mpl::find< Statements, Declaration >::type
+            >
+        {};
+
+        template< typename Declaration >
+        struct statement_type
+          : detail::registered_statement< Declaration >
+        {};
+
+    public:
+        explicit statement_registry( database& db )
+        {
+            _slots.assign( 0 );
+            try
+            {
+                boost::mpl::for_each< Statements, boost::add_pointer< boost::mpl::_1 > >(
+                    detail::registry_prepare< slots_type >( db, _slots ) );
+            } catch( ... ) {
+                clear();
+                throw;
+            }
+        }
+
+        ~statement_registry()
+        {
+            clear();
+        }
+
+        // the statement for a declaration, reset and ready to be bound
+        template< typename Declaration >
+        typename statement_type< Declaration >::type& get()
+        {
+            BOOST_STATIC_ASSERT(( index< Declaration >::value < boost::mpl::size< Statements >::value ));
+
+            typedef typename statement_type< Declaration >::type type;
+
+            type& statement =
+                static_cast< detail::registry_slot_for< type >* >(
+                    _slots[ index< Declaration >::value ] )->statement;
+            statement.reset();
+
+            return statement;
+        }
+
+    private:
+        statement_registry( statement_registry const& );
+        statement_registry& operator =( statement_registry const& );
+
+        void clear()
+        {
+            for( std::size_t i = 0; i < _slots.size(); ++i )
+            {
+                delete _slots[ i ];
+                _slots[ i ] = 0;
+            }
+        }
+
+    private:
+        typedef boost::array< detail::registry_slot*, boost::mpl::size< Statements >::value > slots_type;
+        slots_type _slots;
+    };
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_STATEMENT_REGISTRY_HPP*/
@@ -0,0 +1,98 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/status.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_STATUS_HPP
+#define EGGS_SQLITE_STATUS_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+
+#include <boost/throw_exception.hpp>
+
+namespace eggs { namespace sqlite {
+
+    struct memory_status
+    {
+        enum enum_type
+        {
+            memory_used = SQLITE_STATUS_MEMORY_USED
+          , page_cache_used = SQLITE_STATUS_PAGECACHE_USED
+          , page_cache_overflow = SQLITE_STATUS_PAGECACHE_OVERFLOW
+          , scratch_used = SQLITE_STATUS_SCRATCH_USED
+          , scratch_overflow = SQLITE_STATUS_SCRATCH_OVERFLOW
+          , malloc_size = SQLITE_STATUS_MALLOC_SIZE
+          , parser_stack = SQLITE_STATUS_PARSER_STACK
+          , page_cache_size = SQLITE_STATUS_PAGECACHE_SIZE
+          , scratch_size = SQLITE_STATUS_SCRATCH_SIZE
+          , malloc_count = SQLITE_STATUS_MALLOC_COUNT
+        };
+    };
+
+    struct database_status
+    {
+        enum enum_type
+        {
+            lookaside_used = SQLITE_DBSTATUS_LOOKASIDE_USED
+          , cache_used = SQLITE_DBSTATUS_CACHE_USED
+          , schema_used = SQLITE_DBSTATUS_SCHEMA_USED
+          , statement_used = SQLITE_DBSTATUS_STMT_USED
+          , lookaside_hit = SQLITE_DBSTATUS_LOOKASIDE_HIT
+          , lookaside_miss_size = SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE
+          , lookaside_miss_full = SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL
+          , cache_hit = SQLITE_DBSTATUS_CACHE_HIT
+          , cache_miss = SQLITE_DBSTATUS_CACHE_MISS
+          , cache_write = SQLITE_DBSTATUS_CACHE_WRITE
+        };
+    };
+
+    struct status_value
+    {
+        int current;
+        int highwater;
+    };
+
+    inline status_value get_status( memory_status::enum_type op, bool reset = false )
+    {
+        status_value value = {};
+        int const result =
+            sqlite3_status(
+                op, &value.current, &value.highwater
+              , reset ? 1 : 0
+            );
+        if( result != result_code::ok )
+        {
+            BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+        }
+
+        return value;
+    }
+
+    inline status_value get_status( database const& db, database_status::enum_type op, bool reset = false )
+    {
+        status_value value = {};
+        int const result =
+            sqlite3_db_status(
+                db.native_handle()
+              , op, &value.current, &value.highwater
+              , reset ? 1 : 0
+            );
+        if( result != result_code::ok )
+        {
+            BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+        }
+
+        return value;
+    }
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_STATUS_HPP*/
@@ -0,0 +1,626 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/uring_vfs.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_URING_VFS_HPP
+#define EGGS_SQLITE_URING_VFS_HPP
+
+// this header is not included by <eggs/sqlite.hpp>, it requires the
+// io_uring kernel headers of Linux 5.6 or later, for IORING_OP_WRITE
+
+#if defined( __linux__ )
+
+#include <eggs/sqlite/detail/file_registry.hpp>
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/vfs.hpp>
+
+#include <boost/thread/mutex.hpp>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace eggs { namespace sqlite {
+
+    namespace detail {
+
+        struct uring_write
+        {
+            std::size_t buffer_offset;
+            unsigned size;
+            sqlite3_int64 offset;
+        };
+
+        // an io_uring instance along with the staging buffer writes are copied
+        // into, registered with the kernel when the memlock limit allows it
+        class uring
+        {
+        public:
+            uring()
+              : _descriptor( -1 )
+              , _entries( 0 )
+              , _sq( MAP_FAILED ), _sq_size( 0 )
+              , _cq( MAP_FAILED ), _cq_size( 0 )
+              , _sqes( MAP_FAILED ), _sqes_size( 0 )
+              , _buffer( MAP_FAILED ), _buffer_size( 0 )
+              , _registered( false )
+              , _tail( 0 )
+            {}
+
+            ~uring()
+            {
+                if( _buffer != MAP_FAILED )
+                    munmap( _buffer, _buffer_size );
+                if( _sqes != MAP_FAILED )
+                    munmap( _sqes, _sqes_size );
+                if( _cq != MAP_FAILED && _cq != _sq )
+                    munmap( _cq, _cq_size );
+                if( _sq != MAP_FAILED )
+                    munmap( _sq, _sq_size );
+                if( _descriptor >= 0 )
+                    ::close( _descriptor );
+            }
+
+            bool initialize( unsigned entries, std::size_t buffer_size )
+            {
+                io_uring_params params;
+                std::memset( &params, 0, sizeof( params ) );
+
+                _descriptor = static_cast< int >( ::syscall( __NR_io_uring_setup, entries, &params ) );
+                if( _descriptor < 0 )
+                    return false;
+
+                _entries = params.sq_entries;
+                _sq_size = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+                _cq_size = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+                if( params.features & IORING_FEAT_SINGLE_MMAP )
+                    _sq_size = _cq_size = (std::max)( _sq_size, _cq_size );
+
+                _sq = mmap( 0, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _descriptor, IORING_OFF_SQ_RING );
+                if( _sq == MAP_FAILED )
+                    return false;
+                _cq = ( params.features & IORING_FEAT_SINGLE_MMAP ) ? _sq
+                  : mmap( 0, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _descriptor, IORING_OFF_CQ_RING );
+                if( _cq == MAP_FAILED )
+                    return false;
+                _sqes_size = params.sq_entries * sizeof( io_uring_sqe );
+                _sqes = mmap( 0, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _descriptor, IORING_OFF_SQES );
+                if( _sqes == MAP_FAILED )
+                    return false;
+
+                unsigned char* const sq = static_cast< unsigned char* >( _sq );
+                _sq_tail = reinterpret_cast< unsigned* >( sq + params.sq_off.tail );
+                _sq_mask = reinterpret_cast< unsigned* >( sq + params.sq_off.ring_mask );
+                _sq_array = reinterpret_cast< unsigned* >( sq + params.sq_off.array );
+                _tail = *_sq_tail;
+
+                unsigned char* const cq = static_cast< unsigned char* >( _cq );
+                _cq_head = reinterpret_cast< unsigned* >( cq + params.cq_off.head );
+                _cq_tail = reinterpret_cast< unsigned* >( cq + params.cq_off.tail );
+                _cq_mask = reinterpret_cast< unsigned* >( cq + params.cq_off.ring_mask );
+                _cqes = reinterpret_cast< io_uring_cqe* >( cq + params.cq_off.cqes );
+
+                _buffer_size = buffer_size;
+                _buffer = mmap( 0, _buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+                if( _buffer == MAP_FAILED )
+                    return false;
+
+                iovec vector = { _buffer, _buffer_size };
+                _registered = ::syscall( __NR_io_uring_register, _descriptor, IORING_REGISTER_BUFFERS, &vector, 1 ) == 0;
+
+                return true;
+            }
+
+            unsigned char* buffer() const
+            {
+                return static_cast< unsigned char* >( _buffer );
+            }
+
+            std::size_t buffer_size() const
+            {
+                return _buffer_size;
+            }
+
+            // writes are linked so they land in order, and the sync if any is
+            // linked after the last of them; returns false if any of them failed
+            bool submit( int descriptor, uring_write const* writes, std::size_t count, bool sync, bool data_only )
+            {
+                do
+                {
+                    std::size_t const round = (std::min)( count, static_cast< std::size_t >( _entries - 1 ) );
+                    bool const last = round == count;
+
+                    for( std::size_t i = 0; i < round; ++i )
+                    {
+                        io_uring_sqe& sqe = next_sqe();
+                        sqe.opcode = _registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+                        sqe.fd = descriptor;
+                        sqe.off = static_cast< __u64 >( writes[ i ].offset );
+                        sqe.addr = reinterpret_cast< __u64 >( buffer() + writes[ i ].buffer_offset );
+                        sqe.len = writes[ i ].size;
+                        sqe.flags = ( i + 1 < round || ( last && sync ) ) ? IOSQE_IO_LINK : 0;
+                        sqe.user_data = writes[ i ].size;
+                    }
+                    if( last && sync )
+                    {
+                        io_uring_sqe& sqe = next_sqe();
+                        sqe.opcode = IORING_OP_FSYNC;
+                        sqe.fd = descriptor;
+                        sqe.fsync_flags = data_only ? IORING_FSYNC_DATASYNC : 0;
+                        sqe.user_data = 0;
+                    }
+
+                    if( !submit_and_wait( static_cast< unsigned >( round + ( last && sync ? 1 : 0 ) ) ) )
+                        return false;
+
+                    writes += round;
+                    count -= round;
+                } while( count != 0 );
+
+                return true;
+            }
+
+        private:
+            uring( uring const& );
+            uring& operator =( uring const& );
+
+            io_uring_sqe& next_sqe()
+            {
+                unsigned const index = _tail & *_sq_mask;
+                io_uring_sqe& sqe = static_cast< io_uring_sqe* >( _sqes )[ index ];
+                std::memset( &sqe, 0, sizeof( sqe ) );
+                _sq_array[ index ] = index;
+                ++_tail;
+                return sqe;
+            }
+
+            bool submit_and_wait( unsigned count )
+            {
+                __atomic_store_n( _sq_tail, _tail, __ATOMIC_RELEASE );
+
+                bool success = true;
+                unsigned submitted = 0;
+                unsigned completed = 0;
+                while( completed < count )
+                {
+                    long const entered =
+                        ::syscall(
+                            __NR_io_uring_enter, _descriptor
+                          , count - submitted, count - completed
+                          , IORING_ENTER_GETEVENTS, 0, 0
+                        );
+                    if( entered < 0 && errno != EINTR )
+                    {
+                        // nothing more will complete, forget about what was queued
+                        _tail = __atomic_load_n( _sq_tail, __ATOMIC_ACQUIRE );
+                        return false;
+                    }
+                    if( entered > 0 )
+                        submitted += static_cast< unsigned >( entered );
+
+                    unsigned head = *_cq_head;
+                    unsigned const tail = __atomic_load_n( _cq_tail, __ATOMIC_ACQUIRE );
+                    for( ; head != tail; ++head, ++completed )
+                    {
+                        io_uring_cqe const& cqe = _cqes[ head & *_cq_mask ];
+                        if( cqe.res < 0 || static_cast< __u64 >( cqe.res ) != cqe.user_data )
+                            success = false;
+                    }
+                    __atomic_store_n( _cq_head, head, __ATOMIC_RELEASE );
+                }
+                return success;
+            }
+
+        private:
+            int _descriptor;
+            unsigned _entries;
+
+            void* _sq;
+            std::size_t _sq_size;
+            void* _cq;
+            std::size_t _cq_size;
+            void* _sqes;
+            std::size_t _sqes_size;
+            void* _buffer;
+            std::size_t _buffer_size;
+            bool _registered;
+
+            unsigned* _sq_tail;
+            unsigned* _sq_mask;
+            unsigned* _sq_array;
+            unsigned _tail;
+
+            unsigned* _cq_head;
+            unsigned* _cq_tail;
+            unsigned* _cq_mask;
+            io_uring_cqe* _cqes;
+        };
+
+        struct uring_file : vfs_file
+        {
+            uring_file()
+              : descriptor( -1 )
+              , path( 0 )
+              , directory_sync( false )
+              , wal( false )
+              , direct( false )
+              , flush_after_write( false )
+              , ring( 0 )
+              , buffer_used( 0 )
+            {}
+
+            int descriptor; // -1 when writes go through the parent vfs
+            char const* path;
+            bool directory_sync;
+            bool wal;
+            bool direct; // a database in WAL mode, whose writes are not buffered
+            bool flush_after_write;
+
+            uring* ring; // held from the first buffered write until flushed
+            std::size_t buffer_used;
+            std::vector< uring_write > pending;
+        };
+
+        inline unsigned get_big_endian( void const* buffer )
+        {
+            unsigned char const* const bytes = static_cast< unsigned char const* >( buffer );
+            return ( static_cast< unsigned >( bytes[ 0 ] ) << 24 ) | ( bytes[ 1 ] << 16 ) | ( bytes[ 2 ] << 8 ) | bytes[ 3 ];
+        }
+
+        inline bool write_fully( int descriptor, unsigned char const* buffer, std::size_t size, sqlite3_int64 offset )
+        {
+            while( size != 0 )
+            {
+                ssize_t const written = ::pwrite( descriptor, buffer, size, offset );
+                if( written < 0 && errno == EINTR )
+                    continue;
+                if( written <= 0 )
+                    return false;
+
+                buffer += written;
+                size -= static_cast< std::size_t >( written );
+                offset += written;
+            }
+            return true;
+        }
+
+        // file controls SQLite issues routinely that do not look at the
+        // contents of the file, so pending writes can stay batched; any
+        // other may hand out the file or map it, and flushes first
+        inline bool uring_keeps_batch( int op )
+        {
+            switch( op )
+            {
+            case SQLITE_FCNTL_LOCKSTATE:
+            case SQLITE_FCNTL_SIZE_HINT:
+            case SQLITE_FCNTL_CHUNK_SIZE:
+            case SQLITE_FCNTL_SYNC_OMITTED:
+            case SQLITE_FCNTL_PERSIST_WAL:
+            case SQLITE_FCNTL_OVERWRITE:
+            case SQLITE_FCNTL_VFSNAME:
+            case SQLITE_FCNTL_POWERSAFE_OVERWRITE:
+#       if defined( SQLITE_FCNTL_BUSYHANDLER )
+            case SQLITE_FCNTL_BUSYHANDLER:
+#       endif
+#       if defined( SQLITE_FCNTL_HAS_MOVED )
+            case SQLITE_FCNTL_HAS_MOVED:
+#       endif
+#       if defined( SQLITE_FCNTL_SYNC )
+            case SQLITE_FCNTL_SYNC: // followed by xSync, which flushes
+#       endif
+#       if defined( SQLITE_FCNTL_COMMIT_PHASETWO )
+            case SQLITE_FCNTL_COMMIT_PHASETWO:
+#       endif
+                return true;
+            default:
+                return false;
+            }
+        }
+
+    } // namespace detail
+
+    // a vfs that buffers the writes of the main database, its journal and its
+    // WAL, and hands them to the kernel as a single io_uring submission with
+    // the sync linked after them; WAL writes are also submitted once a commit
+    // frame is complete, so that readers never see frames still buffered
+    //
+    // locking and shared memory stay with the parent vfs, and every connection
+    // in the process to a given database has to use this vfs as descriptors
+    // are shared per inode
+    class uring_vfs
+      : public basic_vfs< uring_vfs, detail::uring_file >
+    {
+        friend class basic_vfs< uring_vfs, detail::uring_file >;
+
+    public:
+        explicit uring_vfs( std::string const& name = "eggs-uring", unsigned queue_depth = 64, std::size_t buffer_size = 1 << 20, bool make_default = false, char const* parent = 0 )
+          : basic_vfs< uring_vfs, detail::uring_file >( name, make_default, parent )
+          , _queue_depth( queue_depth )
+          , _buffer_size( buffer_size )
+        {}
+
+        ~uring_vfs()
+        {
+            for( std::size_t i = 0; i < _rings.size(); ++i )
+                delete _rings[ i ];
+        }
+
+    private:
+        detail::uring* acquire_ring()
+        {
+            boost::mutex::scoped_lock lock( _rings_mutex );
+
+            if( !_free_rings.empty() )
+            {
+                detail::uring* const ring = _free_rings.back();
+                _free_rings.pop_back();
+                return ring;
+            }
+
+            detail::uring* ring = new ( std::nothrow ) detail::uring();
+            if( ring != 0 && !ring->initialize( _queue_depth, _buffer_size ) )
+            {
+                delete ring;
+                ring = 0;
+            }
+            if( ring != 0 )
+                _rings.push_back( ring );
+            return ring;
+        }
+
+        // a ring that failed may still have entries in flight, so it is dropped
+        void release_ring( detail::uring* ring, bool reusable = true )
+        {
+            boost::mutex::scoped_lock lock( _rings_mutex );
+
+            if( reusable )
+            {
+                _free_rings.push_back( ring );
+            } else {
+                _rings.erase( std::find( _rings.begin(), _rings.end(), ring ) );
+                delete ring;
+            }
+        }
+
+        // writes out anything buffered, then syncs if asked to
+        int flush( file_type& file, bool sync = false, int sync_flags = 0 )
+        {
+            bool const data_only = ( sync_flags & SQLITE_SYNC_DATAONLY ) != 0;
+
+            int result = SQLITE_OK;
+            if( !file.pending.empty() )
+            {
+                bool const submitted = file.ring->submit( file.descriptor, &file.pending[ 0 ], file.pending.size(), sync, data_only );
+                if( !submitted )
+                {
+                    // retry synchronously, rewriting what may already be there is harmless
+                    for( std::size_t i = 0; i < file.pending.size() && result == SQLITE_OK; ++i )
+                    {
+                        detail::uring_write const& write = file.pending[ i ];
+                        if( !detail::write_fully( file.descriptor, file.ring->buffer() + write.buffer_offset, write.size, write.offset ) )
+                            result = SQLITE_IOERR_WRITE;
+                    }
+                    if( result == SQLITE_OK && sync && ( data_only ? ::fdatasync( file.descriptor ) : ::fsync( file.descriptor ) ) != 0 )
+                        result = SQLITE_IOERR_FSYNC;
+                }
+
+                file.pending.clear();
+                file.buffer_used = 0;
+                release_ring( file.ring, submitted );
+                file.ring = 0;
+            } else if( sync ) {
+                if( ( data_only ? ::fdatasync( file.descriptor ) : ::fsync( file.descriptor ) ) != 0 )
+                    result = SQLITE_IOERR_FSYNC;
+            }
+
+            if( result == SQLITE_OK && sync && file.directory_sync )
+            {
+                result = sync_directory( file.path );
+                file.directory_sync = false;
+            }
+            return result;
+        }
+
+        static int sync_directory( char const* path )
+        {
+            char const* const separator = std::strrchr( path, '/' );
+            std::string const directory = separator == 0 ? std::string( "." )
+              : separator == path ? std::string( "/" )
+              : std::string( path, separator );
+
+            int const descriptor = ::open( directory.c_str(), O_RDONLY | O_CLOEXEC );
+            if( descriptor < 0 )
+                return SQLITE_OK;
+
+            int const result = ::fsync( descriptor ) == 0 ? SQLITE_OK : SQLITE_IOERR_DIR_FSYNC;
+            ::close( descriptor );
+            return result;
+        }
+
+    private:
+        int open( file_type& file, char const* path, int flags, int* out_flags )
+        {
+            int const result = basic_vfs< uring_vfs, detail::uring_file >::open( file, path, flags, out_flags );
+            if( result != SQLITE_OK )
+                return result;
+
+            int const buffered_files = SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_MAIN_JOURNAL | SQLITE_OPEN_WAL;
+            if( path != 0 && ( flags & buffered_files ) != 0 && ( flags & SQLITE_OPEN_READWRITE ) != 0 )
+            {
+                // journals and WAL files carry no POSIX locks of the unix vfs
+                file.descriptor = detail::file_registry::instance().acquire( path, true, ( flags & SQLITE_OPEN_MAIN_DB ) != 0 );
+                file.path = path;
+                file.directory_sync =
+                    ( flags & SQLITE_OPEN_CREATE ) != 0
+                 && ( flags & ( SQLITE_OPEN_MAIN_JOURNAL | SQLITE_OPEN_WAL ) ) != 0;
+                file.wal = ( flags & SQLITE_OPEN_WAL ) != 0;
+            }
+            return SQLITE_OK;
+        }
+        int close( file_type& file )
+        {
+            int result = SQLITE_OK;
+            if( file.descriptor >= 0 )
+                result = flush( file );
+
+            int const close_result = basic_vfs< uring_vfs, detail::uring_file >::close( file );
+            if( file.descriptor >= 0 )
+                detail::file_registry::instance().release( file.descriptor );
+            return result != SQLITE_OK ? result : close_result;
+        }
+
+        int read( file_type& file, void* buffer, int amount, sqlite3_int64 offset )
+        {
+            if( !file.pending.empty() )
+            {
+                int const result = flush( file );
+                if( result != SQLITE_OK )
+                    return SQLITE_IOERR_READ;
+            }
+            return file.real->pMethods->xRead( file.real, buffer, amount, offset );
+        }
+        int write( file_type& file, void const* buffer, int amount, sqlite3_int64 offset )
+        {
+            if( file.descriptor < 0 )
+                return file.real->pMethods->xWrite( file.real, buffer, amount, offset );
+            if( file.direct )
+                return detail::write_fully( file.descriptor, static_cast< unsigned char const* >( buffer ), amount, offset )
+                    ? SQLITE_OK : SQLITE_IOERR_WRITE;
+
+            int const result = buffer_write( file, buffer, static_cast< std::size_t >( amount ), offset );
+            if( result != SQLITE_OK )
+                return result;
+
+            if( file.flush_after_write )
+            {
+                file.flush_after_write = false;
+                return flush( file );
+            }
+
+            // a frame header with a database size marks the end of a commit,
+            // the frame contents come right after it
+            if( file.wal && amount == 24 && offset >= 32 && detail::get_big_endian( static_cast< unsigned char const* >( buffer ) + 4 ) != 0 )
+                file.flush_after_write = true;
+            return SQLITE_OK;
+        }
+        int buffer_write( file_type& file, void const* buffer, std::size_t size, sqlite3_int64 offset )
+        {
+            // a rewrite of a buffered range just updates it, unless a later
+            // write overlaps it and would land on top of the new contents
+            for( std::size_t i = file.pending.size(); i != 0; --i )
+            {
+                detail::uring_write const& write = file.pending[ i - 1 ];
+                if( write.offset == offset && write.size == size )
+                {
+                    std::memcpy( file.ring->buffer() + write.buffer_offset, buffer, size );
+                    return SQLITE_OK;
+                }
+                if( write.offset < offset + sqlite3_int64( size ) && offset < write.offset + sqlite3_int64( write.size ) )
+                    break;
+            }
+
+            if( file.ring != 0
+             && ( file.buffer_used + size > file.ring->buffer_size() || file.pending.size() + 1 >= _queue_depth ) )
+            {
+                int const result = flush( file );
+                if( result != SQLITE_OK )
+                    return result;
+            }
+            if( file.ring == 0 )
+                file.ring = acquire_ring();
+            if( file.ring == 0 || size > file.ring->buffer_size() )
+            {
+                if( file.ring != 0 && file.pending.empty() )
+                {
+                    release_ring( file.ring );
+                    file.ring = 0;
+                }
+                return detail::write_fully( file.descriptor, static_cast< unsigned char const* >( buffer ), size, offset )
+                    ? SQLITE_OK : SQLITE_IOERR_WRITE;
+            }
+
+            detail::uring_write const write = { file.buffer_used, static_cast< unsigned >( size ), offset };
+            std::memcpy( file.ring->buffer() + write.buffer_offset, buffer, size );
+            file.pending.push_back( write );
+            file.buffer_used = ( file.buffer_used + size + 7 ) & ~std::size_t( 7 );
+            return SQLITE_OK;
+        }
+        int truncate( file_type& file, sqlite3_int64 size )
+        {
+            int const result = flush( file );
+            return result != SQLITE_OK ? result : file.real->pMethods->xTruncate( file.real, size );
+        }
+        int sync( file_type& file, int flags )
+        {
+            if( file.descriptor < 0 )
+                return file.real->pMethods->xSync( file.real, flags );
+
+            return flush( file, true, flags );
+        }
+        int file_size( file_type& file, sqlite3_int64* size )
+        {
+            int const result = flush( file );
+            return result != SQLITE_OK ? result : file.real->pMethods->xFileSize( file.real, size );
+        }
+        int unlock( file_type& file, int level )
+        {
+            int const result = flush( file );
+            return result != SQLITE_OK ? result : file.real->pMethods->xUnlock( file.real, level );
+        }
+        int file_control( file_type& file, int op, void* argument )
+        {
+            if( !detail::uring_keeps_batch( op ) )
+            {
+                int const result = flush( file );
+                if( result != SQLITE_OK )
+                    return result;
+            }
+            return file.real->pMethods->xFileControl( file.real, op, argument );
+        }
+        int shm_map( file_type& file, int region, int region_size, int extend, void volatile** address )
+        {
+            // checkpoints publish their progress through shared memory alone,
+            // so the database file is no longer buffered once in WAL mode
+            if( !file.direct )
+            {
+                int const result = flush( file );
+                if( result != SQLITE_OK )
+                    return result;
+                file.direct = true;
+            }
+            return file.real->pMethods->xShmMap( file.real, region, region_size, extend, address );
+        }
+
+    private:
+        unsigned _queue_depth;
+        std::size_t _buffer_size;
+
+        boost::mutex _rings_mutex;
+        std::vector< detail::uring* > _rings;
+        std::vector< detail::uring* > _free_rings;
+    };
+
+} } // namespace eggs::sqlite
+
+#endif
+
+#endif /*EGGS_SQLITE_URING_VFS_HPP*/
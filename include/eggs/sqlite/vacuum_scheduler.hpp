@@ -0,0 +1,224 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/vacuum_scheduler.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_VACUUM_SCHEDULER_HPP
+#define EGGS_SQLITE_VACUUM_SCHEDULER_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/pragma.hpp>
+
+#include <boost/chrono/duration.hpp>
+#include <boost/chrono/system_clocks.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <algorithm>
+#include <string>
+
+namespace eggs { namespace sqlite {
+
+    struct vacuum_options
+    {
+        vacuum_options()
+          : interval( 250 )
+          , idle_time( 2000 )
+          , free_pages( 256 )
+          , step_pages( 64 )
+        {}
+
+        // how often to look at the database
+        boost::chrono::milliseconds interval;
+
+        // how long the database must go without writes to be considered idle
+        boost::chrono::milliseconds idle_time;
+
+        // leave the free list alone until it holds this many pages
+        int free_pages;
+
+        // the most pages to reclaim in a single step, one step per interval
+        int step_pages;
+    };
+
+    struct vacuum_statistics
+    {
+        boost::uint64_t steps;
+        boost::uint64_t pages_reclaimed;
+        boost::uint64_t busy; // steps skipped because the database was in use
+        boost::uint64_t errors;
+        int free_pages; // the size of the free list when last looked at
+        boost::chrono::nanoseconds last_duration;
+        boost::chrono::nanoseconds max_duration;
+    };
+
+    // reclaims free pages of a database with auto_vacuum=incremental in small
+    // steps, whenever the given connection has not written for a while; the
+    // steps run on a background thread with a connection of its own, and
+    // writers may need a busy timeout to wait for one to finish. The given
+    // connection is looked at from the background thread under its own
+    // mutex, so it must not be opened with SQLITE_OPEN_NOMUTEX
+    class vacuum_scheduler
+    {
+    public:
+        explicit vacuum_scheduler(
+            database& db
+          , vacuum_options const& vacuum = vacuum_options()
+          , database::options const& options = database::options()
+        )
+          : _db( db )
+          , _background( sqlite3_db_filename( db.native_handle(), "main" ), database::mode::read_write, options )
+          , _options( vacuum )
+          , _stop( false )
+          , _changes( sqlite3_total_changes( db.native_handle() ) )
+          , _last_change( boost::chrono::steady_clock::now() )
+          , _steps( 0 ), _pages_reclaimed( 0 ), _busy( 0 ), _errors( 0 )
+          , _free_pages( 0 )
+          , _last_duration( 0 ), _max_duration( 0 )
+        {
+            // a database not in incremental mode has to be vacuumed whole, and
+            // a connection with no mutex cannot be looked at from elsewhere
+            if( get_pragma< pragma::auto_vacuum >( _background ) != pragma::auto_vacuum::incremental
+             || sqlite3_db_mutex( db.native_handle() ) == 0 )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( result_code::misuse ) );
+            }
+
+            _thread = boost::thread( &vacuum_scheduler::run, this );
+        }
+
+        ~vacuum_scheduler()
+        {
+            {
+                boost::mutex::scoped_lock lock( _mutex );
+                _stop = true;
+            }
+            _condition.notify_one();
+            _thread.join();
+        }
+
+        vacuum_statistics statistics() const
+        {
+            boost::mutex::scoped_lock lock( _mutex );
+
+            vacuum_statistics value;
+            value.steps = _steps;
+            value.pages_reclaimed = _pages_reclaimed;
+            value.busy = _busy;
+            value.errors = _errors;
+            value.free_pages = _free_pages;
+            value.last_duration = _last_duration;
+            value.max_duration = _max_duration;
+            return value;
+        }
+
+    private:
+        vacuum_scheduler( vacuum_scheduler const& );
+        vacuum_scheduler& operator =( vacuum_scheduler const& );
+
+        // writes made through the connection being watched count as activity
+        bool idle( boost::chrono::steady_clock::time_point now )
+        {
+            sqlite3_mutex* const mutex = sqlite3_db_mutex( _db.native_handle() );
+            sqlite3_mutex_enter( mutex );
+            int const changes = sqlite3_total_changes( _db.native_handle() );
+            sqlite3_mutex_leave( mutex );
+
+            if( changes != _changes )
+            {
+                _changes = changes;
+                _last_change = now;
+            }
+            return now - _last_change >= _options.idle_time;
+        }
+
+        void run()
+        {
+            boost::mutex::scoped_lock lock( _mutex );
+            while( !_stop )
+            {
+                _condition.wait_for( lock, _options.interval );
+                if( _stop )
+                    break;
+
+                boost::chrono::steady_clock::time_point const start = boost::chrono::steady_clock::now();
+                if( !idle( start ) )
+                    continue;
+
+                lock.unlock();
+                int before = 0, after = 0;
+                bool stepped = false, busy = false, error = false;
+                try
+                {
+                    before = get_pragma< pragma::freelist_count >( _background );
+                    after = before;
+                    if( before >= _options.free_pages && before > 0 )
+                    {
+                        call_pragma< pragma::incremental_vacuum >( _background, (std::min)( before, _options.step_pages ) );
+                        after = get_pragma< pragma::freelist_count >( _background );
+                        stepped = true;
+                    }
+                } catch( sqlite_error const& e ) {
+                    int const code = e.code().value() & 0xff;
+                    busy = code == SQLITE_BUSY || code == SQLITE_LOCKED;
+                    error = !busy;
+                }
+                boost::chrono::steady_clock::time_point const end = boost::chrono::steady_clock::now();
+                lock.lock();
+
+                _free_pages = after;
+                if( busy )
+                    ++_busy;
+                if( error )
+                    ++_errors;
+                if( !stepped )
+                    continue;
+
+                boost::chrono::nanoseconds const duration =
+                    boost::chrono::duration_cast< boost::chrono::nanoseconds >( end - start );
+                ++_steps;
+                _pages_reclaimed += (std::max)( before - after, 0 );
+                _last_duration = duration;
+                _max_duration = (std::max)( _max_duration, duration );
+            }
+        }
+
+    private:
+        database& _db;
+        database _background;
+        vacuum_options _options;
+
+        mutable boost::mutex _mutex;
+        boost::condition_variable _condition;
+        boost::thread _thread;
+        bool _stop;
+
+        int _changes;
+        boost::chrono::steady_clock::time_point _last_change;
+
+        boost::uint64_t _steps;
+        boost::uint64_t _pages_reclaimed;
+        boost::uint64_t _busy;
+        boost::uint64_t _errors;
+        int _free_pages;
+        boost::chrono::nanoseconds _last_duration;
+        boost::chrono::nanoseconds _max_duration;
+    };
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_VACUUM_SCHEDULER_HPP*/
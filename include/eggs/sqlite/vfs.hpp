@@ -0,0 +1,453 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/vfs.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_VFS_HPP
+#define EGGS_SQLITE_VFS_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/error.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <cstddef>
+
+#include <algorithm>
+#include <new>
+#include <string>
+
+namespace eggs { namespace sqlite {
+
+    // the common part of every file opened through a basic_vfs, file types
+    // given to basic_vfs must derive from it
+    struct vfs_file
+    {
+        vfs_file()
+          : real( 0 )
+          , flags( 0 )
+          , vfs( 0 )
+        {
+            base.pMethods = 0;
+        }
+
+        sqlite3_file base;
+        sqlite3_file* real; // the file as opened by the parent vfs
+        int flags;
+        void* vfs;
+    };
+
+    namespace detail {
+
+        inline std::size_t vfs_file_offset( std::size_t size )
+        {
+            return ( size + 7 ) & ~std::size_t( 7 );
+        }
+
+    } // namespace detail
+
+    // a vfs that forwards everything to a parent vfs; Derived hides any of the
+    // hooks below to change behavior, hooks must not throw
+    template< typename Derived, typename File = vfs_file >
+    class basic_vfs
+    {
+    public:
+        typedef sqlite3_vfs* native_handle_type;
+
+        typedef File file_type;
+
+    public:
+        explicit basic_vfs( std::string const& name, bool make_default = false, char const* parent = 0 )
+          : _name( name )
+          , _parent( sqlite3_vfs_find( parent ) )
+        {
+            if( _parent == 0 )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( result_code::error ) );
+            }
+
+            _vfs.iVersion = (std::min)( _parent->iVersion, 3 );
+            _vfs.szOsFile = static_cast< int >( detail::vfs_file_offset( sizeof( File ) ) ) + _parent->szOsFile;
+            _vfs.mxPathname = _parent->mxPathname;
+            _vfs.pNext = 0;
+            _vfs.zName = _name.c_str();
+            _vfs.pAppData = static_cast< Derived* >( this );
+            _vfs.xOpen = &basic_vfs::x_open;
+            _vfs.xDelete = &basic_vfs::x_delete;
+            _vfs.xAccess = &basic_vfs::x_access;
+            _vfs.xFullPathname = &basic_vfs::x_full_pathname;
+            _vfs.xDlOpen = &basic_vfs::x_dl_open;
+            _vfs.xDlError = &basic_vfs::x_dl_error;
+            _vfs.xDlSym = &basic_vfs::x_dl_sym;
+            _vfs.xDlClose = &basic_vfs::x_dl_close;
+            _vfs.xRandomness = &basic_vfs::x_randomness;
+            _vfs.xSleep = &basic_vfs::x_sleep;
+            _vfs.xCurrentTime = &basic_vfs::x_current_time;
+            _vfs.xGetLastError = &basic_vfs::x_get_last_error;
+            _vfs.xCurrentTimeInt64 = _vfs.iVersion >= 2 ? &basic_vfs::x_current_time_int64 : 0;
+            _vfs.xSetSystemCall = _vfs.iVersion >= 3 ? &basic_vfs::x_set_system_call : 0;
+            _vfs.xGetSystemCall = _vfs.iVersion >= 3 ? &basic_vfs::x_get_system_call : 0;
+            _vfs.xNextSystemCall = _vfs.iVersion >= 3 ? &basic_vfs::x_next_system_call : 0;
+
+            int const result = sqlite3_vfs_register( &_vfs, make_default ? 1 : 0 );
+            if( result != result_code::ok )
+            {
+                BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+            }
+        }
+
+        // no database may be using the vfs by now
+        ~basic_vfs()
+        {
+            sqlite3_vfs_unregister( &_vfs );
+        }
+
+        std::string const& name() const
+        {
+            return _name;
+        }
+
+        native_handle_type native_handle()
+        {
+            return &_vfs;
+        }
+
+        native_handle_type parent() const
+        {
+            return _parent;
+        }
+
+        // the file behind handle if it was opened through this vfs, or null
+        file_type* find_file( sqlite3_file* handle ) const
+        {
+            if( handle == 0 || ( handle->pMethods != io_methods( 1 ) && handle->pMethods != io_methods( 2 ) ) )
+                return 0;
+
+            file_type& f = file( handle );
+            return f.vfs == static_cast< Derived const* >( this ) ? &f : 0;
+        }
+
+    protected:
+        // opens file.real through the parent vfs
+        int open( file_type& file, char const* path, int flags, int* out_flags )
+        {
+            return _parent->xOpen( _parent, path, file.real, flags, out_flags );
+        }
+        int close( file_type& file )
+        {
+            return file.real->pMethods != 0 ? file.real->pMethods->xClose( file.real ) : SQLITE_OK;
+        }
+
+        // the version of the io methods for the file, shared memory is only
+        // available for version 2
+        int methods_version( file_type const& file ) const
+        {
+            return file.real->pMethods != 0 ? (std::min)( file.real->pMethods->iVersion, 2 ) : 1;
+        }
+
+        int read( file_type& file, void* buffer, int amount, sqlite3_int64 offset )
+        {
+            return file.real->pMethods->xRead( file.real, buffer, amount, offset );
+        }
+        int write( file_type& file, void const* buffer, int amount, sqlite3_int64 offset )
+        {
+            return file.real->pMethods->xWrite( file.real, buffer, amount, offset );
+        }
+        int truncate( file_type& file, sqlite3_int64 size )
+        {
+            return file.real->pMethods->xTruncate( file.real, size );
+        }
+        int sync( file_type& file, int flags )
+        {
+            return file.real->pMethods->xSync( file.real, flags );
+        }
+        int file_size( file_type& file, sqlite3_int64* size )
+        {
+            return file.real->pMethods->xFileSize( file.real, size );
+        }
+        int lock( file_type& file, int level )
+        {
+            return file.real->pMethods->xLock( file.real, level );
+        }
+        int unlock( file_type& file, int level )
+        {
+            return file.real->pMethods->xUnlock( file.real, level );
+        }
+        int check_reserved_lock( file_type& file, int* reserved )
+        {
+            return file.real->pMethods->xCheckReservedLock( file.real, reserved );
+        }
+        int file_control( file_type& file, int op, void* argument )
+        {
+            return file.real->pMethods->xFileControl( file.real, op, argument );
+        }
+        int sector_size( file_type& file )
+        {
+            return file.real->pMethods->xSectorSize( file.real );
+        }
+        int device_characteristics( file_type& file )
+        {
+            return file.real->pMethods->xDeviceCharacteristics( file.real );
+        }
+        int shm_map( file_type& file, int region, int region_size, int extend, void volatile** address )
+        {
+            return file.real->pMethods->xShmMap( file.real, region, region_size, extend, address );
+        }
+        int shm_lock( file_type& file, int offset, int n, int flags )
+        {
+            return file.real->pMethods->xShmLock( file.real, offset, n, flags );
+        }
+        void shm_barrier( file_type& file )
+        {
+            file.real->pMethods->xShmBarrier( file.real );
+        }
+        int shm_unmap( file_type& file, int remove )
+        {
+            return file.real->pMethods->xShmUnmap( file.real, remove );
+        }
+
+        int remove( char const* path, int sync_directory )
+        {
+            return _parent->xDelete( _parent, path, sync_directory );
+        }
+        int access( char const* path, int flags, int* result )
+        {
+            return _parent->xAccess( _parent, path, flags, result );
+        }
+        int full_pathname( char const* path, int size, char* output )
+        {
+            return _parent->xFullPathname( _parent, path, size, output );
+        }
+
+    private:
+        basic_vfs( basic_vfs const& );
+        basic_vfs& operator =( basic_vfs const& );
+
+        static Derived& derived( sqlite3_vfs* vfs )
+        {
+            return *static_cast< Derived* >( vfs->pAppData );
+        }
+        static sqlite3_vfs* parent( sqlite3_vfs* vfs )
+        {
+            return derived( vfs ).basic_vfs::_parent;
+        }
+
+        static file_type& file( sqlite3_file* handle )
+        {
+            return static_cast< file_type& >( *reinterpret_cast< vfs_file* >( handle ) );
+        }
+        static Derived& derived( file_type& file )
+        {
+            return *static_cast< Derived* >( file.vfs );
+        }
+
+        static sqlite3_io_methods const* io_methods( int version )
+        {
+            static sqlite3_io_methods const methods[] =
+            {
+                {
+                    1
+                  , &basic_vfs::x_close, &basic_vfs::x_read, &basic_vfs::x_write
+                  , &basic_vfs::x_truncate, &basic_vfs::x_sync, &basic_vfs::x_file_size
+                  , &basic_vfs::x_lock, &basic_vfs::x_unlock, &basic_vfs::x_check_reserved_lock
+                  , &basic_vfs::x_file_control, &basic_vfs::x_sector_size, &basic_vfs::x_device_characteristics
+                  , 0, 0, 0, 0
+                }
+              , {
+                    2
+                  , &basic_vfs::x_close, &basic_vfs::x_read, &basic_vfs::x_write
+                  , &basic_vfs::x_truncate, &basic_vfs::x_sync, &basic_vfs::x_file_size
+                  , &basic_vfs::x_lock, &basic_vfs::x_unlock, &basic_vfs::x_check_reserved_lock
+                  , &basic_vfs::x_file_control, &basic_vfs::x_sector_size, &basic_vfs::x_device_characteristics
+                  , &basic_vfs::x_shm_map, &basic_vfs::x_shm_lock, &basic_vfs::x_shm_barrier, &basic_vfs::x_shm_unmap
+                }
+            };
+            return &methods[ version >= 2 ? 1 : 0 ];
+        }
+
+    private:
+        static int x_open( sqlite3_vfs* vfs, char const* path, sqlite3_file* handle, int flags, int* out_flags )
+        {
+            Derived& self = derived( vfs );
+
+            file_type* file = new ( handle ) file_type();
+            file->real = reinterpret_cast< sqlite3_file* >( reinterpret_cast< unsigned char* >( handle ) + detail::vfs_file_offset( sizeof( file_type ) ) );
+            file->real->pMethods = 0;
+            file->flags = flags;
+            file->vfs = &self;
+
+            int const result = self.open( *file, path, flags, out_flags );
+            if( result != SQLITE_OK )
+            {
+                // the parent may want its file closed even if it failed to open
+                if( file->real->pMethods != 0 )
+                    file->real->pMethods->xClose( file->real );
+                file->~file_type();
+                handle->pMethods = 0;
+
+                return result;
+            }
+
+            handle->pMethods = io_methods( self.methods_version( *file ) );
+            return SQLITE_OK;
+        }
+        static int x_delete( sqlite3_vfs* vfs, char const* path, int sync_directory )
+        {
+            return derived( vfs ).remove( path, sync_directory );
+        }
+        static int x_access( sqlite3_vfs* vfs, char const* path, int flags, int* result )
+        {
+            return derived( vfs ).access( path, flags, result );
+        }
+        static int x_full_pathname( sqlite3_vfs* vfs, char const* path, int size, char* output )
+        {
+            return derived( vfs ).full_pathname( path, size, output );
+        }
+        static void* x_dl_open( sqlite3_vfs* vfs, char const* path )
+        {
+            return parent( vfs )->xDlOpen( parent( vfs ), path );
+        }
+        static void x_dl_error( sqlite3_vfs* vfs, int size, char* message )
+        {
+            parent( vfs )->xDlError( parent( vfs ), size, message );
+        }
+        static void ( *x_dl_sym( sqlite3_vfs* vfs, void* library, char const* symbol ) )( void )
+        {
+            return parent( vfs )->xDlSym( parent( vfs ), library, symbol );
+        }
+        static void x_dl_close( sqlite3_vfs* vfs, void* library )
+        {
+            parent( vfs )->xDlClose( parent( vfs ), library );
+        }
+        static int x_randomness( sqlite3_vfs* vfs, int size, char* output )
+        {
+            return parent( vfs )->xRandomness( parent( vfs ), size, output );
+        }
+        static int x_sleep( sqlite3_vfs* vfs, int microseconds )
+        {
+            return parent( vfs )->xSleep( parent( vfs ), microseconds );
+        }
+        static int x_current_time( sqlite3_vfs* vfs, double* time )
+        {
+            return parent( vfs )->xCurrentTime( parent( vfs ), time );
+        }
+        static int x_get_last_error( sqlite3_vfs* vfs, int size, char* message )
+        {
+            return parent( vfs )->xGetLastError( parent( vfs ), size, message );
+        }
+        static int x_current_time_int64( sqlite3_vfs* vfs, sqlite3_int64* time )
+        {
+            return parent( vfs )->xCurrentTimeInt64( parent( vfs ), time );
+        }
+        static int x_set_system_call( sqlite3_vfs* vfs, char const* name, sqlite3_syscall_ptr call )
+        {
+            return parent( vfs )->xSetSystemCall( parent( vfs ), name, call );
+        }
+        static sqlite3_syscall_ptr x_get_system_call( sqlite3_vfs* vfs, char const* name )
+        {
+            return parent( vfs )->xGetSystemCall( parent( vfs ), name );
+        }
+        static char const* x_next_system_call( sqlite3_vfs* vfs, char const* name )
+        {
+            return parent( vfs )->xNextSystemCall( parent( vfs ), name );
+        }
+
+        static int x_close( sqlite3_file* handle )
+        {
+            file_type& f = file( handle );
+
+            int const result = derived( f ).close( f );
+            f.~file_type();
+            return result;
+        }
+        static int x_read( sqlite3_file* handle, void* buffer, int amount, sqlite3_int64 offset )
+        {
+            file_type& f = file( handle );
+            return derived( f ).read( f, buffer, amount, offset );
+        }
+        static int x_write( sqlite3_file* handle, void const* buffer, int amount, sqlite3_int64 offset )
+        {
+            file_type& f = file( handle );
+            return derived( f ).write( f, buffer, amount, offset );
+        }
+        static int x_truncate( sqlite3_file* handle, sqlite3_int64 size )
+        {
+            file_type& f = file( handle );
+            return derived( f ).truncate( f, size );
+        }
+        static int x_sync( sqlite3_file* handle, int flags )
+        {
+            file_type& f = file( handle );
+            return derived( f ).sync( f, flags );
+        }
+        static int x_file_size( sqlite3_file* handle, sqlite3_int64* size )
+        {
+            file_type& f = file( handle );
+            return derived( f ).file_size( f, size );
+        }
+        static int x_lock( sqlite3_file* handle, int level )
+        {
+            file_type& f = file( handle );
+            return derived( f ).lock( f, level );
+        }
+        static int x_unlock( sqlite3_file* handle, int level )
+        {
+            file_type& f = file( handle );
+            return derived( f ).unlock( f, level );
+        }
+        static int x_check_reserved_lock( sqlite3_file* handle, int* reserved )
+        {
+            file_type& f = file( handle );
+            return derived( f ).check_reserved_lock( f, reserved );
+        }
+        static int x_file_control( sqlite3_file* handle, int op, void* argument )
+        {
+            file_type& f = file( handle );
+            return derived( f ).file_control( f, op, argument );
+        }
+        static int x_sector_size( sqlite3_file* handle )
+        {
+            file_type& f = file( handle );
+            return derived( f ).sector_size( f );
+        }
+        static int x_device_characteristics( sqlite3_file* handle )
+        {
+            file_type& f = file( handle );
+            return derived( f ).device_characteristics( f );
+        }
+        static int x_shm_map( sqlite3_file* handle, int region, int region_size, int extend, void volatile** address )
+        {
+            file_type& f = file( handle );
+            return derived( f ).shm_map( f, region, region_size, extend, address );
+        }
+        static int x_shm_lock( sqlite3_file* handle, int offset, int n, int flags )
+        {
+            file_type& f = file( handle );
+            return derived( f ).shm_lock( f, offset, n, flags );
+        }
+        static void x_shm_barrier( sqlite3_file* handle )
+        {
+            file_type& f = file( handle );
+            derived( f ).shm_barrier( f );
+        }
+        static int x_shm_unmap( sqlite3_file* handle, int remove )
+        {
+            file_type& f = file( handle );
+            return derived( f ).shm_unmap( f, remove );
+        }
+
+    private:
+        std::string _name;
+        sqlite3_vfs* _parent;
+        sqlite3_vfs _vfs;
+    };
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_VFS_HPP*/
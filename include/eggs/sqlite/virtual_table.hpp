@@ -0,0 +1,408 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/virtual_table.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_VIRTUAL_TABLE_HPP
+#define EGGS_SQLITE_VIRTUAL_TABLE_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <boost/throw_exception.hpp>
+
+#include <cstring>
+
+#include <exception>
+#include <new>
+#include <string>
+
+namespace eggs { namespace sqlite {
+
+    // the common part of every table of a basic_module, table types given to
+    // basic_module must derive from it
+    struct virtual_table
+    {
+        virtual_table()
+          : module( 0 )
+        {
+            std::memset( &base, 0, sizeof( base ) );
+        }
+
+        sqlite3_vtab base;
+        void* module;
+    };
+
+    // the common part of every cursor of a basic_module, cursor types given
+    // to basic_module must derive from it
+    struct virtual_table_cursor
+    {
+        virtual_table_cursor()
+        {
+            std::memset( &base, 0, sizeof( base ) );
+        }
+
+        sqlite3_vtab_cursor base;
+    };
+
+    namespace detail {
+
+        // reports the exception being handled as the error of a table
+        inline int virtual_table_error( sqlite3_vtab* table )
+        {
+            char const* message = "unknown exception";
+            int result = SQLITE_ERROR;
+            try
+            {
+                throw;
+            } catch( std::bad_alloc const& ) {
+                return SQLITE_NOMEM;
+            } catch( sqlite_error const& e ) {
+                message = e.what();
+                result = e.code().value();
+            } catch( std::exception const& e ) {
+                message = e.what();
+            } catch( ... ) {}
+
+            sqlite3_free( table->zErrMsg );
+            table->zErrMsg = sqlite3_mprintf( "%s", message );
+            return result;
+        }
+
+        // arguments to a virtual table may be quoted
+        inline std::string virtual_table_argument( char const* argument )
+        {
+            std::string result( argument );
+            if( result.size() >= 2 && ( result[ 0 ] == '\'' || result[ 0 ] == '"' ) && result[ result.size() - 1 ] == result[ 0 ] )
+                result = result.substr( 1, result.size() - 2 );
+            return result;
+        }
+
+    } // namespace detail
+
+    // a read-only virtual table module; Derived provides
+    //
+    //   int connect( sqlite3* db, table_type& table, int argc, char const* const* argv, std::string& schema );
+    //   int best_index( table_type& table, sqlite3_index_info* info );
+    //   int filter( cursor_type& cursor, int index, char const* index_string, int argc, sqlite3_value** argv );
+    //   int next( cursor_type& cursor );
+    //   bool eof( cursor_type& cursor );
+    //   int column( cursor_type& cursor, sqlite3_context* context, int column );
+    //   int rowid( cursor_type& cursor, sqlite3_int64* rowid );
+    //
+    // and hides any of the hooks below to change behavior; hooks may throw,
+    // exceptions are reported as errors of the table
+    template< typename Derived, typename Table = virtual_table, typename Cursor = virtual_table_cursor >
+    class basic_module
+    {
+    public:
+        typedef sqlite3_module const* native_handle_type;
+
+        typedef Table table_type;
+        typedef Cursor cursor_type;
+
+    public:
+        native_handle_type native_handle() const
+        {
+            return &_module;
+        }
+
+    protected:
+        // an eponymous module can be used as a table of the same name, or as
+        // a table-valued function, without a CREATE VIRTUAL TABLE
+        explicit basic_module( bool eponymous = false )
+        {
+            std::memset( &_module, 0, sizeof( _module ) );
+            _module.iVersion = 1;
+            _module.xCreate = eponymous ? &basic_module::x_connect : &basic_module::x_create;
+            _module.xConnect = &basic_module::x_connect;
+            _module.xBestIndex = &basic_module::x_best_index;
+            _module.xDisconnect = &basic_module::x_disconnect;
+            _module.xDestroy = &basic_module::x_destroy;
+            _module.xOpen = &basic_module::x_open;
+            _module.xClose = &basic_module::x_close;
+            _module.xFilter = &basic_module::x_filter;
+            _module.xNext = &basic_module::x_next;
+            _module.xEof = &basic_module::x_eof;
+            _module.xColumn = &basic_module::x_column;
+            _module.xRowid = &basic_module::x_rowid;
+            _module.xRename = &basic_module::x_rename;
+        }
+
+        // called for CREATE VIRTUAL TABLE, connects by default
+        int create( sqlite3* db, table_type& table, int argc, char const* const* argv, std::string& schema )
+        {
+            return derived().connect( db, table, argc, argv, schema );
+        }
+        int disconnect( table_type& /*table*/ )
+        {
+            return SQLITE_OK;
+        }
+        // called for DROP TABLE, disconnects by default
+        int destroy( table_type& table )
+        {
+            return derived().disconnect( table );
+        }
+
+        int open( table_type& /*table*/, cursor_type& /*cursor*/ )
+        {
+            return SQLITE_OK;
+        }
+        int close( cursor_type& /*cursor*/ )
+        {
+            return SQLITE_OK;
+        }
+
+        int rename( table_type& /*table*/, char const* /*name*/ )
+        {
+            return SQLITE_OK;
+        }
+
+        static table_type& table( cursor_type& cursor )
+        {
+            return static_cast< table_type& >( *reinterpret_cast< virtual_table* >( cursor.base.pVtab ) );
+        }
+
+    private:
+        basic_module( basic_module const& );
+        basic_module& operator =( basic_module const& );
+
+        Derived& derived()
+        {
+            return *static_cast< Derived* >( this );
+        }
+
+        static table_type& table( sqlite3_vtab* handle )
+        {
+            return static_cast< table_type& >( *reinterpret_cast< virtual_table* >( handle ) );
+        }
+        static cursor_type& cursor( sqlite3_vtab_cursor* handle )
+        {
+            return static_cast< cursor_type& >( *reinterpret_cast< virtual_table_cursor* >( handle ) );
+        }
+        static Derived& derived( table_type& table )
+        {
+            return *static_cast< Derived* >( table.module );
+        }
+
+        template< bool Create >
+        static int construct(
+            sqlite3* db, void* module, int argc, char const* const* argv
+          , sqlite3_vtab** handle, char** error
+        )
+        {
+            Derived& self = *static_cast< Derived* >( module );
+
+            table_type* t = new ( std::nothrow ) table_type();
+            if( t == 0 )
+                return SQLITE_NOMEM;
+            t->module = &self;
+
+            int result = SQLITE_OK;
+            bool connected = false;
+            try
+            {
+                std::string schema;
+                result = Create
+                  ? self.create( db, *t, argc, argv, schema )
+                  : self.connect( db, *t, argc, argv, schema );
+                connected = result == SQLITE_OK;
+                if( connected )
+                    result = sqlite3_declare_vtab( db, schema.c_str() );
+            } catch( ... ) {
+                result = detail::virtual_table_error( &t->base );
+            }
+
+            if( result != SQLITE_OK )
+            {
+                if( connected )
+                    self.disconnect( *t );
+                *error = t->base.zErrMsg;
+                delete t;
+                return result;
+            }
+
+            *handle = &t->base;
+            return SQLITE_OK;
+        }
+
+    private:
+        static int x_create( sqlite3* db, void* module, int argc, char const* const* argv, sqlite3_vtab** handle, char** error )
+        {
+            return construct< true >( db, module, argc, argv, handle, error );
+        }
+        static int x_connect( sqlite3* db, void* module, int argc, char const* const* argv, sqlite3_vtab** handle, char** error )
+        {
+            return construct< false >( db, module, argc, argv, handle, error );
+        }
+        static int x_best_index( sqlite3_vtab* handle, sqlite3_index_info* info )
+        {
+            table_type& t = table( handle );
+            try
+            {
+                return derived( t ).best_index( t, info );
+            } catch( ... ) {
+                return detail::virtual_table_error( handle );
+            }
+        }
+        static int x_disconnect( sqlite3_vtab* handle )
+        {
+            table_type& t = table( handle );
+
+            int const result = derived( t ).disconnect( t );
+            sqlite3_free( t.base.zErrMsg );
+            delete &t;
+            return result;
+        }
+        static int x_destroy( sqlite3_vtab* handle )
+        {
+            table_type& t = table( handle );
+
+            int const result = derived( t ).destroy( t );
+            sqlite3_free( t.base.zErrMsg );
+            delete &t;
+            return result;
+        }
+        static int x_open( sqlite3_vtab* handle, sqlite3_vtab_cursor** cursor_handle )
+        {
+            table_type& t = table( handle );
+
+            cursor_type* c = new ( std::nothrow ) cursor_type();
+            if( c == 0 )
+                return SQLITE_NOMEM;
+
+            int result = SQLITE_OK;
+            try
+            {
+                result = derived( t ).open( t, *c );
+            } catch( ... ) {
+                result = detail::virtual_table_error( handle );
+            }
+            if( result != SQLITE_OK )
+            {
+                delete c;
+                return result;
+            }
+
+            *cursor_handle = &c->base;
+            return SQLITE_OK;
+        }
+        static int x_close( sqlite3_vtab_cursor* handle )
+        {
+            cursor_type& c = cursor( handle );
+            table_type& t = table( handle->pVtab );
+
+            int const result = derived( t ).close( c );
+            delete &c;
+            return result;
+        }
+        static int x_filter( sqlite3_vtab_cursor* handle, int index, char const* index_string, int argc, sqlite3_value** argv )
+        {
+            table_type& t = table( handle->pVtab );
+            try
+            {
+                return derived( t ).filter( cursor( handle ), index, index_string, argc, argv );
+            } catch( ... ) {
+                return detail::virtual_table_error( handle->pVtab );
+            }
+        }
+        static int x_next( sqlite3_vtab_cursor* handle )
+        {
+            table_type& t = table( handle->pVtab );
+            try
+            {
+                return derived( t ).next( cursor( handle ) );
+            } catch( ... ) {
+                return detail::virtual_table_error( handle->pVtab );
+            }
+        }
+        static int x_eof( sqlite3_vtab_cursor* handle )
+        {
+            table_type& t = table( handle->pVtab );
+            return derived( t ).eof( cursor( handle ) ) ? 1 : 0;
+        }
+        static int x_column( sqlite3_vtab_cursor* handle, sqlite3_context* context, int column )
+        {
+            table_type& t = table( handle->pVtab );
+            try
+            {
+                return derived( t ).column( cursor( handle ), context, column );
+            } catch( ... ) {
+                return detail::virtual_table_error( handle->pVtab );
+            }
+        }
+        static int x_rowid( sqlite3_vtab_cursor* handle, sqlite3_int64* rowid )
+        {
+            table_type& t = table( handle->pVtab );
+            try
+            {
+                return derived( t ).rowid( cursor( handle ), rowid );
+            } catch( ... ) {
+                return detail::virtual_table_error( handle->pVtab );
+            }
+        }
+        static int x_rename( sqlite3_vtab* handle, char const* name )
+        {
+            table_type& t = table( handle );
+            try
+            {
+                return derived( t ).rename( t, name );
+            } catch( ... ) {
+                return detail::virtual_table_error( handle );
+            }
+        }
+
+    private:
+        sqlite3_module _module;
+    };
+
+    namespace detail {
+
+        template< typename Module >
+        void destroy_module( void* module )
+        {
+            delete static_cast< Module* >( module );
+        }
+
+    } // namespace detail
+
+    // registers a module with a connection, which takes ownership of it and
+    // destroys it when closed; SQLite destroys the module on failure as well
+    template< typename Module >
+    inline void create_module( database& db, std::string const& name, Module* module, boost::system::error_code& error_code )
+    {
+        int const result =
+            sqlite3_create_module_v2(
+                db.native_handle(), name.c_str()
+              , module->native_handle(), module
+              , &detail::destroy_module< Module >
+            );
+        error_code.assign( result, sqlite_category() );
+    }
+    template< typename Module >
+    inline void create_module( database& db, std::string const& name, Module* module )
+    {
+        int const result =
+            sqlite3_create_module_v2(
+                db.native_handle(), name.c_str()
+              , module->native_handle(), module
+              , &detail::destroy_module< Module >
+            );
+        if( result != SQLITE_OK )
+        {
+            BOOST_THROW_EXCEPTION( sqlite_error( result ) );
+        }
+    }
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_VIRTUAL_TABLE_HPP*/
@@ -0,0 +1,195 @@
+/**
+ * Eggs.SQLite <eggs/sqlite/warm_up.hpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+#ifndef EGGS_SQLITE_WARM_UP_HPP
+#define EGGS_SQLITE_WARM_UP_HPP
+
+#include <eggs/sqlite/detail/sqlite3.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/error.hpp>
+#include <eggs/sqlite/pragma.hpp>
+#include <eggs/sqlite/statement.hpp>
+#include <eggs/sqlite/statement_cache.hpp>
+#include <eggs/sqlite/status.hpp>
+
+#include <boost/chrono/duration.hpp>
+#include <boost/chrono/system_clocks.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <cstddef>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace eggs { namespace sqlite {
+
+    // a run of pages, numbered from 1 as SQLite does
+    struct page_range
+    {
+        boost::int64_t first;
+        boost::int64_t count;
+    };
+
+    struct warm_up_options
+    {
+        warm_up_options()
+          : index_bytes( 0 )
+        {}
+
+        // pages known to be hot, read straight from the file
+        std::vector< page_range > pages;
+
+        // read up to this many bytes from the start of every index, through
+        // SQLite so that they end up in its cache too; zero for none
+        std::size_t index_bytes;
+
+        // statements to compile into the cache
+        std::vector< std::string > statements;
+    };
+
+    struct warm_up_report
+    {
+        boost::uint64_t pages_read;
+        boost::uint64_t index_pages_read;
+        std::size_t statements_prepared;
+        boost::chrono::nanoseconds page_time;
+        boost::chrono::nanoseconds index_time;
+        boost::chrono::nanoseconds statement_time;
+    };
+
+    namespace detail {
+
+        inline std::string quote_identifier( std::string const& name )
+        {
+            std::string result( 1, '"' );
+            for( std::size_t i = 0; i < name.size(); ++i )
+            {
+                if( name[ i ] == '"' )
+                    result += '"';
+                result += name[ i ];
+            }
+            result += '"';
+            return result;
+        }
+
+        inline boost::chrono::nanoseconds elapsed( boost::chrono::steady_clock::time_point start )
+        {
+            return boost::chrono::duration_cast< boost::chrono::nanoseconds >(
+                boost::chrono::steady_clock::now() - start );
+        }
+
+        // reads pages through the vfs of the main database, which brings them
+        // into the operating system cache but not into that of SQLite
+        inline boost::uint64_t warm_up_pages( database& db, std::vector< page_range > const& pages )
+        {
+            sqlite3_file* file = 0;
+            sqlite3_file_control( db.native_handle(), "main", SQLITE_FCNTL_FILE_POINTER, &file );
+            if( file == 0 || file->pMethods == 0 )
+                return 0;
+
+            sqlite3_int64 size = 0;
+            file->pMethods->xFileSize( file, &size );
+
+            boost::int64_t const page_size = get_pragma< pragma::page_size >( db );
+            boost::int64_t const pages_per_read = 64;
+            std::vector< char > buffer( static_cast< std::size_t >( page_size * pages_per_read ) );
+
+            boost::uint64_t read = 0;
+            for( std::size_t i = 0; i < pages.size(); ++i )
+            {
+                boost::int64_t const last =
+                    (std::min)( pages[ i ].first + pages[ i ].count, boost::int64_t( size / page_size + 1 ) );
+                for( boost::int64_t page = (std::max)( pages[ i ].first, boost::int64_t( 1 ) ); page < last; page += pages_per_read )
+                {
+                    boost::int64_t const count = (std::min)( pages_per_read, last - page );
+                    if( file->pMethods->xRead( file, &buffer[ 0 ], static_cast< int >( count * page_size ), ( page - 1 ) * page_size ) != SQLITE_OK )
+                        break;
+                    read += count;
+                }
+            }
+            return read;
+        }
+
+        // scans every index of the main schema by rowid only, which is served
+        // from the index alone, until the scan has missed the cache for the
+        // given bytes; partial indexes cannot serve a scan with no condition,
+        // and indexes of tables without rowid cannot serve one by rowid, so
+        // these are skipped
+        inline boost::uint64_t warm_up_indexes( database& db, std::size_t bytes )
+        {
+            std::vector< std::pair< std::string, std::string > > indexes;
+            {
+                istatement list( db,
+                    "SELECT name, tbl_name FROM main.sqlite_master"
+                    " WHERE type = 'index' AND ( sql IS NULL OR sql NOT LIKE '%WHERE%' )" );
+                while( list.step() == istatement::status_code::row )
+                    indexes.push_back( std::make_pair( list.get< std::string >( 0 ), list.get< std::string >( 1 ) ) );
+            }
+
+            int const page_size = get_pragma< pragma::page_size >( db );
+            boost::uint64_t const budget = ( bytes + page_size - 1 ) / page_size;
+
+            boost::uint64_t read = 0;
+            for( std::size_t i = 0; i < indexes.size(); ++i )
+            {
+                int const start = get_status( db, database_status::cache_miss ).current;
+                int misses = 0;
+                try
+                {
+                    istatement scan( db,
+                        "SELECT rowid FROM main." + quote_identifier( indexes[ i ].second )
+                      + " INDEXED BY " + quote_identifier( indexes[ i ].first ) );
+
+                    while( static_cast< boost::uint64_t >( misses ) < budget && scan.step() == istatement::status_code::row )
+                        misses = get_status( db, database_status::cache_miss ).current - start;
+                } catch( sqlite_error const& ) {
+                    misses = get_status( db, database_status::cache_miss ).current - start;
+                }
+                read += misses;
+            }
+            return read;
+        }
+
+    } // namespace detail
+
+    // gets a freshly opened database ready to serve: reads the hot pages,
+    // the start of every index, and compiles the statements into the cache;
+    // only the main database is warmed up, attached ones are left alone
+    inline warm_up_report warm_up( database& db, warm_up_options const& options, statement_cache& cache )
+    {
+        warm_up_report report = {};
+
+        boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+        report.pages_read = detail::warm_up_pages( db, options.pages );
+        report.page_time = detail::elapsed( start );
+
+        if( options.index_bytes != 0 )
+        {
+            start = boost::chrono::steady_clock::now();
+            report.index_pages_read = detail::warm_up_indexes( db, options.index_bytes );
+            report.index_time = detail::elapsed( start );
+        }
+
+        start = boost::chrono::steady_clock::now();
+        for( std::size_t i = 0; i < options.statements.size(); ++i )
+            cache.prepare( options.statements[ i ] );
+        report.statements_prepared = options.statements.size();
+        report.statement_time = detail::elapsed( start );
+
+        return report;
+    }
+
+} } // namespace eggs::sqlite
+
+#endif /*EGGS_SQLITE_WARM_UP_HPP*/
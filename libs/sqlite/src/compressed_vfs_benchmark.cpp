@@ -0,0 +1,133 @@
+/**
+ * Eggs.SQLite <compressed_vfs_benchmark.cpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+// compresses a synthetic table of text, then compares the size of the
+// files and the time of a full scan of each; the databases are created
+// next to the path given as argument, or in the current directory
+
+#include <eggs/sqlite/compressed_vfs.hpp>
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/statement.hpp>
+
+#include <cstdio>
+
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <boost/chrono/duration.hpp>
+#include <boost/chrono/system_clocks.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <boost/exception/diagnostic_information.hpp>
+
+// runs a statement that returns at most one row
+inline void run( eggs::sqlite::database& db, std::string const& sql )
+{
+    eggs::sqlite::istatement statement( db, sql );
+    statement.step();
+}
+
+inline boost::int64_t file_size( std::string const& path )
+{
+    std::ifstream file( path.c_str(), std::ios::binary | std::ios::ate );
+    return file ? static_cast< boost::int64_t >( file.tellg() ) : 0;
+}
+
+inline void measure( eggs::sqlite::database& db, char const* label )
+{
+    namespace sqlite = eggs::sqlite;
+
+    boost::chrono::steady_clock::time_point const start = boost::chrono::steady_clock::now();
+
+    sqlite::istatement statement( db, "SELECT count( * ), sum( length( body ) ) FROM documents WHERE body LIKE '%seven%'" );
+    statement.step();
+    boost::int64_t const rows = statement.get< boost::int64_t >( 0 );
+
+    std::cout
+     << label << ": " << rows << " rows matched in "
+     << boost::chrono::duration_cast< boost::chrono::milliseconds >(
+            boost::chrono::steady_clock::now() - start ).count()
+     << "ms" "\n"
+     ;
+}
+
+int main( int argc, char* argv[] )
+{
+    namespace sqlite = eggs::sqlite;
+    try
+    {
+        std::string const path = argc > 1 ? argv[ 1 ] : "compressed_vfs_benchmark.db";
+        std::string const compressed = path + "z";
+        int const rows = 100000;
+
+        std::remove( path.c_str() );
+        std::remove( compressed.c_str() );
+        {
+            char const* const words[] = { "one", "two", "three", "four", "five", "six", "seven", "eight" };
+
+            sqlite::database db( path, sqlite::database::mode::read_write | sqlite::database::mode::create );
+            run( db, "CREATE TABLE documents( id INTEGER PRIMARY KEY, body TEXT )" );
+            run( db, "BEGIN" );
+            {
+                sqlite::ostatement insert( db, "INSERT INTO documents( body ) VALUES( ? )" );
+                boost::uint32_t seed = 1;
+                for( int i = 0; i < rows; ++i )
+                {
+                    std::string body;
+                    for( int j = 0; j < 40; ++j )
+                    {
+                        seed = seed * 1103515245 + 12345;
+                        body += words[ ( seed >> 16 ) % 8 ];
+                        body += ' ';
+                    }
+                    insert.put< std::string >( 0, body );
+                    insert.step();
+                }
+            }
+            run( db, "COMMIT" );
+        }
+
+        boost::chrono::steady_clock::time_point const start = boost::chrono::steady_clock::now();
+        sqlite::compress_database( path, compressed );
+        std::cout
+         << "compressed " << file_size( path ) << " bytes into " << file_size( compressed ) << " in "
+         << boost::chrono::duration_cast< boost::chrono::milliseconds >(
+                boost::chrono::steady_clock::now() - start ).count()
+         << "ms" "\n"
+         ;
+
+        sqlite::compressed_vfs vfs;
+        sqlite::database::options options;
+        options.vfs = vfs.name();
+
+        sqlite::database plain( path, sqlite::database::mode::read_only );
+        sqlite::database packed( compressed, sqlite::database::mode::read_only, options );
+        for( int round = 0; round < 3; ++round )
+        {
+            measure( plain, "plain" );
+            measure( packed, "compressed" );
+        }
+    } catch( std::exception const& e ) {
+        std::cerr
+            << "something went wrong" "\n"
+            << boost::diagnostic_information( e ) << std::endl
+            ;
+    } catch( ... ) {
+        std::cerr
+            << "something went really wrong..." << std::endl
+            ;
+    }
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+/**
+ * Eggs.SQLite <function_benchmark.cpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+// compares the cost of a call through create_function against that of a
+// handwritten C callback and of the same expression with no function at all
+
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/function.hpp>
+#include <eggs/sqlite/statement.hpp>
+
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include <boost/chrono/duration.hpp>
+#include <boost/chrono/system_clocks.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <boost/exception/diagnostic_information.hpp>
+
+// runs a statement that returns at most one row
+inline void run( eggs::sqlite::database& db, std::string const& sql )
+{
+    eggs::sqlite::istatement statement( db, sql );
+    statement.step();
+}
+
+inline boost::int64_t add_three( boost::int64_t value )
+{
+    return value + 3;
+}
+
+inline void c_add_three( sqlite3_context* context, int /*count*/, sqlite3_value** values )
+{
+    sqlite3_result_int64( context, sqlite3_value_int64( values[ 0 ] ) + 3 );
+}
+
+inline void measure( eggs::sqlite::database& db, char const* sql )
+{
+    namespace sqlite = eggs::sqlite;
+
+    boost::chrono::steady_clock::time_point const start = boost::chrono::steady_clock::now();
+
+    sqlite::istatement statement( db, sql );
+    statement.step();
+    boost::int64_t const result = statement.get< boost::int64_t >( 0 );
+
+    std::cout
+     << sql << ": " << result << " in "
+     << boost::chrono::duration_cast< boost::chrono::milliseconds >(
+            boost::chrono::steady_clock::now() - start ).count()
+     << "ms" "\n"
+     ;
+}
+
+int main( int argc, char* argv[] )
+{
+    namespace sqlite = eggs::sqlite;
+    try
+    {
+        int const rows = 1000000;
+        int const rounds = 5;
+
+        sqlite::database db( ":memory:" );
+        sqlite::create_function( db, "add_three", &add_three, sqlite::function_flags::deterministic );
+        sqlite3_create_function_v2(
+            db.native_handle(), "c_add_three", 1, SQLITE_UTF8 | sqlite::function_flags::deterministic
+          , 0, &c_add_three, 0, 0, 0
+        );
+
+        run( db, "CREATE TABLE numbers( value INTEGER )" );
+        run( db, "BEGIN" );
+        {
+            sqlite::ostatement insert( db, "INSERT INTO numbers VALUES( ? )" );
+            for( int i = 0; i < rows; ++i )
+            {
+                insert.put< boost::int64_t >( 0, i );
+                insert.step();
+            }
+        }
+        run( db, "COMMIT" );
+
+        for( int round = 0; round < rounds; ++round )
+        {
+            measure( db, "SELECT sum( value + 3 ) FROM numbers" );
+            measure( db, "SELECT sum( c_add_three( value ) ) FROM numbers" );
+            measure( db, "SELECT sum( add_three( value ) ) FROM numbers" );
+        }
+    } catch( std::exception const& e ) {
+        std::cerr
+            << "something went wrong" "\n"
+            << boost::diagnostic_information( e ) << std::endl
+            ;
+    } catch( ... ) {
+        std::cerr
+            << "something went really wrong..." << std::endl
+            ;
+    }
+
+    return 0;
+}
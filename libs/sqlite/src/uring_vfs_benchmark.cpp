@@ -0,0 +1,117 @@
+/**
+ * Eggs.SQLite <uring_vfs_benchmark.cpp>
+ * 
+ * Copyright Agustn Berg, Fusion Fenix 2012
+ * 
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ * 
+ * Library home page: http://github.com/eggs-cpp/eggs-sqlite
+ */
+
+// compares the time per commit of small write transactions through the
+// default vfs and through uring_vfs, for each journal mode; the database
+// is created at the path given as argument, or in the current directory
+
+#include <eggs/sqlite/database.hpp>
+#include <eggs/sqlite/statement.hpp>
+#include <eggs/sqlite/uring_vfs.hpp>
+
+#include <cstdio>
+
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include <boost/chrono/duration.hpp>
+#include <boost/chrono/system_clocks.hpp>
+
+#include <boost/exception/diagnostic_information.hpp>
+
+// runs a statement that returns at most one row
+inline void run( eggs::sqlite::database& db, std::string const& sql )
+{
+    eggs::sqlite::istatement statement( db, sql );
+    statement.step();
+}
+
+inline void remove_database( std::string const& path )
+{
+    std::remove( path.c_str() );
+    std::remove( ( path + "-journal" ).c_str() );
+    std::remove( ( path + "-wal" ).c_str() );
+    std::remove( ( path + "-shm" ).c_str() );
+}
+
+// microseconds per commit
+inline double measure( std::string const& path, std::string const& vfs, char const* mode, int commits )
+{
+    namespace sqlite = eggs::sqlite;
+
+    remove_database( path );
+
+    sqlite::database::options options;
+    options.vfs = vfs;
+
+    double result = 0;
+    {
+        sqlite::database db( path, sqlite::database::mode::read_write | sqlite::database::mode::create, options );
+        run( db, mode );
+        run( db, "CREATE TABLE blobs( value BLOB )" );
+
+        boost::chrono::steady_clock::time_point const start = boost::chrono::steady_clock::now();
+        for( int i = 0; i < commits; ++i )
+        {
+            run( db, "BEGIN" );
+            run( db, "INSERT INTO blobs VALUES( randomblob( 3000 ) )" );
+            run( db, "INSERT INTO blobs VALUES( randomblob( 3000 ) )" );
+            run( db, "UPDATE blobs SET value = randomblob( 100 ) WHERE rowid = 1" );
+            run( db, "COMMIT" );
+        }
+        result = boost::chrono::duration_cast< boost::chrono::microseconds >(
+            boost::chrono::steady_clock::now() - start ).count() / double( commits );
+    }
+
+    remove_database( path );
+    return result;
+}
+
+int main( int argc, char* argv[] )
+{
+    namespace sqlite = eggs::sqlite;
+    try
+    {
+        std::string const path = argc > 1 ? argv[ 1 ] : "uring_vfs_benchmark.db";
+        int const commits = 300;
+
+        char const* const modes[] = {
+            "PRAGMA journal_mode=DELETE"
+          , "PRAGMA journal_mode=TRUNCATE"
+          , "PRAGMA journal_mode=WAL"
+        };
+
+        sqlite::uring_vfs uring;
+        for( std::size_t i = 0; i < sizeof( modes ) / sizeof( modes[ 0 ] ); ++i )
+        {
+            double const parent = measure( path, "", modes[ i ], commits );
+            double const batched = measure( path, uring.name(), modes[ i ], commits );
+
+            std::cout
+             << modes[ i ] << ": "
+             << "default " << parent << "us, "
+             << "uring " << batched << "us per commit" "\n"
+             ;
+        }
+    } catch( std::exception const& e ) {
+        std::cerr
+            << "something went wrong" "\n"
+            << boost::diagnostic_information( e ) << std::endl
+            ;
+    } catch( ... ) {
+        std::cerr
+            << "something went really wrong..." << std::endl
+            ;
+    }
+
+    return 0;
+}